@@ -8,6 +8,8 @@
 
 #include <sys/socket.h>
 
+struct mmsghdr;                 /* defined by <sys/socket.h> with _GNU_SOURCE */
+struct timespec;
 
 /* Functions that wraps the libc. Basically initialize a function pointer the
  * first time a function is called, and then directly call the libc socket api
@@ -23,6 +25,10 @@ ssize_t libc_recvfrom(int fd, void *buf, size_t n, int flags,
                       struct sockaddr *addr, socklen_t *addr_len);
 ssize_t libc_sendmsg (int fd, const struct msghdr *message, int flags);
 ssize_t libc_recvmsg (int fd, struct msghdr *message, int flags);
+int libc_sendmmsg (int fd, struct mmsghdr *vmessages, unsigned int vlen,
+                   int flags);
+int libc_recvmmsg (int fd, struct mmsghdr *vmessages, unsigned int vlen,
+                   int flags, struct timespec *tmo);
 int libc_listen (int fd, int n);
 int libc_accept (int fd, struct sockaddr *addr, socklen_t *addr_len);
 int libc_shutdown (int fd, int how);
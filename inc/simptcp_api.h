@@ -13,6 +13,47 @@
  */
 #define IPPROTO_SIMPTCP	15
 
+/* socket options of level IPPROTO_SIMPTCP (int values) */
+#define SIMPTCP_GO_BACK_N 1 /* 1 : Go-Back-N sender, 0 : stop-and-wait (default) */
+#define SIMPTCP_SENDING_WINDOW 2 /* Go-Back-N sending window, in PDUs */
+#define SIMPTCP_RECEIVING_WINDOW 3 /* receive queue size, in PDUs, set before
+                                     connect or listen (SO_RCVBUF sets it in
+                                     bytes, rounded up to whole PDUs of the MSS) */
+#define SIMPTCP_SACK 4 /* 1 : hold out of sequence PDUs and advertise them in
+                          SACK options (selective repeat), 0 : drop them (default) */
+#define SIMPTCP_RTO_MIN 5 /* lower bound of the retransmission timeout, in ms */
+#define SIMPTCP_RTO_MAX 6 /* upper bound of the retransmission timeout, in ms */
+#define SIMPTCP_TIMESTAMPS 7 /* 1 : data PDUs carry the timestamp option, whose
+                                echo gives an RTT sample per ACK (default) */
+#define SIMPTCP_MAXSEG 8 /* MSS announced in the SYN (set before connect or
+                            listen), then the negotiated MSS, in bytes */
+#define SIMPTCP_DELAYED_ACK 9 /* longest delay of an acknowledgement, in ms (every
+                                 second in sequence PDU is acknowledged at once);
+                                 0 : every PDU is acknowledged at once (default) */
+#define SIMPTCP_CONGESTION 10 /* congestion control algorithm of the sender
+                                 (SIMPTCP_CC_* below, set before sending) */
+#define SIMPTCP_CWND 11 /* congestion window, in PDUs (read only) */
+#define SIMPTCP_PACING_RATE 12 /* sending rate set by the congestion control,
+                                  in bytes/s, 0 : not paced (read only) */
+#define SIMPTCP_MAX_PACING_RATE 13 /* bound of the pacing rate, in bytes/s; the
+                                      PDUs are paced at this rate if the
+                                      congestion control sets none
+                                      (0 : no bound, default) */
+/* SO_SNDBUF (level SOL_SOCKET) sets the send queue in bytes, rounded up to
+   whole PDUs of the MSS (default : 64 PDUs, at least twice the sending
+   window); send() returns once the message is queued and only blocks (fails
+   with EAGAIN under MSG_DONTWAIT) when the queue is full */
+
+/* congestion control algorithms (SIMPTCP_CONGESTION values) */
+#define SIMPTCP_CC_NONE 0 /* fixed window : the sending window alone */
+#define SIMPTCP_CC_NEWRENO 1 /* loss based, NewReno [RFC5681, RFC6582] (default) */
+#define SIMPTCP_CC_BBR 2 /* model based : bottleneck bandwidth and min RTT
+                            estimates drive cwnd and the pacing rate (BBR) */
+#define SIMPTCP_CC_LEDBAT 3 /* less than best effort, delay based (LEDBAT
+                               [RFC6817]) : yields to other traffic as soon
+                               as the queueing delay grows, for background
+                               bulk transfers */
+
 int socket(int domain, int type, int protocol);
 int bind (int fd, const struct sockaddr *addr, socklen_t len);
 int connect (int fd, const struct sockaddr *addr, socklen_t len);
@@ -0,0 +1,107 @@
+/*! \file simptcp_cc.h
+*  \brief{Pluggable congestion control of the simptcp sender : an algorithm is
+*  a table of functions called on the events of a connection (ACK, loss
+*  detected by duplicate ACKs, retransmission timeout), in the spirit of the
+*  socket state function tables. It keeps the congestion window (cwnd) and the
+*  slow start threshold (ssthresh) of the socket up to date, in PDUs; the
+*  sender keeps at most min(cwnd, sending window) PDUs in flight.}
+*/
+
+#ifndef _SIMPTCP_CC_H_
+#define _SIMPTCP_CC_H_
+
+#include <stdint.h>
+
+struct simptcp_socket;
+
+#define SIMPTCP_CC_INITIAL_WINDOW 10 /* IW, in PDUs [RFC6928] */
+#define SIMPTCP_CC_MIN_SSTHRESH 2 /* lower bound of ssthresh, in PDUs [RFC5681] */
+#define SIMPTCP_CC_PRIV_SIZE 128 /* per socket state of an algorithm, in bytes */
+
+/* per socket state of the algorithm attached to sock */
+#define simptcp_cc_priv(sock) ((void *) (sock)->cc_priv)
+/* compilation fails if the state of an algorithm does not fit in cc_priv */
+#define SIMPTCP_CC_PRIV_CHECK(type) \
+    typedef char type##_fits_cc_priv[(sizeof(struct type) <= SIMPTCP_CC_PRIV_SIZE) ? 1 : -1]
+
+/*!
+ * \struct simptcp_rate_sample
+ * \brief what an ACK tells the sender : PDUs newly acknowledged, RTT and
+ * delivery rate samples
+ */
+struct simptcp_rate_sample
+{
+    unsigned int acked; /*!< PDUs newly acknowledged, 0 for a duplicate ACK */
+    double rtt; /*!< RTT sample in s, 0 if none */
+    double owd; /*!< one-way delay sample in s (peer timestamp of the ACK less
+                  the timestamp it echoes : includes the clock offset of the
+                  peer), meaningful if owd_valid */
+    unsigned char owd_valid; /*!< 1 : the ACK carries the timestamp option */
+    unsigned long prior_delivered; /*!< delivered when the newest acknowledged
+                                     PDU was sent */
+    unsigned int delivered; /*!< PDUs delivered since then, 0 : no rate sample */
+    uint64_t interval_us; /*!< over this interval, in us */
+};
+
+/**
+ * function pointer whose function gets called when the algorithm is attached
+ * to a socket (socket creation, setsockopt, accept) : it sets cwnd, ssthresh
+ * and its own state
+ */
+typedef void (simptcp_cc_init)
+(struct simptcp_socket* sock);
+
+/**
+ * function pointer whose function gets called for each new or duplicate ACK
+ * received by the sender, with its samples. Fast recovery state
+ * (fast_recovery, recover) and the delivered count are already updated by
+ * the ACK.
+ */
+typedef void (simptcp_cc_on_ack)
+(struct simptcp_socket* sock, const struct simptcp_rate_sample *rs);
+
+/**
+ * function pointer whose function gets called when a loss is detected by
+ * duplicate ACKs, before the fast retransmit (fast recovery entered)
+ */
+typedef void (simptcp_cc_on_loss)
+(struct simptcp_socket* sock);
+
+/**
+ * function pointer whose function gets called when the retransmission timer
+ * expires, before the unacked PDUs are sent again
+ */
+typedef void (simptcp_cc_on_rto)
+(struct simptcp_socket* sock);
+
+/**
+ * \brief It gathers the functions of a congestion control algorithm
+ */
+typedef struct simptcp_cc_ops
+{
+    const char *name;
+    simptcp_cc_init     *init;
+    simptcp_cc_on_ack   *on_ack;
+    simptcp_cc_on_loss  *on_loss;
+    simptcp_cc_on_rto   *on_rto;
+} simptcp_cc_ops;
+
+/* algorithms, indexed by the SIMPTCP_CC_* values of simptcp_api.h */
+extern const simptcp_cc_ops *simptcp_cc_algorithms[];
+extern const unsigned int simptcp_cc_algorithm_count;
+
+extern const simptcp_cc_ops simptcp_cc_none;
+extern const simptcp_cc_ops simptcp_cc_newreno;
+extern const simptcp_cc_ops simptcp_cc_bbr;
+extern const simptcp_cc_ops simptcp_cc_ledbat;
+
+/* attach algorithm id to a socket; -EINVAL if unknown */
+int simptcp_cc_set(struct simptcp_socket *sock, int id);
+/* id of the algorithm of a socket */
+int simptcp_cc_get(struct simptcp_socket *sock);
+/* PDUs the sender may have in flight : min(cwnd, sending window) */
+unsigned int simptcp_cc_window(struct simptcp_socket *sock);
+
+#endif /* _SIMPTCP_CC_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,44 @@
+/*! \file simptcp_demux.h
+*  \brief{Hash tables used by the simptcp entity to demultiplex received PDUs :
+*  connected sockets are keyed on (local port, remote address, remote port),
+*  listening sockets on their local port}
+*/
+
+#ifndef _SIMPTCP_DEMUX_H_
+#define _SIMPTCP_DEMUX_H_
+
+#include <stdint.h>
+#include <simptcp_lib.h>
+
+#define SIMPTCP_DEMUX_BUCKETS (1 << 16) /* default number of connection buckets */
+#define SIMPTCP_DEMUX_LISTEN_BUCKETS 256 /* number of listener buckets */
+
+/*!
+ * \enum simptcp_demux_tables
+ * \brief table in which a simpTCP socket is registered (field demux_table)
+ */
+enum simptcp_demux_tables
+{
+    demux_none=0,
+    demux_connection=1,
+    demux_listener=2
+};
+
+/* allocate the tables; buckets is rounded up to a power of two */
+int simptcp_demux_init(unsigned int buckets);
+
+/* register a socket whose local and remote SAP addresses are set */
+void simptcp_demux_insert_connection(struct simptcp_socket *sock);
+/* register a listening socket on its local port */
+void simptcp_demux_insert_listener(struct simptcp_socket *sock);
+/* unregister a socket from the table it belongs to (if any) */
+void simptcp_demux_remove(struct simptcp_socket *sock);
+
+/* lock free lookups; ports and address in network byte order */
+struct simptcp_socket *simptcp_demux_lookup_connection(uint16_t lport,
+        uint32_t raddr, uint16_t rport);
+struct simptcp_socket *simptcp_demux_lookup_listener(uint16_t lport);
+
+#endif /* _SIMPTCP_DEMUX_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
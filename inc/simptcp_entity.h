@@ -9,12 +9,63 @@
 #include <stdint.h>             /* for INT32_MAX */
 #include <pthread.h>            /* for pthread_mutex_t, pthread_cond_t */
 #include <sys/socket.h>
+#include <sys/uio.h>            /* for struct iovec */
 #include <netinet/in.h>
 #include <simptcp_lib.h>
 
-#define MAX_OPEN_SOCK 5 /* the maximum number of open sockets */
-#define ETH_MTU 1500 /* Ethernet Max transmit Unit */
-#define  MAX_SIMPTCP_BUFFER_SIZE (ETH_MTU-20-8) /* to avoid IP fragmentation */
+#define SIMPTCP_DEFAULT_MAX_OPEN_SOCK 65536 /* default maximum number of open sockets */
+#define SIMPTCP_FD_CHUNK 256 /* descriptors added at once when the table grows */
+#define SIMPTCP_PCB_SLAB 64 /* simptcp_socket structures allocated at once by the PCB pool */
+#define SIMPTCP_DEFAULT_RX_BATCH 32 /* default number of PDUs read per recvmmsg */
+#define SIMPTCP_MAX_RX_BATCH 1024 /* upper bound of the receive batch (UIO_MAXIOV) */
+#define SIMPTCP_RX_BATCHES_PER_WAKEUP 4 /* recvmmsg batches read before timers run */
+#define SIMPTCP_TX_QUEUE_SIZE 64 /* number of PDUs the transmit queue can hold */
+#define SIMPTCP_TX_HIGH_WATER 32 /* queue occupation that triggers a sendmmsg */
+
+/*!
+ * \struct simptcp_rx_slot
+ * \brief element de l'anneau de reception de l'entite : un PDU simpTCP recu
+ * et l'adresse du socket UDP qui l'a emis
+ */
+struct simptcp_rx_slot
+{
+    char * buffer; /*!< received PDU, max_pdu_size bytes plus one spare byte
+                     for the odd length checksum padding */
+    struct sockaddr_in udp_remote; /*!< udp remote SAP from which the PDU originates */
+};
+
+/*!
+ * \struct simptcp_tx_slot
+ * \brief element de la file d'emission de l'entite : un PDU simpTCP a emettre
+ * et l'adresse du socket UDP destinataire
+ */
+struct simptcp_tx_slot
+{
+    char * buffer; /*!< PDU to transmit, up to max_pdu_size bytes */
+    struct sockaddr_in udp_remote; /*!< udp remote SAP the PDU is destined to */
+};
+
+/*!
+ * \struct simptcp_entity_stats
+ * \brief compteurs (MIB) propres a l'entite simpTCP
+ */
+struct simptcp_entity_stats
+{
+    unsigned long rx_batch_count; /*!< number of non empty recvmmsg batches */
+    unsigned long rx_pdu_count; /*!< number of received UDP datagrams */
+    unsigned long rx_bad_checksum_count; /*!< number of dropped corrupted PDUs */
+    unsigned long rx_bad_header_count; /*!< number of dropped PDUs whose lengths
+                                         do not match the datagram */
+    unsigned long rx_no_socket_count; /*!< number of PDUs matching no simpTCP socket */
+    unsigned long rx_emulated_loss_count; /*!< number of PDUs dropped by the loss emulation */
+    unsigned long rx_fast_path_count; /*!< number of PDUs processed by the header prediction */
+    unsigned long rx_slow_path_count; /*!< number of PDUs processed by the state machine */
+    unsigned int rx_max_batch; /*!< largest batch read by a single recvmmsg */
+    unsigned long tx_batch_count; /*!< number of sendmmsg calls */
+    unsigned long tx_pdu_count; /*!< number of transmitted PDUs */
+    unsigned long tx_error_count; /*!< number of PDUs dropped on a send error */
+    unsigned int tx_max_batch; /*!< largest batch sent by a single sendmmsg */
+};
 
 /*!
 *  \struct simptcp
@@ -32,17 +83,52 @@
 */
 struct simptcp
 {
-    struct simptcp_socket *simptcp_socket_descriptors[MAX_OPEN_SOCK];/*!< SimpTCP socket descriptor table */
+    struct simptcp_socket *** simptcp_socket_descriptors;/*!< SimpTCP socket descriptor table :
+                                                            directory of chunks of #SIMPTCP_FD_CHUNK
+                                                            descriptors, allocated as the table grows */
+    unsigned int max_open_sockets; /*!< runtime limit of open simpTCP sockets */
+    unsigned int descriptors_high_water; /*!< descriptors below this one have been used once */
+    int * free_descriptors; /*!< stack of released descriptors, reused first */
+    unsigned int free_descriptors_count; /*!< number of released descriptors */
+    unsigned int free_descriptors_size; /*!< capacity of free_descriptors */
+    struct simptcp_socket * free_sockets; /*!< PCB pool : released simptcp_socket structures */
+    struct simptcp_socket * released_sockets; /*!< sockets closed by the application,
+                                                recycled by the entity handler */
+    pthread_mutex_t descriptors_mutex; /*!< protects descriptor allocation, the PCB pool
+                                         and the released sockets */
     struct simptcp_socket * simptcp_socket_list; /*!< Open simpTCP socket list */
     unsigned int open_simptcp_sockets; /*!< open simpTCP sockets number */
     unsigned int open_simptcp_connections; 	/*!< number of open simpTCP connections */
 
     int udp_fd; /*!< udp socket descriptor */
     struct sockaddr_in local_udp;  /*!< local UDP socket SAP address */
+    unsigned int mtu; /*!< MTU of the path to the peers (IP packet size) */
+    unsigned int max_pdu_size; /*!< largest PDU an UDP datagram carries
+                                 without IP fragmentation */
+    unsigned char pmtu_discovery; /*!< 1 : datagrams are sent with the DF bit
+                                    set and the senders probe the path MTU */
+
+    int epoll_fd; /*!< epoll instance waiting on udp_fd, timer_fd and wakeup_fd */
+    int timer_fd; /*!< timerfd armed for the earliest simpTCP socket deadline */
+    int wakeup_fd; /*!< eventfd used by the application to wake up the entity */
+
+    struct simptcp_rx_slot * in_ring; /*!< ring of rx_batch_size receive slots,
+                                        each provisionned for one single max_pdu_size PDU */
+    struct mmsghdr * in_msgs; /*!< recvmmsg descriptors of the in_ring slots */
+    struct iovec * in_iovs; /*!< io vectors of the in_ring slots */
+    unsigned int rx_batch_size; /*!< maximum number of PDUs read per recvmmsg */
+    double rx_loss_rate; /*!< probability of dropping a received PDU (loss
+                           emulation for tests and benchmarks, 0 by default) */
+
+    struct simptcp_tx_slot * out_ring; /*!< transmit queue : PDUs enqueued by the
+                                         socket state functions, drained by sendmmsg */
+    struct mmsghdr * out_msgs; /*!< sendmmsg descriptors of the out_ring slots */
+    struct iovec * out_iovs; /*!< io vectors of the out_ring slots */
+    unsigned int out_len; /*!< instantaneous transmit queue occupation */
+    pthread_mutex_t out_mutex; /*!< protects the transmit queue (the application
+                                 and the entity both enqueue) */
 
-    char in_buffer[MAX_SIMPTCP_BUFFER_SIZE]; /*!< SimpTCP socket Receive buffer used ;
-											  Provisionned for one single MAXSIZE PDU */
-    unsigned int in_len; /*!< instantaneous in_buffer occupation */
+    struct simptcp_entity_stats stats; /*!< entity MIB statistics */
 
 
 
@@ -65,8 +151,24 @@ struct simptcp simptcp_entity;
 
 
 
+/* set the receive batch size; to be called before start_simptcp */
+int simptcp_set_rx_batch_size(unsigned int n);
+/* set the MTU (IP packet size) the PDUs are sized for; to be called before start_simptcp */
+int simptcp_set_mtu(unsigned int mtu);
+/* enable path MTU discovery (DF bit and probes); to be called before start_simptcp */
+int simptcp_set_pmtu_discovery(int on);
+/* emulate a lossy link : drop received PDUs with probability rate */
+int simptcp_set_rx_loss_rate(double rate);
 /* create a simptcp_core handler */
 int start_simptcp (int local_udp);
+/* print the entity statistics */
+void print_simptcp_entity_stats();
+/* wake up the entity handler so that it re-arms its timer */
+void simptcp_entity_wakeup();
+/* queue a PDU for transmission to a remote UDP SAP */
+int simptcp_entity_enqueue_pdu(const char * pdu, int len, struct sockaddr_in * udp_remote);
+/* transmit all the queued PDUs */
+void simptcp_entity_flush();
 
 #endif /* _SIMPTCP_ENTITY_H_ */
 
@@ -10,13 +10,29 @@
 #include <pthread.h>            /* for pthread_mutex_t, pthread_cond_t */
 #include <sys/socket.h>
 #include <pthread.h>
+#include <simptcp_timer.h>
+#include <simptcp_queue.h>
+#include <simptcp_cc.h>
 
 
-#define ETH_MTU 1500 /* Ethernet Max transmit Unit */
-
-#define SIMPTCP_SOCKET_MAX_BUFFER_SIZE (ETH_MTU-16-20-8) /* SIMPTCP_MAX_SIZE to avoid IP 
-							    fragmentation assuming no IP options */
+/* control PDUs (connection management) are built in fixed size buffers, data
+   PDUs in the queues, sized from the MSS of the connection */
+#define SIMPTCP_SOCKET_MAX_BUFFER_SIZE SIMPTCP_MTU_PDU_SIZE(SIMPTCP_DEFAULT_MTU)
 #define MAX_RETRANSMIT 255  /* Maximum number of retransmissions */
+#define SIMPTCP_TIME_WAIT_DURATION 2000 /* 2*MSL, in ms */
+#define SIMPTCP_DEFAULT_WINDOW 16 /* default sending/receiving window, in PDUs */
+#define SIMPTCP_DEFAULT_SEND_QUEUE 64 /* default send queue (SO_SNDBUF), in PDUs */
+#define SIMPTCP_INITIAL_RTO 1000 /* retransmission timeout before any RTT
+				    sample, in ms [RFC6298] */
+#define SIMPTCP_DEFAULT_RTO_MIN 200 /* default RTO bounds, in ms */
+#define SIMPTCP_DEFAULT_RTO_MAX 60000
+#define SIMPTCP_MAX_DELACK 500 /* upper bound of the ACK delay, in ms [RFC1122] */
+#define SIMPTCP_MAX_PERSIST_BACKOFF 6 /* the probe interval stops doubling,
+				       unless capped by rto_max */
+#define SIMPTCP_QUICKACKS 16 /* PDUs acknowledged at once after the connection
+				opening or an out of sequence arrival */
+#define SIMPTCP_DUPACK_THRESHOLD 3 /* duplicate ACKs that trigger a fast
+				      retransmit [RFC5681] */
 
 
 
@@ -75,6 +91,15 @@ struct simptcp_socket   /* SimpTCP Protocol Control Block */
 
     short  socket_type; /*!< SimpTCP socket type (#socket_types): either client,
 					   listening or server socket */
+    int fd; /*!< descriptor of the socket (index in the descriptor table) */
+    struct simptcp_socket * pool_next; /*!< next free structure in the PCB pool,
+                                         or next socket waiting to be recycled */
+    unsigned char released; /*!< 1 : closed by the application, recycled by
+                              the entity handler */
+    struct simptcp_socket * demux_next; /*!< next socket in the same demultiplexing
+                                          hash bucket */
+    short demux_table; /*!< demultiplexing table the socket is registered in
+                         (#simptcp_demux_tables) */
     struct simptcp_socket * * new_conn_req; /*!<  remote SAPs of backlogged
 					      connection requests received on a listening socket -
 					      used by sys call accept to set up new connections */
@@ -98,7 +123,9 @@ struct simptcp_socket   /* SimpTCP Protocol Control Block */
     /* Related to data transmissions */
     short socket_state_sender; /*!< sender side FSM describing
 							  the data transfer phase (started during TD) */
-    unsigned int next_seq_num;  /*!< Next sequence number */
+    unsigned int next_seq_num;  /*!< last sequence number used : data PDUs
+                                  and FIN take the next one, pure ACKs
+                                  carry it without consuming it */
     char out_buffer[SIMPTCP_SOCKET_MAX_BUFFER_SIZE]; /*!< SimpTCP socket Transmit
 						      buffer used to store
 						      outgoing SimpTCP PDUs */
@@ -108,43 +135,136 @@ struct simptcp_socket   /* SimpTCP Protocol Control Block */
 
     /* timer */
     int timer_duration; /*!< expressed in ms, normally derived from estimated_rtt  */
-    struct timeval timeout; /*!< Expected timeout for last unacked packet */
+    struct simptcp_timer timers[SIMPTCP_TIMER_KINDS]; /*!< RTO, TIME_WAIT, delayed ACK,
+							keepalive, path MTU,
+							pacing and persist
+							timers */
 
     /* when receiving  Data */
     short socket_state_receiver; /*!< receiver side FSM describing
 				the data transfer phase */
     unsigned int next_ack_num;  /*!< Next ack number */
-    char in_buffer[SIMPTCP_SOCKET_MAX_BUFFER_SIZE]; /*!< SimpTCP socket Receive
-						     buffer used to store
-						     ingoing SimpTCP PDUs */
-    unsigned int in_len;/*!< instantaneous in_buffer occupation */
 
     /* MIB Statistics */
     unsigned long simptcp_send_count; /* number of sent SimpTCP PDU */
     unsigned long simptcp_receive_count; /* number of sent SimpTCP PDU */
     unsigned long simptcp_in_errors_count; /* number of unexpected received SimpTCP PDU */
     unsigned long simptcp_retransmit_count; /* number of SimpTCP PDU retransmissions */
+    unsigned long simptcp_dupack_count; /* number of duplicate ACKs received */
+    unsigned long simptcp_fast_retransmit_count; /* number of retransmissions
+						  triggered by ACKs (not by
+						  the RTO timer) */
+    unsigned long simptcp_fast_recovery_count; /* number of fast recovery phases */
+    unsigned long simptcp_paced_count; /* number of data PDUs held by pacing */
+    unsigned long simptcp_window_probe_count; /* number of zero window probes sent */
 
 
     /* optional fields */
     /* related to the sending  window used with GoBack-N mechanism */
+    unsigned char go_back_n; /* 1 : Go-Back-N sender, 0 : stop-and-wait
+			      (one PDU in flight, default) */
     unsigned int sending_window_size;
     unsigned int sending_window_base; /* sequence number of first unacked
 				       simptcp packet */
+    struct simptcp_pdu_queue rtx_queue; /* send queue : sent and unacked
+					 PDUs, then the snd_unsent PDUs
+					 not sent yet */
+    unsigned int snd_unsent; /* PDUs at the tail of rtx_queue held by the
+			      windows or by pacing */
+    unsigned int snd_queue_size; /* capacity of rtx_queue set by SO_SNDBUF,
+				  in PDUs; 0 : default */
+    unsigned char dupacks; /* consecutive duplicate ACKs received */
+    unsigned char fast_recovery; /* 1 : in fast recovery [RFC6582], until
+				  recover is acknowledged */
+    unsigned int recover; /* last PDU sent when fast recovery was entered */
+    u_int32_t snd_wnd; /* receive window advertised by the peer, in bytes */
+    u_int16_t snd_wl1; /* seq of the PDU that last updated snd_wnd */
+    u_int16_t snd_wl2; /* ack of the PDU that last updated snd_wnd */
+    unsigned int rtx_bytes; /* payload bytes of the PDUs in flight */
+    unsigned char persist_backoff; /* window probes sent since the window
+				    closed (exponential backoff) */
+
+    /* related to congestion control */
+    const struct simptcp_cc_ops *cc; /* algorithm of the sender */
+    unsigned int cwnd; /* congestion window, in PDUs */
+    unsigned int ssthresh; /* slow start threshold, in PDUs */
+    double pacing_rate; /* rate set by the algorithm, in bytes/s; 0 : not paced */
+    unsigned long delivered; /* PDUs acknowledged, for the delivery rate
+			      samples */
+    uint64_t delivered_at; /* date in us of the last delivery (or of the
+			    first send after an idle period) */
+    u_int64_t cc_priv[SIMPTCP_CC_PRIV_SIZE / sizeof(u_int64_t)]; /* state of
+								     the algorithm */
+
+    /* related to pacing */
+    unsigned int max_pacing_rate; /* bound of the pacing rate set by the
+				   application, in bytes/s; 0 : none */
+    double pacing_tokens; /* token bucket, in bytes (negative after
+			   retransmissions) */
+    uint64_t pacing_stamp; /* date in us the bucket was last filled */
+    unsigned char pacing_listed; /* 1 : in the round robin of the entity */
+    struct simptcp_socket *pacing_next; /* next socket of the round robin */
 
     /* related to the receiving  window used with GoBack-N mechanism */
     unsigned int receiving_window_size;
     unsigned int receiving_window_base; /* sequence number of last in
 					 sequence received packet */
+    struct simptcp_pdu_ring in_queue; /* in sequence PDUs not yet read by
+				       the application : pushed by the entity,
+				       popped by the reader without lock */
+    unsigned int in_offset; /* payload bytes of the first PDU of in_queue
+			     already read (recv buffer shorter than the
+			     message) */
+    unsigned char sack; /* 1 : selective repeat receiver (out of sequence
+			 PDUs held and SACKed), 0 : they are dropped */
+    struct simptcp_reorder_buffer ooo_buffer; /* out of sequence PDUs */
+    unsigned int delack_timeout; /* longest delay of an ACK, in ms;
+				  0 : each PDU is acknowledged at once */
+    unsigned char delack_pending; /* in sequence PDUs not acknowledged yet */
+    unsigned char quickack; /* PDUs still to acknowledge at once (quick-ack
+			     mode) */
+    u_int32_t rcv_wnd; /* window last advertised to the peer, in bytes */
+
+    /* related to the window scale option [RFC7323] */
+    unsigned char wscale_ok; /* 1 : both SYN carried the option */
+    unsigned char snd_wscale; /* shift of the windows advertised by the peer */
+    unsigned char rcv_wscale; /* shift of the windows advertised to the peer */
 
     /* related to RTT estimation */
-    double rtt_estimate;
+    double rtt_estimate; /* smoothed RTT (SRTT), in s */
+    double rtt_variance; /* RTT variation (RTTVAR), in s */
     double last_rtt; /* last RTT */
+    unsigned long rtt_samples; /* number of RTT samples, 0 : timer_duration
+				is used as RTO */
+    unsigned int rto_min; /* RTO bounds, in ms */
+    unsigned int rto_max;
+    unsigned char timestamps; /* 1 : data PDUs carry the timestamp option */
+    u_int32_t ts_recent; /* ts_val of the last in sequence PDU received,
+			  echoed in the ACKs */
+    unsigned char ts_recent_valid; /* a ts_val has been received */
+
+    /* related to the MSS option [RFC879] */
+    unsigned int mss; /* largest PDU payload, options included : the local
+		       MSS (entity MTU) until the SYN exchange, then the
+		       smaller of both ends' MSS */
+
+    /* related to path MTU discovery [RFC8899] */
+    unsigned int plpmtu; /* largest packet size known to cross the path,
+			  sizes the data PDUs; 0 : no search (mss applies) */
+    unsigned int pmtu_max; /* upper bound of the search (packet size) */
+    unsigned int pmtu_probe_size; /* packet size of the outstanding probe,
+				   0 if none (search complete) */
+    u_int16_t pmtu_probe_id; /* number of the last probe sent, echoed
+			      by its acknowledgement */
+    unsigned char pmtu_probe_count; /* transmissions of this probe size */
 
     /*! mutex to control the write-access to this block
      contening processes : primitives called by the
      application vs simptcp protocol entity */
     pthread_mutex_t mutex_socket;
+    /*! signalled by the simptcp protocol entity each time it has processed
+     a PDU or a timeout for this socket (state, in_queue, next_ack_num...) */
+    pthread_cond_t cond_socket;
 };
 
 /*
@@ -263,13 +383,54 @@ typedef struct simptcp_socket_states_funcs
 
 
 
+/* set the maximum number of open sockets; to be called before start_simptcp */
+int simptcp_set_max_open_sockets(unsigned int n);
+/* allocate the descriptor table */
+int init_simptcp_descriptors();
 /* Fill a struct simptcp_socket with default values */
 int create_simptcp_socket();
+/* give back the descriptor and the PCB of a closed socket */
+int release_simptcp_socket(int fd);
+void recycle_simptcp_sockets();
+/* descriptor table lookup */
+struct simptcp_socket * get_simptcp_socket(int fd);
 char * simptcp_socket_state_get_str(simptcp_socket_state_funcs *state);
 inline int lock_simptcp_socket(struct simptcp_socket *sock);
 inline int unlock_simptcp_socket(struct simptcp_socket *sock);
-int is_timeout(struct simptcp_socket * sock);
+int wait_simptcp_socket(struct simptcp_socket *sock);
+int signal_simptcp_socket(struct simptcp_socket *sock);
 int has_active_timer(struct simptcp_socket * sock);
+void start_timer(struct simptcp_socket * sock, int duration);
+void stop_timer(struct simptcp_socket * sock);
+void start_simptcp_timer(struct simptcp_socket * sock, int kind, int duration);
+void stop_simptcp_timer(struct simptcp_socket * sock, int kind);
+int send_simptcp_ack(struct simptcp_socket * sock);
+void handle_simptcp_delack_timeout(struct simptcp_socket * sock);
+u_int32_t simptcp_rcv_space(struct simptcp_socket * sock);
+void set_simptcp_window(struct simptcp_socket * sock, char * pdu);
+void set_simptcp_ack(struct simptcp_socket * sock, char * pdu, uint64_t now);
+void handle_simptcp_persist_timeout(struct simptcp_socket * sock);
+/* header prediction : process an in sequence data PDU or pure ACK of an
+   established connection without the state machine; 0 if not predicted */
+int simptcp_fast_path(struct simptcp_socket * sock, char * pdu, int len);
+int transmit_simptcp_pdu(struct simptcp_socket * sock, struct simptcp_queued_pdu * queued);
+unsigned int simptcp_in_flight(struct simptcp_socket * sock);
+unsigned int simptcp_snd_queue_size(struct simptcp_socket * sock);
+int simptcp_snd_allowed(struct simptcp_socket * sock, struct simptcp_queued_pdu * queued);
+void simptcp_persist_arm(struct simptcp_socket * sock);
+int retransmit_simptcp_window(struct simptcp_socket * sock);
+int fast_retransmit_simptcp_pdu(struct simptcp_socket * sock);
+int repacketize_simptcp_queue(struct simptcp_socket * sock);
+int getTimeoutDuration(struct simptcp_socket * sock);
+void update_simptcp_rtt(struct simptcp_socket * sock, double rtt);
+int set_simptcp_socket_option(struct simptcp_socket * sock, int optname,
+                              const void *optval, socklen_t optlen);
+int get_simptcp_socket_option(struct simptcp_socket * sock, int optname,
+                              void *optval, socklen_t *optlen);
+int set_simptcp_socket_buffer(struct simptcp_socket * sock, int optname,
+                              const void *optval, socklen_t optlen);
+int get_simptcp_socket_buffer(struct simptcp_socket * sock, int optname,
+                              void *optval, socklen_t *optlen);
 
 
 #endif // _SIMPTCP_LIB_H_
@@ -0,0 +1,37 @@
+/*! \file simptcp_pacing.h
+*  \brief{Pacing of the data PDUs : each connection has a token bucket filled
+*  at its pacing rate (set by the congestion control, bounded by the
+*  SIMPTCP_MAX_PACING_RATE option). A PDU the bucket cannot pay for waits in
+*  the send queue behind the PDUs in flight; the entity handler releases the
+*  waiting PDUs one connection after the other (round robin) and the pacing
+*  timer of a connection wakes it up when its bucket has refilled.}
+*/
+
+#ifndef _SIMPTCP_PACING_H_
+#define _SIMPTCP_PACING_H_
+
+#include <simptcp_lib.h>
+
+#define SIMPTCP_PACING_QUANTUM 2000 /* bucket depth, in us of the rate : the
+                                       pacing timer fires one to two ticks of
+                                       the timer wheel late */
+#define SIMPTCP_PACING_MIN_BURST 2 /* lower bound of the bucket depth, in PDUs */
+
+/* rate the PDUs of a connection leave at, in bytes/s; 0 : not paced */
+double simptcp_pacing_rate(struct simptcp_socket *sock);
+/* transmit the unsent PDUs of the send queue that the windows and the
+   bucket allow; the others wait for an ACK or for the pacing timer */
+void simptcp_pacing_output(struct simptcp_socket *sock);
+/* a PDU was retransmitted outside of pacing : take it out of the bucket */
+void simptcp_pacing_charge(struct simptcp_socket *sock, int len);
+/* the pacing timer expired : the connection joins the round robin again */
+void simptcp_pacing_handle_timeout(struct simptcp_socket *sock);
+/* take a released socket out of the round robin */
+void simptcp_pacing_remove(struct simptcp_socket *sock);
+/* release the held PDUs the buckets allow, one connection after the other;
+   called by the entity handler */
+void simptcp_pacing_run();
+
+#endif /* _SIMPTCP_PACING_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -31,20 +31,45 @@
  */
 #define RST  		0x08
 
+/*!
+ * \def PROBE
+ * Le flag PROBE, sonde de decouverte de la PMTU : PDU de bourrage sans
+ * numero de sequence (seq_num numerote la sonde), acquitte par un PDU
+ * PROBE|ACK dont l'ack_num reprend ce numero
+ */
+#define PROBE  		0x10
+
+/*!
+ * \def FRAG
+ * Le flag FRAG, fragment d'un message : le message se poursuit dans le PDU
+ * de donnees suivant ; son dernier fragment ne porte pas le flag
+ */
+#define FRAG  		0x20
+
 /*!
  * \def SIMPTCP_GHEADER_SIZE
  * Taille en octets de l'en-tête générique (Sans option) du PDU SimpTCP
  */
 #define SIMPTCP_GHEADER_SIZE 	(sizeof (struct simptcp_generic_header))
 
-#define ETH_MTU 1500 /* Ethernet Max transmit Unit */
+#define SIMPTCP_DEFAULT_MTU 1500 /* Ethernet Max transmit Unit, default entity MTU */
+#define SIMPTCP_MIN_MTU 576 /* smallest datagram every IPv4 host accepts [RFC791] */
+#define SIMPTCP_MAX_MTU 65535 /* largest IPv4 datagram (loopback) */
+
+/* largest simptcp PDU carried by one UDP datagram in an mtu sized IP packet,
+   assuming no IP options, to avoid IP fragmentation */
+#define SIMPTCP_MTU_PDU_SIZE(mtu) ((mtu)-20-8)
+/* MSS : largest payload of a PDU (header options included) for an mtu */
+#define SIMPTCP_MTU_MSS(mtu) (SIMPTCP_MTU_PDU_SIZE(mtu)-SIMPTCP_GHEADER_SIZE)
+/* IP packet size of a PDU carrying mss bytes of payload */
+#define SIMPTCP_MSS_MTU(mss) ((mss)+SIMPTCP_GHEADER_SIZE+20+8)
 
 /*! \def SIMPTCP_MAX_SIZE
  * \brief Taille maximale de la charge utile d'un PDU SimpTCP
  * pour éviter fragmentation IP sur un réseau physique
- * de type Ethernetto avoid IP
+ * de type Ethernet ; MSS suppose d'un pair qui n'annonce pas le sien
 */
-#define SIMPTCP_MAX_SIZE (ETH_MTU-SIMPTCP_GHEADER_SIZE-20-8)
+#define SIMPTCP_MAX_SIZE SIMPTCP_MTU_MSS(SIMPTCP_DEFAULT_MTU)
 
 
 
@@ -69,13 +94,15 @@ typedef struct simptcp_generic_header
 
 /* simptcp options -
    refer to [RFC793] for Maximum segment size option;
-   [RFC2018] for Selective ACK option; [RFC1323] for timestamp option
+   [RFC2018] for Selective ACK option; [RFC1323] for timestamp and window
+   scale options
    could be extended to cope with other options
 */
 #define SIMPTCP_NO_OPTIONS 0
 #define SIMPTCP_MSS_OPTION 2
 #define SIMPTCP_SACK_OPTION 4
 #define SIMPTCP_TS_OPTION 8
+#define SIMPTCP_WSCALE_OPTION 16
 
 /*!
  * \brief structure relative a la declarartion
@@ -92,6 +119,32 @@ typedef struct simptcp_option_header
     unsigned char option_len; /*!< option length in bytes */
 } simptcp_option_header;
 
+/* option_len is the length of the option value (header excluded); values
+   are in network byte order */
+#define SIMPTCP_MAX_SACK_BLOCKS 4 /* SACK blocks carried by one PDU */
+#define SIMPTCP_TS_OPTION_SIZE (sizeof(simptcp_option_header) + 2 * sizeof(u_int32_t))
+#define SIMPTCP_MSS_OPTION_SIZE (sizeof(simptcp_option_header) + sizeof(u_int16_t))
+#define SIMPTCP_WSCALE_OPTION_SIZE (sizeof(simptcp_option_header) + sizeof(unsigned char))
+#define SIMPTCP_MAX_WSCALE 14 /* largest window shift [RFC7323] */
+#define SIMPTCP_MAX_OPTIONS_SIZE 40 /* all option headers and values of a PDU */
+
+/*!
+ * \struct simptcp_options
+ * \brief decoded options of a PDU
+ */
+struct simptcp_options
+{
+    unsigned char present; /*!< SIMPTCP_*_OPTION kinds present (bit mask) */
+    u_int16_t mss; /*!< largest payload the sender accepts (SYN PDUs only) */
+    unsigned char sack_blocks; /*!< number of SACK blocks */
+    u_int16_t sack[SIMPTCP_MAX_SACK_BLOCKS][2]; /*!< SACK blocks : first and
+                                                  past the last PDU received */
+    u_int32_t ts_val; /*!< timestamp of the sender, in us */
+    u_int32_t ts_ecr; /*!< timestamp echoed to the peer (its last in sequence ts_val) */
+    unsigned char wscale; /*!< shift of the windows the sender will advertise
+                            (SYN PDUs only) */
+};
+
 
 
 
@@ -144,6 +197,38 @@ char* simptcp_make_pdu(
     u_int16_t seq_num,
     u_int16_t ack_num,
     unsigned char flags);
+char* simptcp_make_pdu_with_options(
+    struct sockaddr_in* src,
+    struct sockaddr_in* dst,
+    void * payload,
+    u_int16_t payload_len,
+    u_int16_t seq_num,
+    u_int16_t ack_num,
+    unsigned char flags,
+    const struct simptcp_options * options);
+/* build a PDU in a caller buffer (total length plus one byte for the
+   checksum padding); returns its total length */
+int simptcp_write_pdu(
+    char * pdu,
+    struct sockaddr_in* src,
+    struct sockaddr_in* dst,
+    void * payload,
+    u_int16_t payload_len,
+    u_int16_t seq_num,
+    u_int16_t ack_num,
+    unsigned char flags,
+    const struct simptcp_options * options);
+
+/* option headers and values of the options present */
+int simptcp_options_len (const struct simptcp_options * options);
+/* decode the options of a PDU; 0 if success, -1 if malformed */
+int simptcp_get_options (const char *buffer, struct simptcp_options * options);
+/* rewrite the ack number and the window of a built PDU when it leaves and
+   update its checksum incrementally */
+void simptcp_update_ack (char *buffer, u_int16_t ack, u_int16_t window);
+/* rewrite the timestamp option of a built PDU when it leaves and update its
+   checksum incrementally; -1 if the PDU has no timestamp option */
+int simptcp_update_ts (char *buffer, u_int32_t ts_val, u_int32_t ts_ecr);
 
 
 #endif /* _SIMPTCP_PACKET_H_ */
@@ -0,0 +1,44 @@
+/*! \file simptcp_pmtu.h
+*  \brief{Packetization layer path MTU discovery [RFC8899] : the sender of a
+*  connection probes the path with padded PROBE PDUs (the entity UDP socket sets
+*  the DF bit), sizes its data PDUs for the largest acknowledged probe and
+*  falls back to the base size on repeated losses. The result is cached per
+*  destination.}
+*/
+
+#ifndef _SIMPTCP_PMTU_H_
+#define _SIMPTCP_PMTU_H_
+
+#include <netinet/in.h>
+#include <simptcp_lib.h>
+
+#define SIMPTCP_PMTU_BASE 1200 /* BASE_PLPMTU : packet size assumed to cross
+                                  any path [RFC8899] */
+#define SIMPTCP_PMTU_MAX_PROBES 3 /* MAX_PROBES : lost probes before a size is
+                                     deemed too large; also consecutive data
+                                     timeouts that reveal a black hole */
+#define SIMPTCP_PMTU_SEARCH_STEP 16 /* the search ends when its bounds are
+                                       closer, in bytes */
+#define SIMPTCP_PMTU_RAISE_TIMER 600000 /* delay before searching a larger PMTU
+                                           again, in ms */
+#define SIMPTCP_PMTU_CACHE_SIZE 256 /* cached destinations (direct mapped) */
+#define SIMPTCP_PMTU_CACHE_LIFETIME 600000 /* validity of a cached PMTU, in ms */
+
+/* PMTU cached for a destination, 0 if unknown */
+unsigned int simptcp_pmtu_cache_lookup(struct in_addr addr);
+void simptcp_pmtu_cache_update(struct in_addr addr, unsigned int pmtu);
+
+/* start the search of a connection, from the cached PMTU or the base size */
+void simptcp_pmtu_start(struct simptcp_socket *sock);
+/* payload limit of the data PDUs : the MSS, lowered to the PMTU found */
+unsigned int simptcp_pmtu_mss(struct simptcp_socket *sock);
+/* process a received PROBE PDU : answer a probe, or account for its ACK */
+void simptcp_pmtu_process_probe(struct simptcp_socket *sock, const char *pdu, int len);
+/* the PMTU timer expired : probe lost, or time to search a larger PMTU */
+void simptcp_pmtu_handle_timeout(struct simptcp_socket *sock);
+/* data PDUs keep timing out : the path may have shrunk below the PMTU */
+void simptcp_pmtu_black_hole(struct simptcp_socket *sock);
+
+#endif /* _SIMPTCP_PMTU_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,137 @@
+/*! \file simptcp_queue.h
+*  \brief{Fixed size FIFO of simptcp PDUs, used as the retransmission queue of
+*  the sender (PDUs sent and not yet acknowledged), ring of the in sequence
+*  PDUs handed from the entity to the application (receive queue), and
+*  reorder buffer of the out of sequence PDUs held by a selective repeat
+*  receiver}
+*/
+
+#ifndef _SIMPTCP_QUEUE_H_
+#define _SIMPTCP_QUEUE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <simptcp_packet.h>
+
+/*!
+ * \struct simptcp_queued_pdu
+ * \brief PDU held in a queue with its sequence number
+ */
+struct simptcp_queued_pdu
+{
+    unsigned int seq; /*!< sequence number of the PDU */
+    int len; /*!< PDU size in bytes, 0 for an empty reorder buffer slot */
+    unsigned char sacked; /*!< retransmission queue : selectively acknowledged */
+    unsigned char retransmitted; /*!< retransmission queue : sent more than once,
+                                   its ACK gives no RTT sample (Karn) */
+    uint64_t sent_at; /*!< retransmission queue : first transmission date in us */
+    unsigned long delivered; /*!< retransmission queue : PDUs delivered by
+                               the connection when it was sent */
+    uint64_t delivered_at; /*!< retransmission queue : date in us of that
+                             delivery */
+    char *pdu; /*!< copy of the PDU, in a buffer of pdu_size bytes plus one
+                 spare byte for the odd length checksum padding */
+};
+
+/*!
+ * \struct simptcp_pdu_queue
+ * \brief circular FIFO of PDUs, allocated on first use
+ */
+struct simptcp_pdu_queue
+{
+    struct simptcp_queued_pdu *slots; /*!< size slots followed by their PDU
+                                        buffers, NULL until allocated */
+    unsigned int size; /*!< capacity in PDUs */
+    unsigned int pdu_size; /*!< largest PDU a slot holds, in bytes */
+    unsigned int head; /*!< index of the oldest PDU */
+    unsigned int count; /*!< number of queued PDUs */
+};
+
+/*!
+ * \struct simptcp_pdu_ring
+ * \brief bounded FIFO of PDUs between one producer thread (the entity) and
+ * one consumer thread (the reader), without lock : each side only writes its
+ * own index and publishes it with release ordering; one slot always stays
+ * empty to tell a full ring from an empty one. Allocated on first use.
+ */
+struct simptcp_pdu_ring
+{
+    struct simptcp_queued_pdu *slots; /*!< size + 1 slots followed by their
+                                        PDU buffers, NULL until allocated */
+    unsigned int size; /*!< capacity in PDUs */
+    unsigned int pdu_size; /*!< largest PDU a slot holds, in bytes */
+    unsigned int head; /*!< slot of the oldest PDU, written by the consumer */
+    unsigned int tail; /*!< slot of the next PDU, written by the producer */
+};
+
+/*!
+ * \struct simptcp_reorder_buffer
+ * \brief out of sequence PDUs, slot i holds PDU number base+i where base is
+ * the next in sequence PDU awaited (slot 0 is therefore always empty)
+ */
+struct simptcp_reorder_buffer
+{
+    struct simptcp_queued_pdu *slots; /*!< size slots followed by their PDU
+                                        buffers, NULL until allocated */
+    unsigned int size; /*!< capacity in PDUs (receiving window) */
+    unsigned int pdu_size; /*!< largest PDU a slot holds, in bytes */
+    unsigned int head; /*!< slot of base */
+    unsigned int count; /*!< number of held PDUs */
+};
+
+/* compare two 16 bits sequence numbers : <0, 0 or >0 as a is before, equal to or after b */
+#define simptcp_seq_cmp(a, b) ((int16_t) (u_int16_t) ((a) - (b)))
+
+/* (re)allocate an empty queue of size PDUs of up to pdu_size bytes; -EBUSY if
+   not empty, -ENOMEM */
+int simptcp_queue_init(struct simptcp_pdu_queue *queue, unsigned int size,
+                       unsigned int pdu_size);
+void simptcp_queue_free(struct simptcp_pdu_queue *queue);
+
+/* append a copy of a PDU; NULL if the queue is full, not allocated or the PDU too large */
+struct simptcp_queued_pdu *simptcp_queue_push(struct simptcp_pdu_queue *queue,
+        const char *pdu, int len, unsigned int seq);
+/* i-th PDU from the oldest one */
+struct simptcp_queued_pdu *simptcp_queue_at(struct simptcp_pdu_queue *queue,
+        unsigned int i);
+/* drop the oldest PDU */
+void simptcp_queue_pop(struct simptcp_pdu_queue *queue);
+/* drop the PDUs numbered before ack (cumulative acknowledgement); returns their number */
+unsigned int simptcp_queue_ack(struct simptcp_pdu_queue *queue, unsigned int ack);
+
+/* (re)allocate an empty ring of size PDUs of up to pdu_size bytes (producer
+   side, consumer idle); -EBUSY if not empty, -ENOMEM */
+int simptcp_ring_init(struct simptcp_pdu_ring *ring, unsigned int size,
+                      unsigned int pdu_size);
+void simptcp_ring_free(struct simptcp_pdu_ring *ring);
+/* number of PDUs in the ring, from either side */
+unsigned int simptcp_ring_count(struct simptcp_pdu_ring *ring);
+/* producer : append a copy of a PDU; NULL if the ring is full, not allocated
+   or the PDU too large */
+struct simptcp_queued_pdu *simptcp_ring_push(struct simptcp_pdu_ring *ring,
+        const char *pdu, int len, unsigned int seq);
+/* consumer : oldest PDU, NULL if the ring is empty */
+struct simptcp_queued_pdu *simptcp_ring_peek(struct simptcp_pdu_ring *ring);
+/* consumer : drop the oldest PDU, its slot goes back to the producer */
+void simptcp_ring_pop(struct simptcp_pdu_ring *ring);
+
+/* (re)allocate an empty reorder buffer of size PDUs of up to pdu_size bytes;
+   -EBUSY if not empty, -ENOMEM */
+int simptcp_reorder_init(struct simptcp_reorder_buffer *buffer, unsigned int size,
+                         unsigned int pdu_size);
+void simptcp_reorder_free(struct simptcp_reorder_buffer *buffer);
+/* hold a copy of PDU base+offset; 1 if held, 0 if already held, -1 if out of the window */
+int simptcp_reorder_store(struct simptcp_reorder_buffer *buffer, unsigned int offset,
+                          const char *pdu, int len, unsigned int seq);
+/* PDU base, now in sequence, NULL if not held */
+struct simptcp_queued_pdu *simptcp_reorder_first(struct simptcp_reorder_buffer *buffer);
+/* base+1 becomes the awaited PDU (drops PDU base if held) */
+void simptcp_reorder_advance(struct simptcp_reorder_buffer *buffer);
+/* SACK blocks (first, past the last PDU) of the held PDUs; returns their number */
+int simptcp_reorder_sack_blocks(struct simptcp_reorder_buffer *buffer, unsigned int base,
+                                u_int16_t blocks[][2], int max_blocks);
+
+#endif /* _SIMPTCP_QUEUE_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
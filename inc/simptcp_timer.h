@@ -0,0 +1,72 @@
+/*! \file simptcp_timer.h
+*  \brief{Hashed hierarchical timer wheel driving the simptcp socket timers
+*  (retransmission, TIME_WAIT, delayed ACK, keepalive, path MTU probe,
+*  pacing, persist). Time is counted in
+*  milliseconds of CLOCK_MONOTONIC.}
+*/
+
+#ifndef _SIMPTCP_TIMER_H_
+#define _SIMPTCP_TIMER_H_
+
+#include <stdint.h>
+
+#define SIMPTCP_TIMER_WHEEL_BITS 6 /* log2 of the number of slots per level */
+#define SIMPTCP_TIMER_WHEEL_SIZE (1 << SIMPTCP_TIMER_WHEEL_BITS)
+#define SIMPTCP_TIMER_WHEEL_LEVELS 4 /* 1ms ticks : covers up to ~4.6 hours */
+
+struct simptcp_socket;
+
+/*!
+ * \enum simptcp_timer_kinds
+ * \brief timers that can be armed independently on a simpTCP socket
+ */
+enum simptcp_timer_kinds
+{
+    SIMPTCP_TIMER_RTO=0, /* retransmission of unacked PDU (handshake, data, FIN) */
+    SIMPTCP_TIMER_TIME_WAIT=1, /* 2*MSL wait before closing */
+    SIMPTCP_TIMER_DELACK=2, /* delayed acknowledgement */
+    SIMPTCP_TIMER_KEEPALIVE=3, /* idle connection probe */
+    SIMPTCP_TIMER_PMTU=4, /* path MTU probe loss, or next search */
+    SIMPTCP_TIMER_PACING=5, /* token bucket refilled for the next held PDU */
+    SIMPTCP_TIMER_PERSIST=6, /* zero window probe */
+    SIMPTCP_TIMER_KINDS=7
+};
+
+/*!
+ * \struct simptcp_timer
+ * \brief timer embedded in a simpTCP socket, linked in a slot of the wheel
+ */
+struct simptcp_timer
+{
+    struct simptcp_timer *next; /*!< next timer of the slot */
+    struct simptcp_timer **pprev; /*!< link pointing to this timer, NULL if not armed */
+    uint64_t expires; /*!< expiry date in ms */
+    struct simptcp_socket *sock; /*!< owning socket */
+    unsigned char kind; /*!< one of simptcp_timer_kinds */
+    unsigned char level; /*!< wheel level (or expired list) holding the timer */
+    unsigned char slot; /*!< slot of the level holding the timer */
+};
+
+/* current CLOCK_MONOTONIC date in ms */
+uint64_t simptcp_timer_now();
+/* current CLOCK_MONOTONIC date in us (RTT sampling) */
+uint64_t simptcp_timer_now_us();
+/* reset the wheel; its first tick is now */
+void simptcp_timer_wheel_init(uint64_t now);
+
+/* bind the timers of a socket to it (all disarmed) */
+void simptcp_timer_init(struct simptcp_socket *sock, struct simptcp_timer *timers);
+/* (re)arm a timer to fire duration ms from now; O(1) */
+void simptcp_timer_arm(struct simptcp_timer *timer, int duration);
+/* disarm a timer (no effect if it is not armed); O(1) */
+void simptcp_timer_cancel(struct simptcp_timer *timer);
+int simptcp_timer_pending(struct simptcp_timer *timer);
+
+/* advance the wheel up to now and pop one expired timer (disarmed), NULL if none */
+struct simptcp_timer *simptcp_timer_next_expired(uint64_t now);
+/* delay in ms until the wheel needs to be advanced again, -1 if no timer is armed */
+int64_t simptcp_timer_next_expiry(uint64_t now);
+
+#endif /* _SIMPTCP_TIMER_H_ */
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,105 @@
+/* Microbenchmark of the simptcp demultiplexer : measures the cost of a
+   connection lookup in the hash tables of simptcp_demux.c for 10 to 100k
+   registered sockets, compared with the former linear scan of the socket
+   descriptor table. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <simptcp_demux.h>
+
+#define LOOKUPS 1000000 /* hash lookups per table size */
+#define SCAN_WORK 20000000UL /* socket comparisons budget of the linear scan */
+
+static double now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* former demultiplex_packet() connection search */
+static struct simptcp_socket *linear_lookup(struct simptcp_socket **table, int n,
+        uint16_t lport, uint32_t raddr, uint16_t rport)
+{
+    int fd;
+
+    for (fd = 0; fd < n; fd++)
+    {
+        if (table[fd]->local_simptcp.sin_port == lport
+                && table[fd]->remote_simptcp.sin_addr.s_addr == raddr
+                && table[fd]->remote_simptcp.sin_port == rport)
+            return table[fd];
+    }
+    return NULL;
+}
+
+int main()
+{
+    int sizes[] = {10, 100, 1000, 10000, 100000};
+    struct simptcp_socket **socks;
+    struct simptcp_socket *s;
+    unsigned long found;
+    double t0, hash_ns, scan_ns;
+    int i, k, n, scans;
+
+    printf("%8s %14s %14s\n", "sockets", "hash ns/op", "linear ns/op");
+    for (k = 0; k < (int) (sizeof(sizes) / sizeof(sizes[0])); k++)
+    {
+        n = sizes[k];
+        if (simptcp_demux_init(SIMPTCP_DEMUX_BUCKETS) < 0)
+        {
+            perror("simptcp_demux_init");
+            return 1;
+        }
+        socks = malloc(n * sizeof(struct simptcp_socket *));
+        for (i = 0; i < n; i++)
+        {
+            /* a few servers ports, many remote hosts and ports */
+            socks[i] = calloc(1, sizeof(struct simptcp_socket));
+            socks[i]->fd = i;
+            socks[i]->local_simptcp.sin_port = htons(15000 + i % 16);
+            socks[i]->remote_simptcp.sin_addr.s_addr = htonl(0x0a000000 + i / 64);
+            socks[i]->remote_simptcp.sin_port = htons(20000 + i % 64);
+            simptcp_demux_insert_connection(socks[i]);
+        }
+
+        found = 0;
+        t0 = now_ns();
+        for (i = 0; i < LOOKUPS; i++)
+        {
+            s = socks[(i * 7919UL) % n];
+            found += (simptcp_demux_lookup_connection(s->local_simptcp.sin_port,
+                      s->remote_simptcp.sin_addr.s_addr,
+                      s->remote_simptcp.sin_port) == s);
+        }
+        hash_ns = (now_ns() - t0) / LOOKUPS;
+
+        scans = SCAN_WORK / n;
+        t0 = now_ns();
+        for (i = 0; i < scans; i++)
+        {
+            s = socks[(i * 7919UL) % n];
+            found += (linear_lookup(socks, n, s->local_simptcp.sin_port,
+                                    s->remote_simptcp.sin_addr.s_addr,
+                                    s->remote_simptcp.sin_port) == s);
+        }
+        scan_ns = (now_ns() - t0) / scans;
+
+        if (found != (unsigned long) LOOKUPS + scans)
+            fprintf(stderr, "lookup mismatch for %d sockets\n", n);
+        printf("%8d %14.1f %14.1f\n", n, hash_ns, scan_ns);
+
+        for (i = 0; i < n; i++)
+        {
+            simptcp_demux_remove(socks[i]);
+            free(socks[i]);
+        }
+        free(socks);
+    }
+    return 0;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
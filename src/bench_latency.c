@@ -0,0 +1,133 @@
+/* Round trip latency benchmark of simptcp on loopback : a forked server
+   accepts one connection and echoes every message it receives until it is
+   killed; the client times MESSAGES request/reply exchanges over the same
+   connection (each reply carries the acknowledgement of its request). Only
+   the data transfer phase is measured. With a delayed ACK delay (in ms) as
+   argument, no PDU carries an acknowledgement alone. Protocol traces go to
+   stdout, results to stderr : run with ./bench_latency [delack] > /dev/null */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <simptcp_api.h>
+#include <simptcp_entity.h>
+
+#define SERVER_PORT 15600 /* server udp port = listening simptcp port */
+#define CLIENT_PORT 15601
+#define MESSAGES 2000
+#define MESSAGE_SIZE 64
+
+static int delack = 0; /* 0 : every PDU acknowledged at once */
+
+static double now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static int run_server()
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    char buffer[MESSAGE_SIZE];
+    int fd, conn, n;
+
+    start_simptcp(SERVER_PORT);
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_SIMPTCP);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(SERVER_PORT);
+    if ((fd < 0) || (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+            (setsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_DELAYED_ACK, &delack,
+                        sizeof(delack)) < 0) ||
+            (listen(fd, 1) < 0))
+        return 1;
+    conn = accept(fd, (struct sockaddr *) &addr, &len);
+    if (conn < 0)
+        return 1;
+    while ((n = recv(conn, buffer, sizeof(buffer), 0)) > 0)
+        if (send(conn, buffer, n, 0) < 0)
+            break;
+    return 1;
+}
+
+static int run_client()
+{
+    struct sockaddr_in addr;
+    char buffer[MESSAGE_SIZE];
+    double *rtt = malloc(MESSAGES * sizeof(double));
+    double t0, sum = 0;
+    int fd, i;
+
+    start_simptcp(CLIENT_PORT);
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_SIMPTCP);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(SERVER_PORT);
+    if ((fd < 0) ||
+            (setsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_DELAYED_ACK, &delack,
+                        sizeof(delack)) < 0) ||
+            (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0))
+    {
+        fprintf(stderr, "connect failed\n");
+        return 1;
+    }
+    memset(buffer, 'x', sizeof(buffer));
+    for (i = 0; i < MESSAGES; i++)
+    {
+        t0 = now_us();
+        if ((send(fd, buffer, sizeof(buffer), 0) < 0) ||
+                (recv(fd, buffer, sizeof(buffer), 0) <= 0))
+            return 1;
+        rtt[i] = now_us() - t0;
+        sum += rtt[i];
+    }
+
+    qsort(rtt, MESSAGES, sizeof(double), cmp_double);
+    fprintf(stderr, "%d round trips of %d bytes : mean %.1f us, p50 %.1f us, "
+            "p99 %.1f us, max %.1f us\n", MESSAGES, MESSAGE_SIZE, sum / MESSAGES,
+            rtt[MESSAGES / 2], rtt[MESSAGES * 99 / 100], rtt[MESSAGES - 1]);
+    free(rtt);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    pid_t server;
+    int status, res;
+
+    if (argc > 1)
+        delack = atoi(argv[1]);
+    server = fork();
+    if (server < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+    if (server == 0)
+        return run_server();
+
+    usleep(200000); /* let the server listen */
+    res = run_client();
+    kill(server, SIGTERM);
+    waitpid(server, &status, 0);
+    return res;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,321 @@
+/* Bulk transfer throughput benchmark of simptcp on loopback : a forked
+   server accepts one connection and reads until the client closes it; the
+   client sends as many bytes as n Ethernet PDUs carry (SIMPTCP_MAX_SIZE each)
+   in messages of M bytes, by default one PDU of the negotiated MSS (less the
+   room taken by the header options) per send, and closes the connection.
+   The server reads a message per recv and times the transfer, from the first
+   message read to the FIN (sent once every PDU is acknowledged).
+   Protocol traces go to stdout, results to stderr :
+   run with ./bench_throughput [-w window] [-R window] [-S queue] [-l loss] [-s] [-r rto] [-m mtu] [-p] [-d delay] [-c cc] [-P rate] [-M size] [-n pdus] > /dev/null
+     -w : Go-Back-N sending window (stop-and-wait if absent)
+     -R : receive queue of the server, in PDUs (default 4 times -w)
+     -S : send queue of the client, in PDUs (default 64, at least 2 times -w)
+     -l : emulated loss rate of both entities, in percent
+     -s : selective repeat receiver (SACK option)
+     -r : minimum retransmission timeout of the client, in ms
+     -m : MTU of both entities (default 1500, up to 65535 on loopback)
+     -p : path MTU discovery (the client probes up to the MTU)
+     -d : delayed ACKs of the server, longest delay in ms
+     -c : congestion control of the client (none, newreno, bbr, ledbat)
+     -P : largest pacing rate of the client, in Mbit/s
+     -M : size of the messages, in bytes (fragmented in PDUs by simptcp)
+     -n : number of Ethernet PDUs to transfer (default 20000) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <simptcp_api.h>
+#include <simptcp_entity.h>
+#include <simptcp_packet.h>
+#include <simptcp_pmtu.h>
+#include <simptcp_cc.h>
+
+#define SERVER_PORT 15610 /* server udp port = listening simptcp port */
+#define CLIENT_PORT 15611
+#define MESSAGE_SIZE SIMPTCP_MAX_SIZE
+#define BUFFER_SIZE SIMPTCP_MTU_MSS(SIMPTCP_MAX_MTU) /* largest PDU payload */
+
+static int window = 0; /* Go-Back-N window, 0 : stop-and-wait */
+static int rcv_window = 0; /* 0 : 4 * window */
+static int snd_queue = 0; /* 0 : default */
+static double loss = 0; /* emulated loss rate */
+static int sack = 0;
+static int rto_min = 0; /* 0 : default */
+static long messages = 20000;
+static int mtu = SIMPTCP_DEFAULT_MTU;
+static int pmtu_discovery = 0;
+static int delack = 0; /* 0 : every PDU acknowledged at once */
+static int cc = SIMPTCP_CC_NEWRENO;
+static int max_rate = 0; /* bytes/s, 0 : no bound */
+static long message_size = 0; /* 0 : one PDU */
+
+static double now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int run_server()
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    static char buffer[BUFFER_SIZE];
+    char *message = buffer;
+    long received = 0, count = 0, size = BUFFER_SIZE;
+    int fd, conn, n, mss, rcvbuf;
+    socklen_t optlen = sizeof(mss);
+    double t0 = 0, elapsed;
+
+    simptcp_set_rx_loss_rate(loss);
+    if ((simptcp_set_mtu(mtu) < 0) ||
+            (simptcp_set_pmtu_discovery(pmtu_discovery) < 0))
+        return 1;
+    start_simptcp(SERVER_PORT);
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_SIMPTCP);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(SERVER_PORT);
+    if ((fd < 0) || (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+            (listen(fd, 1) < 0))
+        return 1;
+    /* room for the reader to lag behind the sender before the advertised
+       window closes, in bytes of PDUs of the MSS; the options are inherited
+       by the accepted socket */
+    if (rcv_window == 0)
+        rcv_window = 4 * window;
+    rcvbuf = rcv_window * SIMPTCP_MTU_MSS(mtu);
+    if (((rcv_window > 0) &&
+            (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0)) ||
+            (setsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_SACK, &sack,
+                        sizeof(sack)) < 0) ||
+            (setsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_DELAYED_ACK, &delack,
+                        sizeof(delack)) < 0))
+    {
+        perror("setsockopt");
+        return 1;
+    }
+    conn = accept(fd, (struct sockaddr *) &addr, &len);
+    if ((conn < 0) ||
+            (getsockopt(conn, IPPROTO_SIMPTCP, SIMPTCP_MAXSEG, &mss, &optlen) < 0))
+        return 1;
+    if (message_size > size)
+    {
+        size = message_size;
+        if ((message = malloc(size)) == NULL)
+            return 1;
+    }
+    while ((n = recv(conn, message, size, 0)) > 0)
+    {
+        if (received == 0)
+            t0 = now_us();
+        received += n;
+        count++;
+    }
+    elapsed = now_us() - t0;
+    close(conn);
+    if (message != buffer)
+        free(message);
+    if (received != messages * MESSAGE_SIZE)
+    {
+        fprintf(stderr, "%ld bytes received out of %ld\n", received,
+                messages * MESSAGE_SIZE);
+        return 1;
+    }
+
+    if (window > 0)
+        fprintf(stderr, "Go-Back-N, window %d", window);
+    else
+        fprintf(stderr, "stop-and-wait");
+    if (rcv_window > 0)
+        fprintf(stderr, ", receive queue %d", rcv_window);
+    fprintf(stderr, "%s, %.1f%% loss, MSS %d : %ld bytes in %.1f ms, %.1f Mbit/s\n",
+            sack ? ", SACK" : "", loss * 100, mss, received, elapsed / 1e3,
+            received * 8 / elapsed);
+    fprintf(stderr, "%ld messages read, server transmitted %lu PDUs, "
+            "received %lu on the fast path and %lu on the slow path\n", count,
+            simptcp_entity.stats.tx_pdu_count, simptcp_entity.stats.rx_fast_path_count,
+            simptcp_entity.stats.rx_slow_path_count);
+    return 0;
+}
+
+static int run_client()
+{
+    struct sockaddr_in addr;
+    struct simptcp_options options;
+    char *buffer;
+    int fd, n, on = 1, cwnd, rate, mss, sndbuf;
+    socklen_t optlen = sizeof(cwnd);
+    long left;
+
+    simptcp_set_rx_loss_rate(loss);
+    if ((simptcp_set_mtu(mtu) < 0) ||
+            (simptcp_set_pmtu_discovery(pmtu_discovery) < 0))
+    {
+        fprintf(stderr, "invalid MTU %d\n", mtu);
+        return 1;
+    }
+    start_simptcp(CLIENT_PORT);
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_SIMPTCP);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(SERVER_PORT);
+    if ((fd < 0) || (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0))
+    {
+        fprintf(stderr, "connect failed\n");
+        return 1;
+    }
+    if ((window > 0) &&
+            ((setsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_SENDING_WINDOW, &window,
+                         sizeof(window)) < 0) ||
+             (setsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_GO_BACK_N, &on,
+                         sizeof(on)) < 0)))
+    {
+        perror("setsockopt");
+        return 1;
+    }
+    /* room for the application to run ahead of the acknowledgements */
+    sndbuf = snd_queue * SIMPTCP_MTU_MSS(mtu);
+    if (((snd_queue > 0) &&
+            (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0)) ||
+            ((rto_min > 0) &&
+            (setsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_RTO_MIN, &rto_min,
+                        sizeof(rto_min)) < 0)) ||
+            (setsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_CONGESTION, &cc,
+                        sizeof(cc)) < 0) ||
+            (setsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_MAX_PACING_RATE, &max_rate,
+                        sizeof(max_rate)) < 0))
+    {
+        perror("setsockopt");
+        return 1;
+    }
+    if (message_size == 0)
+    {
+        /* one PDU : the MSS less the timestamps option */
+        if (getsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_MAXSEG, &mss, &optlen) < 0)
+            return 1;
+        options.present = SIMPTCP_TS_OPTION;
+        message_size = mss - simptcp_options_len(&options);
+    }
+    if ((buffer = malloc(message_size)) == NULL)
+        return 1;
+    memset(buffer, 'x', message_size);
+    for (left = messages * MESSAGE_SIZE; left > 0; left -= n)
+    {
+        n = send(fd, buffer, left < message_size ? left : message_size, 0);
+        if (n < 0)
+            return 1;
+    }
+    free(buffer);
+    if ((getsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_CWND, &cwnd, &optlen) < 0) ||
+            (getsockopt(fd, IPPROTO_SIMPTCP, SIMPTCP_PACING_RATE, &rate, &optlen) < 0) ||
+            (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) < 0))
+        return 1;
+    close(fd);
+    fprintf(stderr, "client transmitted %lu PDUs, send queue %d bytes, %s cwnd %d",
+            simptcp_entity.stats.tx_pdu_count, sndbuf,
+            simptcp_cc_algorithms[cc]->name, cwnd);
+    if (rate > 0)
+        fprintf(stderr, ", pacing rate %.1f Mbit/s", rate * 8.0 / 1e6);
+    if (max_rate > 0)
+        fprintf(stderr, ", max pacing rate %.1f Mbit/s", max_rate * 8.0 / 1e6);
+    if (pmtu_discovery)
+        fprintf(stderr, ", path MTU %u",
+                simptcp_pmtu_cache_lookup(addr.sin_addr));
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    pid_t server;
+    int status, res, opt;
+    unsigned int i;
+
+    while ((opt = getopt(argc, argv, "w:R:S:l:sr:m:pd:c:P:M:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'R':
+            rcv_window = atoi(optarg);
+            break;
+        case 'S':
+            snd_queue = atoi(optarg);
+            break;
+        case 'l':
+            loss = atof(optarg) / 100;
+            break;
+        case 's':
+            sack = 1;
+            break;
+        case 'r':
+            rto_min = atoi(optarg);
+            break;
+        case 'm':
+            mtu = atoi(optarg);
+            break;
+        case 'p':
+            pmtu_discovery = 1;
+            break;
+        case 'd':
+            delack = atoi(optarg);
+            break;
+        case 'c':
+            for (i = 0; (i < simptcp_cc_algorithm_count) &&
+                    strcmp(optarg, simptcp_cc_algorithms[i]->name); i++)
+                ;
+            if (i == simptcp_cc_algorithm_count)
+            {
+                fprintf(stderr, "unknown congestion control %s\n", optarg);
+                return 1;
+            }
+            cc = i;
+            break;
+        case 'P':
+            max_rate = atof(optarg) * 1e6 / 8;
+            break;
+        case 'M':
+            message_size = atol(optarg);
+            break;
+        case 'n':
+            messages = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage : %s [-w window] [-R window] [-S queue] [-l loss] [-s] [-r rto] "
+                    "[-m mtu] [-p] [-d delay] [-c cc] [-P rate] [-M size] [-n pdus]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    server = fork();
+    if (server < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+    if (server == 0)
+        return run_server();
+
+    usleep(200000); /* let the server listen */
+    res = run_client();
+    if (res != 0)
+        kill(server, SIGTERM);
+    waitpid(server, &status, 0);
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+        res = 1;
+    return res;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
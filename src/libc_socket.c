@@ -2,10 +2,10 @@
  * libc_socket.c
  */
 
+#define _GNU_SOURCE             /* for recvmmsg(), sendmmsg(), RTLD_NEXT */
 #include <stdio.h>              /* for printf() */
 #include <netdb.h>              /* for struct sockaddr and socklen_t */
 
-#define __USE_GNU
 #include <dlfcn.h>              /* for dlsym(), */
 #include <term_colors.h>        /* for color macros */
 #define __PREFIX__              "[" COLOR("LIBC-SOCKET", BRIGHT_BLUE) " ] "
@@ -38,6 +38,10 @@ static ssize_t (*recvfrom_ptr) (int fd, void *buf, size_t n, int flags,
                                 struct sockaddr *addr, socklen_t *addr_len);
 static ssize_t (*sendmsg_ptr) (int fd, const struct msghdr *message, int flags);
 static ssize_t (*recvmsg_ptr) (int fd, struct msghdr *message, int flags);
+static int (*sendmmsg_ptr) (int fd, struct mmsghdr *vmessages, unsigned int vlen,
+                            int flags);
+static int (*recvmmsg_ptr) (int fd, struct mmsghdr *vmessages, unsigned int vlen,
+                            int flags, struct timespec *tmo);
 static int (*listen_ptr) (int fd, int n);
 static int (*accept_ptr) (int fd, struct sockaddr *addr, socklen_t *addr_len);
 static int (*shutdown_ptr) (int fd, int how);
@@ -163,6 +167,32 @@ ssize_t libc_recvmsg (int fd, struct msghdr *message, int flags)
     return recvmsg_ptr(fd, message, flags);
 }
 
+int libc_sendmmsg (int fd, struct mmsghdr *vmessages, unsigned int vlen,
+                   int flags)
+{
+    //#if __DEBUG__
+    //printf("function %s called\n", __func__);
+    //#endif
+
+    INIT_FUNCTION_POINTER(sendmmsg);
+    CHECK_FUNCTION_POINTER(sendmmsg);
+
+    return sendmmsg_ptr(fd, vmessages, vlen, flags);
+}
+
+int libc_recvmmsg (int fd, struct mmsghdr *vmessages, unsigned int vlen,
+                   int flags, struct timespec *tmo)
+{
+    //#if __DEBUG__
+    //printf("function %s called\n", __func__);
+    //#endif
+
+    INIT_FUNCTION_POINTER(recvmmsg);
+    CHECK_FUNCTION_POINTER(recvmmsg);
+
+    return recvmmsg_ptr(fd, vmessages, vlen, flags, tmo);
+}
+
 
 int libc_listen (int fd, int n)
 {
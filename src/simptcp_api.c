@@ -34,10 +34,7 @@ int is_simptcp_descriptor(int fd)
     printf("function %s called\n", __func__);
 #endif
 
-    if ((fd >= 0) && (fd <= UINT16_MAX))
-    {
-        res = (simptcp_entity.simptcp_socket_descriptors[fd] != NULL);
-    }
+    res = (get_simptcp_socket(fd) != NULL);
 #if __DEBUG__
     printf("descriptor %d %s a simptcp descriptor\n", fd, res ? "IS" : "IS NOT");
 #endif
@@ -97,7 +94,7 @@ int bind (int fd, const struct sockaddr *addr, socklen_t len)
     if (addr == NULL)
         return -EINVAL;
     /* Set the simptcp local socket with the binded one */
-    memcpy(&(simptcp_entity.simptcp_socket_descriptors[fd]->local_simptcp), addr, len);
+    memcpy(&(get_simptcp_socket(fd)->local_simptcp), addr, len);
 
     return 0;
 }
@@ -115,7 +112,7 @@ int connect (int fd, const struct sockaddr *addr, socklen_t len)
         return libc_connect(fd, addr, len);
     }
     /* Here comes the code for the connect related to simptcp */
-    sock=simptcp_entity.simptcp_socket_descriptors[fd];
+    sock=get_simptcp_socket(fd);
     return sock->socket_state->active_open(sock,(struct sockaddr *)addr,len);
 }
 
@@ -133,7 +130,7 @@ ssize_t send (int fd, const void *buf, size_t n, int flags)
     }
 
     /* Here comes the code for the send related to simptcp */
-    sock=simptcp_entity.simptcp_socket_descriptors[fd];
+    sock=get_simptcp_socket(fd);
     return sock->socket_state->send(sock,buf,n,flags);
 
 }
@@ -154,7 +151,7 @@ ssize_t recv (int fd, void *buf, size_t n, int flags)
     /* Here comes the code for the recv related to simptcp */
 
 
-    sock=simptcp_entity.simptcp_socket_descriptors[fd];
+    sock=get_simptcp_socket(fd);
     return sock->socket_state->recv(sock,buf,n,flags);
 }
 
@@ -177,7 +174,7 @@ int listen (int fd, int n)
     if (n >= SOMAXCONN)
         return -EINVAL;
 
-    sock=simptcp_entity.simptcp_socket_descriptors[fd];
+    sock=get_simptcp_socket(fd);
     return sock->socket_state->passive_open(sock,n);
 
     return 0;
@@ -196,7 +193,7 @@ int accept (int fd, struct sockaddr *addr, socklen_t *addr_len)
     }
 
     /* Here comes the code for the accept related to simtcp */
-    sock=simptcp_entity.simptcp_socket_descriptors[fd];
+    sock=get_simptcp_socket(fd);
     return sock->socket_state->accept(sock,addr,addr_len);
 }
 
@@ -212,12 +209,15 @@ int shutdown (int fd, int how)
         return libc_shutdown(fd, how);
 
     /* Here comes the code for the shutdown related to simtcp */
-    sock=simptcp_entity.simptcp_socket_descriptors[fd];
+    sock=get_simptcp_socket(fd);
     return sock->socket_state->shutdown (sock,how);
 }
 
 int close (int fd)
 {
+    struct simptcp_socket* sock;
+    int res;
+
 #if __DEBUG__
     printf("function %s called\n", __func__);
 #endif
@@ -228,8 +228,15 @@ int close (int fd)
     }
 
     /* Here comes the code for the close related to simtcp */
-
-    return shutdown(fd, SHUT_RDWR);
+    res = shutdown(fd, SHUT_RDWR);
+
+    /* a socket that no longer takes part in a connection gives back its
+       descriptor and control block */
+    sock = get_simptcp_socket(fd);
+    if ((sock->socket_state == &(simptcp_entity.simptcp_socket_states->closed)) ||
+            (sock->socket_state == &(simptcp_entity.simptcp_socket_states->listen)))
+        release_simptcp_socket(fd);
+    return res;
 }
 
 ssize_t read (int fd, void *buf, size_t n)
@@ -288,6 +295,14 @@ int getsockopt (int fd, int level, int optname, void *optval,
     printf("function %s called\n", __func__);
 #endif
 
+    if (is_simptcp_descriptor(fd) && (level == IPPROTO_SIMPTCP))
+        return get_simptcp_socket_option(get_simptcp_socket(fd), optname,
+                                         optval, optlen);
+    /* buffer sizes are those of the simptcp socket, not of the udp one */
+    if (is_simptcp_descriptor(fd) && (level == SOL_SOCKET) &&
+            ((optname == SO_RCVBUF) || (optname == SO_SNDBUF)))
+        return get_simptcp_socket_buffer(get_simptcp_socket(fd), optname,
+                                         optval, optlen);
     return libc_getsockopt(fd, level, optname, optval, optlen);
 }
 
@@ -299,6 +314,13 @@ int setsockopt (int fd, int level, int optname, const void *optval,
     printf("function %s called\n", __func__);
 #endif
 
+    if (is_simptcp_descriptor(fd) && (level == IPPROTO_SIMPTCP))
+        return set_simptcp_socket_option(get_simptcp_socket(fd), optname,
+                                         optval, optlen);
+    if (is_simptcp_descriptor(fd) && (level == SOL_SOCKET) &&
+            ((optname == SO_RCVBUF) || (optname == SO_SNDBUF)))
+        return set_simptcp_socket_buffer(get_simptcp_socket(fd), optname,
+                                         optval, optlen);
     return libc_setsockopt(fd, level,optname, optval, optlen);
 }
 
@@ -0,0 +1,103 @@
+/*! \file simptcp_cc.c
+*  \brief{Congestion control framework : table of the algorithms and the
+*  "none" algorithm (fixed window, the sending window alone limits the
+*  sender). The functions are called with the socket locked.}
+*/
+
+#include <stdint.h>
+#include <errno.h>              /* for errno macros */
+
+#include <simptcp_api.h>        /* for SIMPTCP_CC_* */
+#include <simptcp_cc.h>
+#include <simptcp_lib.h>
+
+/* algorithms, indexed by their SIMPTCP_CC_* identifier */
+const simptcp_cc_ops *simptcp_cc_algorithms[] =
+{
+    &simptcp_cc_none,
+    &simptcp_cc_newreno,
+    &simptcp_cc_bbr,
+    &simptcp_cc_ledbat
+};
+const unsigned int simptcp_cc_algorithm_count =
+    sizeof(simptcp_cc_algorithms) / sizeof(simptcp_cc_algorithms[0]);
+
+/*!
+ * \fn static void none_simptcp_cc_init(struct simptcp_socket *sock)
+ * \brief fenetre de congestion illimitee : seule la fenetre d'emission borne
+ * le nombre de PDU en vol
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+static void none_simptcp_cc_init(struct simptcp_socket *sock)
+{
+    sock->cwnd = UINT16_MAX;
+    sock->ssthresh = UINT16_MAX;
+}
+
+static void none_simptcp_cc_on_ack(struct simptcp_socket *sock,
+                                   const struct simptcp_rate_sample *rs)
+{
+}
+
+static void none_simptcp_cc_on_event(struct simptcp_socket *sock)
+{
+}
+
+const simptcp_cc_ops simptcp_cc_none =
+{
+    "none",
+    &none_simptcp_cc_init,
+    &none_simptcp_cc_on_ack,
+    &none_simptcp_cc_on_event,
+    &none_simptcp_cc_on_event
+};
+
+/*!
+ * \fn int simptcp_cc_set(struct simptcp_socket *sock, int id)
+ * \brief attache un algorithme de controle de congestion a un socket et
+ * l'initialise
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param id identifiant SIMPTCP_CC_* de l'algorithme
+ * \return 0 si succes, -EINVAL si l'algorithme est inconnu
+ */
+int simptcp_cc_set(struct simptcp_socket *sock, int id)
+{
+    if ((id < 0) || (id >= simptcp_cc_algorithm_count))
+        return -EINVAL;
+    sock->cc = simptcp_cc_algorithms[id];
+    sock->pacing_rate = 0;
+    sock->cc->init(sock);
+    return 0;
+}
+
+/*!
+ * \fn int simptcp_cc_get(struct simptcp_socket *sock)
+ * \brief renvoie l'identifiant SIMPTCP_CC_* de l'algorithme d'un socket
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return identifiant de l'algorithme
+ */
+int simptcp_cc_get(struct simptcp_socket *sock)
+{
+    int id;
+
+    for (id = 0; id < simptcp_cc_algorithm_count; id++)
+        if (simptcp_cc_algorithms[id] == sock->cc)
+            return id;
+    return SIMPTCP_CC_NONE;
+}
+
+/*!
+ * \fn unsigned int simptcp_cc_window(struct simptcp_socket *sock)
+ * \brief nombre de PDU que l'emetteur peut avoir en vol
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return min(cwnd, fenetre d'emission), au moins 1
+ */
+unsigned int simptcp_cc_window(struct simptcp_socket *sock)
+{
+    if (sock->cwnd == 0)
+        return 1;
+    return sock->cwnd < sock->sending_window_size ? sock->cwnd :
+           sock->sending_window_size;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,296 @@
+/*! \file simptcp_cc_bbr.c
+*  \brief{Model based congestion control in the style of BBR : the sender
+*  estimates the bottleneck bandwidth (max of the delivery rate samples over
+*  the last round trips) and the round trip propagation time (min of the RTT
+*  samples over the last seconds), and derives the pacing rate and cwnd from
+*  them, with gains that depend on its phase (STARTUP, DRAIN, PROBE_BW,
+*  PROBE_RTT). Unlike NewReno, a loss does not shrink the window.}
+*/
+
+#include <stdint.h>
+
+#include <simptcp_cc.h>
+#include <simptcp_lib.h>
+#include <simptcp_packet.h>
+#include <simptcp_pmtu.h>
+#include <simptcp_timer.h>
+
+#define BBR_HIGH_GAIN 2.885 /* 2/ln(2) : STARTUP doubles the rate each round trip */
+#define BBR_CWND_GAIN 2.0 /* PROBE_BW cwnd, in BDP */
+#define BBR_BW_WINDOW 10 /* round trips of the bandwidth max filter */
+#define BBR_MIN_RTT_WINDOW 10000000 /* life of a min RTT sample, in us */
+#define BBR_PROBE_RTT_DURATION 200000 /* time spent at BBR_MIN_CWND, in us */
+#define BBR_MIN_CWND 4 /* in PDUs */
+#define BBR_ACK_QUANTUM 3 /* extra cwnd for delayed and aggregated ACKs, in PDUs */
+#define BBR_FULL_BW_GROWTH 1.25 /* STARTUP ends when the bandwidth grows less */
+#define BBR_FULL_BW_ROUNDS 3 /* in as many round trips */
+#define BBR_CYCLE_LEN 8 /* phases of the PROBE_BW gain cycle, one min RTT each */
+
+/* PROBE_BW : probe for more bandwidth, drain the queue it built, cruise */
+static const double bbr_pacing_gain[BBR_CYCLE_LEN] =
+{
+    1.25, 0.75, 1, 1, 1, 1, 1, 1
+};
+
+/*!
+ * \enum bbr_simptcp_cc_modes
+ * \brief phases of the BBR sender
+ */
+enum bbr_simptcp_cc_modes
+{
+    BBR_STARTUP=0, /* exponential growth until the bandwidth stops growing */
+    BBR_DRAIN=1, /* empty the queue built by STARTUP */
+    BBR_PROBE_BW=2, /* steady state, cycling the pacing gain */
+    BBR_PROBE_RTT=3 /* cwnd at its minimum to measure the min RTT again */
+};
+
+/*!
+ * \struct bbr_simptcp_cc
+ * \brief state of BBR in the socket (cc_priv)
+ */
+struct bbr_simptcp_cc
+{
+    double max_bw; /*!< bottleneck bandwidth estimate, in PDUs/s */
+    double full_bw; /*!< STARTUP : bandwidth of the last significant growth */
+    double min_rtt; /*!< round trip propagation time estimate in s, 0 : none */
+    uint64_t min_rtt_at; /*!< date of the min RTT sample, in us */
+    uint64_t cycle_at; /*!< PROBE_BW : date the gain phase began, in us */
+    uint64_t probe_rtt_done_at; /*!< PROBE_RTT : end date in us, 0 : cwnd
+                                  not at its minimum yet */
+    double pacing_gain;
+    double cwnd_gain;
+    unsigned long next_round_delivered; /*!< delivered count ending the round trip */
+    unsigned int round_count; /*!< round trips elapsed */
+    unsigned int bw_round; /*!< round trip of the max_bw sample */
+    unsigned int prior_cwnd; /*!< cwnd before PROBE_RTT or a timeout */
+    unsigned char mode; /*!< #bbr_simptcp_cc_modes */
+    unsigned char cycle_index; /*!< PROBE_BW : phase in #bbr_pacing_gain */
+    unsigned char full_bw_count; /*!< STARTUP : round trips without growth */
+    unsigned char full_bw_reached; /*!< 1 : the bottleneck is full */
+    unsigned char min_rtt_expired; /*!< 1 : the last ACK found the min RTT
+                                     sample too old */
+};
+SIMPTCP_CC_PRIV_CHECK(bbr_simptcp_cc);
+
+/*!
+ * \fn static unsigned int bbr_simptcp_cc_bdp(struct simptcp_socket *sock, double gain)
+ * \brief produit debit-delai estime, multiplie par un gain
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param gain gain applique
+ * \return BDP en PDU, la fenetre initiale si le modele est encore vide
+ */
+static unsigned int bbr_simptcp_cc_bdp(struct simptcp_socket *sock, double gain)
+{
+    struct bbr_simptcp_cc *bbr = simptcp_cc_priv(sock);
+
+    if ((bbr->max_bw == 0) || (bbr->min_rtt == 0))
+        return SIMPTCP_CC_INITIAL_WINDOW;
+    return (unsigned int) (gain * bbr->max_bw * bbr->min_rtt + 0.5);
+}
+
+/*!
+ * \fn static void bbr_simptcp_cc_set_mode(struct simptcp_socket *sock, unsigned char mode)
+ * \brief entre dans une phase et fixe ses gains
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param mode phase (#bbr_simptcp_cc_modes)
+ */
+static void bbr_simptcp_cc_set_mode(struct simptcp_socket *sock, unsigned char mode)
+{
+    struct bbr_simptcp_cc *bbr = simptcp_cc_priv(sock);
+
+    bbr->mode = mode;
+    switch (mode)
+    {
+    case BBR_STARTUP:
+        bbr->pacing_gain = BBR_HIGH_GAIN;
+        bbr->cwnd_gain = BBR_HIGH_GAIN;
+        break;
+    case BBR_DRAIN:
+        bbr->pacing_gain = 1 / BBR_HIGH_GAIN;
+        bbr->cwnd_gain = BBR_HIGH_GAIN;
+        break;
+    case BBR_PROBE_BW:
+        bbr->cycle_index = 0;
+        bbr->cycle_at = simptcp_timer_now_us();
+        bbr->pacing_gain = bbr_pacing_gain[0];
+        bbr->cwnd_gain = BBR_CWND_GAIN;
+        break;
+    case BBR_PROBE_RTT:
+        bbr->prior_cwnd = sock->cwnd;
+        bbr->probe_rtt_done_at = 0;
+        bbr->pacing_gain = 1;
+        bbr->cwnd_gain = 1;
+        break;
+    }
+}
+
+static void bbr_simptcp_cc_init(struct simptcp_socket *sock)
+{
+    struct bbr_simptcp_cc *bbr = simptcp_cc_priv(sock);
+
+    bbr->max_bw = 0;
+    bbr->full_bw = 0;
+    bbr->min_rtt = 0;
+    bbr->min_rtt_at = 0;
+    bbr->next_round_delivered = sock->delivered;
+    bbr->round_count = 0;
+    bbr->bw_round = 0;
+    bbr->full_bw_count = 0;
+    bbr->full_bw_reached = 0;
+    bbr->min_rtt_expired = 0;
+    bbr->prior_cwnd = 0;
+    bbr_simptcp_cc_set_mode(sock, BBR_STARTUP);
+    sock->cwnd = SIMPTCP_CC_INITIAL_WINDOW;
+    sock->ssthresh = UINT16_MAX;
+}
+
+/*!
+ * \fn static void bbr_simptcp_cc_update_model(struct simptcp_socket *sock, const struct simptcp_rate_sample *rs, uint64_t now)
+ * \brief met a jour le modele du chemin avec les mesures d'un ACK : compte
+ * les allers-retours, filtre le debit (max sur #BBR_BW_WINDOW allers-retours)
+ * et le RTT (min sur #BBR_MIN_RTT_WINDOW us), detecte la saturation du goulot
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param rs mesures de l'ACK
+ * \param now date en us
+ */
+static void bbr_simptcp_cc_update_model(struct simptcp_socket *sock,
+                                        const struct simptcp_rate_sample *rs,
+                                        uint64_t now)
+{
+    struct bbr_simptcp_cc *bbr = simptcp_cc_priv(sock);
+    int round_start = 0;
+    double bw;
+
+    /* a round trip ends when a PDU sent after its beginning is acknowledged */
+    if ((rs->delivered > 0) && (rs->prior_delivered >= bbr->next_round_delivered))
+    {
+        bbr->next_round_delivered = sock->delivered;
+        bbr->round_count++;
+        round_start = 1;
+    }
+    if ((rs->delivered > 0) && (rs->interval_us > 0))
+    {
+        bw = rs->delivered * 1e6 / rs->interval_us;
+        if ((bw >= bbr->max_bw) || (bbr->round_count - bbr->bw_round >= BBR_BW_WINDOW))
+        {
+            bbr->max_bw = bw;
+            bbr->bw_round = bbr->round_count;
+        }
+    }
+    /* last_rtt : the sample just fed to the RTO estimator */
+    bbr->min_rtt_expired = (bbr->min_rtt > 0) &&
+                           (now - bbr->min_rtt_at > BBR_MIN_RTT_WINDOW);
+    if ((rs->rtt > 0) && ((bbr->min_rtt == 0) || bbr->min_rtt_expired ||
+                          (sock->last_rtt <= bbr->min_rtt)))
+    {
+        bbr->min_rtt = sock->last_rtt;
+        bbr->min_rtt_at = now;
+    }
+    if (!bbr->full_bw_reached && round_start)
+    {
+        if (bbr->max_bw >= bbr->full_bw * BBR_FULL_BW_GROWTH)
+        {
+            bbr->full_bw = bbr->max_bw;
+            bbr->full_bw_count = 0;
+        }
+        else if (++bbr->full_bw_count >= BBR_FULL_BW_ROUNDS)
+            bbr->full_bw_reached = 1;
+    }
+}
+
+/*!
+ * \fn static void bbr_simptcp_cc_on_ack(struct simptcp_socket *sock, const struct simptcp_rate_sample *rs)
+ * \brief met a jour le modele, change de phase si besoin, puis fixe le debit
+ * d'emission (gain x debit du goulot) et cwnd (gain x BDP)
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param rs mesures de l'ACK
+ */
+static void bbr_simptcp_cc_on_ack(struct simptcp_socket *sock,
+                                  const struct simptcp_rate_sample *rs)
+{
+    struct bbr_simptcp_cc *bbr = simptcp_cc_priv(sock);
+    uint64_t now = simptcp_timer_now_us();
+    unsigned int target;
+    double rate;
+
+    /* a duplicate ACK delivers nothing the model can use */
+    if (rs->acked == 0)
+        return;
+    bbr_simptcp_cc_update_model(sock, rs, now);
+
+    if ((bbr->mode == BBR_STARTUP) && bbr->full_bw_reached)
+        bbr_simptcp_cc_set_mode(sock, BBR_DRAIN);
+    if ((bbr->mode == BBR_DRAIN) &&
+            (simptcp_in_flight(sock) <= bbr_simptcp_cc_bdp(sock, 1)))
+        bbr_simptcp_cc_set_mode(sock, BBR_PROBE_BW);
+    if ((bbr->mode == BBR_PROBE_BW) && (now - bbr->cycle_at > bbr->min_rtt * 1e6))
+    {
+        bbr->cycle_index = (bbr->cycle_index + 1) % BBR_CYCLE_LEN;
+        bbr->cycle_at = now;
+        bbr->pacing_gain = bbr_pacing_gain[bbr->cycle_index];
+    }
+    /* the min RTT has not been seen again for long : drain the queue to
+       measure it */
+    if ((bbr->mode != BBR_PROBE_RTT) && bbr->min_rtt_expired)
+        bbr_simptcp_cc_set_mode(sock, BBR_PROBE_RTT);
+    if (bbr->mode == BBR_PROBE_RTT)
+    {
+        if ((bbr->probe_rtt_done_at == 0) && (simptcp_in_flight(sock) <= BBR_MIN_CWND))
+            bbr->probe_rtt_done_at = now + BBR_PROBE_RTT_DURATION;
+        else if ((bbr->probe_rtt_done_at != 0) && (now >= bbr->probe_rtt_done_at))
+        {
+            bbr->min_rtt_at = now;
+            sock->cwnd = sock->cwnd > bbr->prior_cwnd ? sock->cwnd : bbr->prior_cwnd;
+            bbr_simptcp_cc_set_mode(sock, bbr->full_bw_reached ? BBR_PROBE_BW : BBR_STARTUP);
+        }
+    }
+
+    /* pacing rate, in bytes/s; STARTUP never lowers it */
+    if (bbr->max_bw > 0)
+        rate = bbr->pacing_gain * bbr->max_bw *
+               (SIMPTCP_GHEADER_SIZE + simptcp_pmtu_mss(sock));
+    else if (sock->rtt_estimate > 0)
+        rate = bbr->pacing_gain * sock->cwnd *
+               (SIMPTCP_GHEADER_SIZE + simptcp_pmtu_mss(sock)) / sock->rtt_estimate;
+    else
+        rate = 0;
+    if (bbr->full_bw_reached || (rate > sock->pacing_rate))
+        sock->pacing_rate = rate;
+
+    /* cwnd grows toward its target as PDUs are delivered */
+    if (bbr->mode == BBR_PROBE_RTT)
+    {
+        if (sock->cwnd > BBR_MIN_CWND)
+            sock->cwnd = BBR_MIN_CWND;
+        return;
+    }
+    target = bbr_simptcp_cc_bdp(sock, bbr->cwnd_gain) + BBR_ACK_QUANTUM;
+    if (bbr->full_bw_reached)
+        sock->cwnd = sock->cwnd + rs->acked < target ? sock->cwnd + rs->acked : target;
+    else if ((sock->cwnd < target) || (sock->delivered < SIMPTCP_CC_INITIAL_WINDOW))
+        sock->cwnd += rs->acked;
+    if (sock->cwnd < BBR_MIN_CWND)
+        sock->cwnd = BBR_MIN_CWND;
+}
+
+static void bbr_simptcp_cc_on_loss(struct simptcp_socket *sock)
+{
+}
+
+static void bbr_simptcp_cc_on_rto(struct simptcp_socket *sock)
+{
+    /* the unacked PDUs are sent again : cwnd grows back by one PDU per PDU
+       delivered, up to the BDP target */
+    sock->cwnd = 1;
+}
+
+const simptcp_cc_ops simptcp_cc_bbr =
+{
+    "bbr",
+    &bbr_simptcp_cc_init,
+    &bbr_simptcp_cc_on_ack,
+    &bbr_simptcp_cc_on_loss,
+    &bbr_simptcp_cc_on_rto
+};
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,195 @@
+/*! \file simptcp_cc_ledbat.c
+*  \brief{Less than best effort congestion control in the style of LEDBAT
+*  [RFC6817] : the sender measures the one-way delay of the path with the
+*  timestamp option, takes its minimum over the last minutes as the base
+*  delay and the excess as the queueing delay. The window grows while the
+*  queueing delay stays below a target and shrinks in proportion as soon as
+*  it exceeds it, so that the flow yields to competing best effort flows
+*  before they see a loss. Without the timestamp option, the window only
+*  reacts to losses. The window is counted in PDUs.}
+*/
+
+#include <stdint.h>
+
+#include <simptcp_cc.h>
+#include <simptcp_lib.h>
+#include <simptcp_timer.h>
+
+#define LEDBAT_TARGET 100000 /* queueing delay the sender aims at, in us */
+#define LEDBAT_GAIN 1.0 /* at most one PDU of growth per window acknowledged */
+#define LEDBAT_BASE_HISTORY 10 /* base delay : min over as many minutes */
+#define LEDBAT_BASE_INTERVAL 60000000 /* span of a base delay bucket, in us */
+#define LEDBAT_CURRENT_FILTER 4 /* current delay : min of the last samples */
+#define LEDBAT_ALLOWED_INCREASE 1 /* cwnd beyond the PDUs in flight, in PDUs */
+#define LEDBAT_INIT_CWND 2 /* in PDUs */
+#define LEDBAT_MIN_CWND 2 /* in PDUs */
+
+/*!
+ * \struct ledbat_simptcp_cc
+ * \brief state of LEDBAT in the socket (cc_priv)
+ */
+struct ledbat_simptcp_cc
+{
+    double cwnd; /*!< fractional window, sock->cwnd is its integer part */
+    int32_t base_history[LEDBAT_BASE_HISTORY]; /*!< min one-way delay of each
+                                                 bucket, in us */
+    unsigned char base_count; /*!< buckets in use, 0 : no sample yet */
+    uint64_t base_started; /*!< start of the current bucket, in us */
+    int32_t current_filter[LEDBAT_CURRENT_FILTER]; /*!< last one-way delays, in us */
+    unsigned char current_count; /*!< samples in current_filter */
+    unsigned char current_next; /*!< next slot of current_filter */
+};
+SIMPTCP_CC_PRIV_CHECK(ledbat_simptcp_cc);
+
+/*!
+ * \fn static void ledbat_simptcp_cc_update_base(struct ledbat_simptcp_cc *ca, int32_t owd)
+ * \brief ajoute un delai aller a l'historique du delai de base : une case par
+ * minute, la plus ancienne est oubliee au bout de LEDBAT_BASE_HISTORY minutes
+ * (suit un changement de route ou la derive des horloges)
+ * \param ca etat LEDBAT du socket
+ * \param owd delai aller mesure, en us
+ */
+static void ledbat_simptcp_cc_update_base(struct ledbat_simptcp_cc *ca,
+                                          int32_t owd)
+{
+    uint64_t now = simptcp_timer_now_us();
+    int i;
+
+    if ((ca->base_count == 0) ||
+            (now - ca->base_started >= LEDBAT_BASE_INTERVAL))
+    {
+        if (ca->base_count == LEDBAT_BASE_HISTORY)
+        {
+            for (i = 1; i < LEDBAT_BASE_HISTORY; i++)
+                ca->base_history[i - 1] = ca->base_history[i];
+            ca->base_count--;
+        }
+        ca->base_history[ca->base_count++] = owd;
+        ca->base_started = now;
+    }
+    else if (owd < ca->base_history[ca->base_count - 1])
+        ca->base_history[ca->base_count - 1] = owd;
+}
+
+/*!
+ * \fn static int32_t ledbat_simptcp_cc_queuing_delay(struct ledbat_simptcp_cc *ca, int32_t owd)
+ * \brief estime le delai de file d'attente : minimum des derniers delais
+ * aller (filtre le bruit) moins le delai de base. Le decalage des horloges
+ * des deux entites s'annule dans la difference.
+ * \param ca etat LEDBAT du socket
+ * \param owd delai aller mesure, en us
+ * \return delai de file d'attente, en us
+ */
+static int32_t ledbat_simptcp_cc_queuing_delay(struct ledbat_simptcp_cc *ca,
+                                               int32_t owd)
+{
+    int32_t current, base;
+    int i;
+
+    ledbat_simptcp_cc_update_base(ca, owd);
+    ca->current_filter[ca->current_next] = owd;
+    ca->current_next = (ca->current_next + 1) % LEDBAT_CURRENT_FILTER;
+    if (ca->current_count < LEDBAT_CURRENT_FILTER)
+        ca->current_count++;
+
+    current = ca->current_filter[0];
+    for (i = 1; i < ca->current_count; i++)
+        if (ca->current_filter[i] < current)
+            current = ca->current_filter[i];
+    base = ca->base_history[0];
+    for (i = 1; i < ca->base_count; i++)
+        if (ca->base_history[i] < base)
+            base = ca->base_history[i];
+    return current - base;
+}
+
+/*!
+ * \fn static void ledbat_simptcp_cc_set_cwnd(struct simptcp_socket *sock, struct ledbat_simptcp_cc *ca, unsigned int flight)
+ * \brief borne la fenetre (au plus LEDBAT_ALLOWED_INCREASE PDU au dela des
+ * PDU en vol, au moins LEDBAT_MIN_CWND) et la reporte dans le socket
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param ca etat LEDBAT du socket
+ * \param flight PDU en vol avant l'evenement
+ */
+static void ledbat_simptcp_cc_set_cwnd(struct simptcp_socket *sock,
+                                       struct ledbat_simptcp_cc *ca,
+                                       unsigned int flight)
+{
+    double max_cwnd = flight + LEDBAT_ALLOWED_INCREASE;
+
+    if (ca->cwnd > max_cwnd)
+        ca->cwnd = max_cwnd;
+    if (ca->cwnd < LEDBAT_MIN_CWND)
+        ca->cwnd = LEDBAT_MIN_CWND;
+    sock->cwnd = (unsigned int) ca->cwnd;
+}
+
+static void ledbat_simptcp_cc_init(struct simptcp_socket *sock)
+{
+    struct ledbat_simptcp_cc *ca = simptcp_cc_priv(sock);
+
+    ca->cwnd = LEDBAT_INIT_CWND;
+    ca->base_count = 0;
+    ca->current_count = 0;
+    ca->current_next = 0;
+    sock->cwnd = LEDBAT_INIT_CWND;
+    sock->ssthresh = UINT16_MAX;
+}
+
+/*!
+ * \fn static void ledbat_simptcp_cc_on_ack(struct simptcp_socket *sock, const struct simptcp_rate_sample *rs)
+ * \brief controleur lineaire : la fenetre croit ou decroit de
+ * GAIN * (TARGET - delai de file) / TARGET PDU par fenetre acquittee ; sans
+ * mesure du delai aller, elle croit comme en congestion avoidance
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param rs mesures de l'ACK (PDU acquittes et delai aller)
+ */
+static void ledbat_simptcp_cc_on_ack(struct simptcp_socket *sock,
+                                     const struct simptcp_rate_sample *rs)
+{
+    struct ledbat_simptcp_cc *ca = simptcp_cc_priv(sock);
+    double off_target = 1;
+    int32_t queuing_delay;
+
+    if (rs->owd_valid)
+    {
+        queuing_delay = ledbat_simptcp_cc_queuing_delay(ca,
+                        (int32_t) (rs->owd * 1e6));
+        off_target = (double) (LEDBAT_TARGET - queuing_delay) / LEDBAT_TARGET;
+    }
+    /* the sender was not limited by cwnd : do not grow [RFC7661], but
+       always back off above the target */
+    if ((rs->acked == 0) || sock->fast_recovery ||
+            ((off_target > 0) && (simptcp_in_flight(sock) + rs->acked < sock->cwnd)))
+        return;
+    ca->cwnd += LEDBAT_GAIN * off_target * rs->acked / ca->cwnd;
+    ledbat_simptcp_cc_set_cwnd(sock, ca, simptcp_in_flight(sock) + rs->acked);
+}
+
+/* loss : halve the window at most once per round trip, as a TCP would */
+static void ledbat_simptcp_cc_on_loss(struct simptcp_socket *sock)
+{
+    struct ledbat_simptcp_cc *ca = simptcp_cc_priv(sock);
+
+    ca->cwnd /= 2;
+    ledbat_simptcp_cc_set_cwnd(sock, ca, simptcp_in_flight(sock));
+}
+
+static void ledbat_simptcp_cc_on_rto(struct simptcp_socket *sock)
+{
+    struct ledbat_simptcp_cc *ca = simptcp_cc_priv(sock);
+
+    ca->cwnd = 1;
+    sock->cwnd = 1;
+}
+
+const simptcp_cc_ops simptcp_cc_ledbat =
+{
+    "ledbat",
+    &ledbat_simptcp_cc_init,
+    &ledbat_simptcp_cc_on_ack,
+    &ledbat_simptcp_cc_on_loss,
+    &ledbat_simptcp_cc_on_rto
+};
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
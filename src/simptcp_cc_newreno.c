@@ -0,0 +1,121 @@
+/*! \file simptcp_cc_newreno.c
+*  \brief{NewReno congestion control : slow start and congestion avoidance
+*  [RFC5681], fast recovery with partial acknowledgements [RFC6582]. The
+*  window is counted in PDUs.}
+*/
+
+#include <simptcp_cc.h>
+#include <simptcp_lib.h>
+
+/*!
+ * \struct newreno_simptcp_cc
+ * \brief state of NewReno in the socket (cc_priv)
+ */
+struct newreno_simptcp_cc
+{
+    unsigned int acked_cnt; /*!< congestion avoidance : PDUs acknowledged
+                              since cwnd last grew */
+    unsigned char in_recovery; /*!< 1 : window inflated by the fast recovery */
+};
+SIMPTCP_CC_PRIV_CHECK(newreno_simptcp_cc);
+
+/*!
+ * \fn static unsigned int newreno_simptcp_cc_ssthresh(struct simptcp_socket *sock)
+ * \brief seuil de slow start apres une perte : la moitie des PDU en vol
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return ssthresh en PDU
+ */
+static unsigned int newreno_simptcp_cc_ssthresh(struct simptcp_socket *sock)
+{
+    unsigned int half = simptcp_in_flight(sock) / 2;
+
+    return half > SIMPTCP_CC_MIN_SSTHRESH ? half : SIMPTCP_CC_MIN_SSTHRESH;
+}
+
+static void newreno_simptcp_cc_init(struct simptcp_socket *sock)
+{
+    struct newreno_simptcp_cc *ca = simptcp_cc_priv(sock);
+
+    sock->cwnd = SIMPTCP_CC_INITIAL_WINDOW;
+    sock->ssthresh = UINT16_MAX;
+    ca->acked_cnt = 0;
+    ca->in_recovery = 0;
+}
+
+/*!
+ * \fn static void newreno_simptcp_cc_on_ack(struct simptcp_socket *sock, const struct simptcp_rate_sample *rs)
+ * \brief en fast recovery, chaque ACK duplique gonfle la fenetre d'un PDU (un
+ * PDU a quitte le reseau), un acquittement partiel la degonfle des PDU
+ * acquittes et l'acquittement de recover la ramene a ssthresh ; sinon la
+ * fenetre croit d'un PDU par PDU acquitte (slow start) puis d'un PDU par
+ * fenetre acquittee (congestion avoidance)
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param rs mesures de l'ACK (seul le nombre de PDU acquittes sert)
+ */
+static void newreno_simptcp_cc_on_ack(struct simptcp_socket *sock,
+                                      const struct simptcp_rate_sample *rs)
+{
+    struct newreno_simptcp_cc *ca = simptcp_cc_priv(sock);
+    unsigned int acked = rs->acked;
+
+    if (ca->in_recovery)
+    {
+        if (!sock->fast_recovery)
+        {
+            ca->in_recovery = 0;
+            sock->cwnd = simptcp_in_flight(sock) + 1 < sock->ssthresh ?
+                         simptcp_in_flight(sock) + 1 : sock->ssthresh;
+        }
+        else if (acked == 0)
+            sock->cwnd++;
+        else
+            sock->cwnd = (sock->cwnd > acked ? sock->cwnd - acked : 0) + 1;
+        return;
+    }
+    /* the sender was not limited by cwnd : its growth would not be
+       validated by the network [RFC7661] */
+    if ((acked == 0) || (simptcp_in_flight(sock) + acked < sock->cwnd))
+        return;
+    if (sock->cwnd < sock->ssthresh)
+    {
+        sock->cwnd += acked;
+        return;
+    }
+    ca->acked_cnt += acked;
+    if (ca->acked_cnt >= sock->cwnd)
+    {
+        ca->acked_cnt -= sock->cwnd;
+        sock->cwnd++;
+    }
+}
+
+static void newreno_simptcp_cc_on_loss(struct simptcp_socket *sock)
+{
+    struct newreno_simptcp_cc *ca = simptcp_cc_priv(sock);
+
+    sock->ssthresh = newreno_simptcp_cc_ssthresh(sock);
+    sock->cwnd = sock->ssthresh + SIMPTCP_DUPACK_THRESHOLD;
+    ca->acked_cnt = 0;
+    ca->in_recovery = 1;
+}
+
+static void newreno_simptcp_cc_on_rto(struct simptcp_socket *sock)
+{
+    struct newreno_simptcp_cc *ca = simptcp_cc_priv(sock);
+
+    sock->ssthresh = newreno_simptcp_cc_ssthresh(sock);
+    sock->cwnd = 1;
+    ca->acked_cnt = 0;
+    ca->in_recovery = 0;
+}
+
+const simptcp_cc_ops simptcp_cc_newreno =
+{
+    "newreno",
+    &newreno_simptcp_cc_init,
+    &newreno_simptcp_cc_on_ack,
+    &newreno_simptcp_cc_on_loss,
+    &newreno_simptcp_cc_on_rto
+};
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,240 @@
+/*! \file simptcp_demux.c
+*  \brief{Hash tables used to demultiplex received simptcp PDUs.
+*  Lookups are run by the entity handler without taking any lock : buckets are
+*  singly linked lists whose links are published with release stores, so that
+*  a reader never sees a half-inserted socket. Insertions and removals
+*  (state transitions, from the application or the entity) are serialized
+*  by a writer mutex.}
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>              /* for errno macros */
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include <simptcp_demux.h>
+#include <term_colors.h>        /* for color macros */
+#define __PREFIX__              "[" COLOR("SIMPTCP_DEMUX", BRIGHT_VIOLET) "] "
+#include <term_io.h>
+
+#ifndef __DEBUG__
+#define __DEBUG__               1
+#endif
+
+/*!
+ * \struct simptcp_demux_table
+ * \brief table de hachage a chainage : tableau de buckets (listes simplement
+ * chainees via le champ demux_next de #simptcp_socket)
+ */
+struct simptcp_demux_table
+{
+    struct simptcp_socket **buckets; /*!< bucket heads */
+    uint32_t mask; /*!< number of buckets - 1 */
+};
+
+static struct simptcp_demux_table connection_table;
+static struct simptcp_demux_table listener_table;
+static pthread_mutex_t demux_writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * \fn static uint32_t demux_hash(uint16_t lport, uint32_t raddr, uint16_t rport)
+ * \brief melange les champs de la cle (finaliseur de murmur3 simplifie)
+ */
+static uint32_t demux_hash(uint16_t lport, uint32_t raddr, uint16_t rport)
+{
+    uint32_t h = raddr ^ (((uint32_t) lport << 16) | rport);
+
+    h ^= h >> 16;
+    h *= 0x7feb352d;
+    h ^= h >> 15;
+    h *= 0x846ca68b;
+    h ^= h >> 16;
+    return h;
+}
+
+/*!
+ * \fn static int init_table(struct simptcp_demux_table *table, unsigned int buckets)
+ * \brief alloue les buckets d'une table (nombre arrondi a la puissance de 2 superieure)
+ * \return -ENOMEM si echec, 0 sinon
+ */
+static int init_table(struct simptcp_demux_table *table, unsigned int buckets)
+{
+    unsigned int n = 1;
+
+    while (n < buckets)
+        n <<= 1;
+    free(table->buckets);
+    table->buckets = calloc(n, sizeof(struct simptcp_socket *));
+    if (!table->buckets)
+        return -ENOMEM;
+    table->mask = n - 1;
+    return 0;
+}
+
+/*!
+ * \fn int simptcp_demux_init(unsigned int buckets)
+ * \brief alloue les tables de demultiplexage
+ * \param buckets nombre de buckets de la table des connexions
+ * \return -ENOMEM si echec, 0 sinon
+ */
+int simptcp_demux_init(unsigned int buckets)
+{
+    int res;
+
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    res = init_table(&connection_table, buckets ? buckets : SIMPTCP_DEMUX_BUCKETS);
+    if (res < 0)
+        return res;
+    return init_table(&listener_table, SIMPTCP_DEMUX_LISTEN_BUCKETS);
+}
+
+/*!
+ * \fn static void table_insert(struct simptcp_demux_table *table, uint32_t h, struct simptcp_socket *sock)
+ * \brief insere le socket en tete du bucket h. Le lien vers l'ancienne tete est
+ * ecrit avant la publication du socket (store release) : un lecteur concurrent
+ * voit soit l'ancienne liste soit la nouvelle, complete.
+ */
+static void table_insert(struct simptcp_demux_table *table, uint32_t h,
+                         struct simptcp_socket *sock)
+{
+    struct simptcp_socket **head = &(table->buckets[h & table->mask]);
+
+    sock->demux_next = *head;
+    __atomic_store_n(head, sock, __ATOMIC_RELEASE);
+}
+
+/*!
+ * \fn void simptcp_demux_insert_connection(struct simptcp_socket *sock)
+ * \brief enregistre un socket dont les adresses locale et distante sont fixees
+ * (socket client en cours de connexion, socket cree sur reception d'un SYN)
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+void simptcp_demux_insert_connection(struct simptcp_socket *sock)
+{
+    pthread_mutex_lock(&demux_writer_mutex);
+    if (sock->demux_table == demux_none)
+    {
+        table_insert(&connection_table,
+                     demux_hash(sock->local_simptcp.sin_port,
+                                sock->remote_simptcp.sin_addr.s_addr,
+                                sock->remote_simptcp.sin_port), sock);
+        sock->demux_table = demux_connection;
+    }
+    pthread_mutex_unlock(&demux_writer_mutex);
+}
+
+/*!
+ * \fn void simptcp_demux_insert_listener(struct simptcp_socket *sock)
+ * \brief enregistre un socket en ecoute (listening_server) sur son port local
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+void simptcp_demux_insert_listener(struct simptcp_socket *sock)
+{
+    pthread_mutex_lock(&demux_writer_mutex);
+    if (sock->demux_table == demux_none)
+    {
+        table_insert(&listener_table, sock->local_simptcp.sin_port, sock);
+        sock->demux_table = demux_listener;
+    }
+    pthread_mutex_unlock(&demux_writer_mutex);
+}
+
+/*!
+ * \fn void simptcp_demux_remove(struct simptcp_socket *sock)
+ * \brief retire un socket de la table ou il est enregistre (sans effet sinon).
+ * Le champ demux_next du socket retire n'est pas modifie : un lecteur arrete
+ * sur ce socket poursuit son parcours sans rupture. La memoire du socket ne doit
+ * etre reutilisee que par le thread de l'entite (seul lecteur).
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ */
+void simptcp_demux_remove(struct simptcp_socket *sock)
+{
+    struct simptcp_demux_table *table;
+    struct simptcp_socket **link;
+    uint32_t h;
+
+    pthread_mutex_lock(&demux_writer_mutex);
+    if (sock->demux_table == demux_connection)
+    {
+        table = &connection_table;
+        h = demux_hash(sock->local_simptcp.sin_port,
+                       sock->remote_simptcp.sin_addr.s_addr,
+                       sock->remote_simptcp.sin_port);
+    }
+    else if (sock->demux_table == demux_listener)
+    {
+        table = &listener_table;
+        h = sock->local_simptcp.sin_port;
+    }
+    else
+    {
+        pthread_mutex_unlock(&demux_writer_mutex);
+        return;
+    }
+
+    for (link = &(table->buckets[h & table->mask]); *link != NULL;
+            link = &((*link)->demux_next))
+    {
+        if (*link == sock)
+        {
+            __atomic_store_n(link, sock->demux_next, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    sock->demux_table = demux_none;
+    pthread_mutex_unlock(&demux_writer_mutex);
+}
+
+/*!
+ * \fn struct simptcp_socket *simptcp_demux_lookup_connection(uint16_t lport, uint32_t raddr, uint16_t rport)
+ * \brief recherche le socket connecte associe a un 4-uplet (sans verrou)
+ * \param lport port simpTCP local (ordre reseau)
+ * \param raddr adresse IP distante (ordre reseau)
+ * \param rport port simpTCP distant (ordre reseau)
+ * \return le socket trouve, NULL sinon
+ */
+struct simptcp_socket *simptcp_demux_lookup_connection(uint16_t lport,
+        uint32_t raddr, uint16_t rport)
+{
+    struct simptcp_socket *sock;
+
+    sock = __atomic_load_n(&(connection_table.buckets[demux_hash(lport, raddr, rport)
+                                                      & connection_table.mask]),
+                           __ATOMIC_ACQUIRE);
+    while (sock != NULL)
+    {
+        if (sock->local_simptcp.sin_port == lport
+                && sock->remote_simptcp.sin_addr.s_addr == raddr
+                && sock->remote_simptcp.sin_port == rport)
+            return sock;
+        sock = __atomic_load_n(&(sock->demux_next), __ATOMIC_ACQUIRE);
+    }
+    return NULL;
+}
+
+/*!
+ * \fn struct simptcp_socket *simptcp_demux_lookup_listener(uint16_t lport)
+ * \brief recherche le socket en ecoute sur un port local (sans verrou)
+ * \param lport port simpTCP local (ordre reseau)
+ * \return le socket trouve, NULL sinon
+ */
+struct simptcp_socket *simptcp_demux_lookup_listener(uint16_t lport)
+{
+    struct simptcp_socket *sock;
+
+    sock = __atomic_load_n(&(listener_table.buckets[lport & listener_table.mask]),
+                           __ATOMIC_ACQUIRE);
+    while (sock != NULL)
+    {
+        if (sock->local_simptcp.sin_port == lport)
+            return sock;
+        sock = __atomic_load_n(&(sock->demux_next), __ATOMIC_ACQUIRE);
+    }
+    return NULL;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -2,18 +2,26 @@
  * \brief
  *
  */
+#define _GNU_SOURCE             /* for recvmmsg(), struct mmsghdr */
 #include <stdlib.h>
 #include <stdio.h>          /* for printf() */
 #include <stdint.h>         /* for UINT16_MAX */
 #include <string.h>         /* for memset() */
 #include <unistd.h>         /* for sleep() */
+#include <errno.h>              /* for errno macros */
 #include <fcntl.h>              /* for fcntl(), O_NONBLOCK */
 #include <arpa/inet.h>
 #include <sys/time.h>           /* for gettimeofday,..*/
+#include <sys/epoll.h>          /* for epoll_create1(), epoll_wait() */
+#include <sys/timerfd.h>        /* for timerfd_create(), timerfd_settime() */
+#include <sys/eventfd.h>        /* for eventfd() */
 
 
 #include <simptcp_entity.h>
+#include <simptcp_demux.h>
 #include <simptcp_packet.h>
+#include <simptcp_pmtu.h>
+#include <simptcp_pacing.h>
 #include <libc_socket.h>
 
 #include <term_colors.h>
@@ -62,6 +70,8 @@ int set_non_blocking(int fd)
  * suppose recevoir les PDU SimpTCP-SYN de demande d'etablissement d'une nouvelle connexion
  * Cas 2) PDU destine a un "non listening socket" (socket cote client ou cote serveur cree suite
  * a l'acceptation d'une demande de connexion
+ * Les deux cas sont resolus en O(1) par les tables de hachage de simptcp_demux.c
+ * (cle (port local, adresse distante, port distant) puis port local)
  * \param buffer qui pointe sur le PDU SimpTCP (charge utile du paquet UDP recu)
  * \param udp_remote qui pointe sur l'adresse du socket UDP emetteur du PDU SimpTCP
  * \return le descripteur du socket SimpTCP ou -1 s'il n'est destine a socket SimpTCP
@@ -69,10 +79,8 @@ int set_non_blocking(int fd)
 int demultiplex_packet(char * buffer,struct sockaddr_in * udp_remote)
 {
     struct simptcp_socket *sock = NULL;
-    struct simptcp_socket *new_sock = NULL;
     struct sockaddr_in simptcp_remote;
     u_int16_t dport;
-    int fd; /* simtcp socket descriptor */
     int slen=sizeof(struct sockaddr_in);
 
 #if __DEBUG__
@@ -86,57 +94,38 @@ int demultiplex_packet(char * buffer,struct sockaddr_in * udp_remote)
     simptcp_remote.sin_port = htons(simptcp_get_sport(buffer));
     dport = htons(simptcp_get_dport(buffer));
 
-    simptcp_print_packet(buffer);
     /* check if the packet is destined for a non-listening socket */
-    /* this is an inefficient way to fetch for open sockets
-       could be imporved using the open_sockets_list
-       which points to the head of the list of open sockets
-    */
-    for (fd=0; fd< MAX_OPEN_SOCK; fd++)
+    sock = simptcp_demux_lookup_connection(dport, simptcp_remote.sin_addr.s_addr,
+                                           simptcp_remote.sin_port);
+    if (sock != NULL)
     {
-        if ((sock=simptcp_entity.simptcp_socket_descriptors[fd]) != NULL)
-        {
-            // print_simptcp_socket(sock);
-            /* this is an open socket ..*/
-            if (sock->local_simptcp.sin_port == dport
-                    && sock->remote_simptcp.sin_addr.s_addr == simptcp_remote.sin_addr.s_addr
-                    && sock->remote_simptcp.sin_port == simptcp_remote.sin_port)
-            {
-                /* this is the fetched socket */
+        /* this is the fetched socket */
 #if __DEBUG__
-                printf("Delivering packet to socket fd %u at state %s\n",
-                       fd, simptcp_socket_state_get_str(sock->socket_state));
+        printf("Delivering packet to socket fd %u at state %s\n",
+               sock->fd, simptcp_socket_state_get_str(sock->socket_state));
 #endif
-                return fd;
-            }
-        }
+        return sock->fd;
     }
     /* now, check if the packet is destined for a listening sock */
-    for (fd=0; fd< MAX_OPEN_SOCK; fd++)
+    sock = simptcp_demux_lookup_listener(dport);
+    if (sock != NULL)
     {
-        if ((sock=simptcp_entity.simptcp_socket_descriptors[fd]) != NULL)
-        {
-            if ((sock->local_simptcp.sin_port == dport)
-                    && (sock->socket_type == listening_server))
-            {
-                /* this is the fetched listening socket */
+        /* this is the fetched listening socket */
 #if __DEBUG__
-                printf("Delivering packet to socket fd %u at state %s\n",
-                       fd, simptcp_socket_state_get_str(sock->socket_state));
+        printf("Delivering packet to socket fd %u at state %s\n",
+               sock->fd, simptcp_socket_state_get_str(sock->socket_state));
 #endif
-                /* for a listening socket an additionnal work is needed :
-                save the remote udp/simpTCP addresses; they will be used
-                 when processing the received pdu
-                     */
-                lock_simptcp_socket(sock);
-
-                memcpy(&(sock->remote_simptcp),&simptcp_remote,slen);
-                memcpy(&(sock->remote_udp),udp_remote,slen);
-                unlock_simptcp_socket(sock);
-
-                return fd;
-            }
-        }
+        /* for a listening socket an additionnal work is needed :
+        save the remote udp/simpTCP addresses; they will be used
+         when processing the received pdu
+             */
+        lock_simptcp_socket(sock);
+
+        memcpy(&(sock->remote_simptcp),&simptcp_remote,slen);
+        memcpy(&(sock->remote_udp),udp_remote,slen);
+        unlock_simptcp_socket(sock);
+
+        return sock->fd;
     }
     /* No match found */
 #if __DEBUG__
@@ -146,6 +135,346 @@ int demultiplex_packet(char * buffer,struct sockaddr_in * udp_remote)
 }
 
 
+/*!
+ * \fn void simptcp_entity_wakeup()
+ * \brief reveille le handler #simptcp_entity_handler bloque dans epoll_wait.
+ * Appelee par l'application lorsqu'elle modifie une echeance (lancement d'un timer)
+ * afin que l'entite re-arme son timerfd. Sans effet depuis le handler lui-meme.
+ */
+void simptcp_entity_wakeup()
+{
+    uint64_t one = 1;
+
+    if (pthread_equal(pthread_self(), simptcp_entity.simptcp_handler))
+        return;
+    if (libc_write(simptcp_entity.wakeup_fd, &one, sizeof(one)) < 0)
+        perror("wakeup of simptcp entity failed");
+}
+
+/*!
+ * \fn void arm_entity_timer(uint64_t now)
+ * \brief arme le timerfd de l'entite sur le prochain tick ou la roue de timers a
+ * du travail (desarme s'il n'y a aucun timer)
+ * \param now date (CLOCK_MONOTONIC, en ms) lue a cette iteration du handler
+ */
+void arm_entity_timer(uint64_t now)
+{
+    struct itimerspec its;
+    int64_t delay = simptcp_timer_next_expiry(now);
+
+    memset(&its, 0, sizeof(its));
+    if (delay == 0)
+        /* a zero it_value would disarm the timerfd */
+        its.it_value.tv_nsec = 1;
+    else if (delay > 0)
+    {
+        its.it_value.tv_sec = delay / 1000;
+        its.it_value.tv_nsec = (delay % 1000) * 1000000;
+    }
+    if (timerfd_settime(simptcp_entity.timer_fd, 0, &its, NULL) < 0)
+        perror("timerfd_settime failed");
+}
+
+/*!
+ * \fn void handle_simptcp_timer(struct simptcp_timer * timer)
+ * \brief traite l'expiration de l'un des timers d'un socket simpTCP
+ * \param timer timer echu (desarme)
+ */
+void handle_simptcp_timer(struct simptcp_timer * timer)
+{
+    struct simptcp_socket *sock = timer->sock;
+
+    lock_simptcp_socket(sock);
+    switch (timer->kind)
+    {
+    case SIMPTCP_TIMER_RTO:
+    case SIMPTCP_TIMER_TIME_WAIT:
+        /* the timer is one-shot, the handler restarts it if needed */
+        sock->socket_state->handle_timeout(sock);
+        break;
+    case SIMPTCP_TIMER_DELACK:
+        handle_simptcp_delack_timeout(sock);
+        break;
+    case SIMPTCP_TIMER_PMTU:
+        simptcp_pmtu_handle_timeout(sock);
+        break;
+    case SIMPTCP_TIMER_PACING:
+        simptcp_pacing_handle_timeout(sock);
+        break;
+    case SIMPTCP_TIMER_PERSIST:
+        handle_simptcp_persist_timeout(sock);
+        break;
+    default:
+        /* keepalive is not armed by any state yet */
+        break;
+    }
+    signal_simptcp_socket(sock);
+    unlock_simptcp_socket(sock);
+}
+
+/*!
+ * \fn void process_simptcp_pdu(struct simptcp_rx_slot * slot, int len)
+ * \brief verifie le checksum d'un PDU recu, le demultiplexe et le fait traiter
+ * par le socket simpTCP destinataire selon l'etat dans lequel il se trouve
+ * \param slot element de l'anneau de reception contenant le PDU
+ * \param len taille en octets du PDU recu
+ */
+void process_simptcp_pdu(struct simptcp_rx_slot * slot, int len)
+{
+    char * buffer = slot->buffer;
+    struct simptcp_socket *sock;
+    int fd; /* simptcp socket file descriptor */
+
+#if __DEBUG__
+    printf("************************************************************\n"
+           "Received packet of size %d on %s:%hu\n",
+           len, inet_ntoa(slot->udp_remote.sin_addr),
+           simptcp_get_dport(buffer));
+#endif
+    /* lossy link emulation */
+    if ((simptcp_entity.rx_loss_rate > 0) &&
+            (rand() < simptcp_entity.rx_loss_rate * RAND_MAX))
+    {
+        simptcp_entity.stats.rx_emulated_loss_count++;
+        return;
+    }
+    /* the lengths of the header must match the datagram : the PDU is then
+       read within its receive slot */
+    if ((len < (int) SIMPTCP_GHEADER_SIZE) ||
+            (simptcp_get_head_len(buffer) < SIMPTCP_GHEADER_SIZE) ||
+            (simptcp_get_head_len(buffer) > simptcp_get_total_len(buffer)) ||
+            (simptcp_get_total_len(buffer) != len))
+    {
+#if __DEBUG__
+        printf("Dropping malformed packet (bad lengths) \n");
+#endif
+        simptcp_entity.stats.rx_bad_header_count++;
+        return;
+    }
+    /* check if corrupted */
+    if (!simptcp_check_checksum(buffer,len))
+    {
+#if __DEBUG__
+
+        printf("Dropping corrupted packet (bad checksum) \n");
+        simptcp_print_packet(buffer);
+#endif
+        simptcp_entity.stats.rx_bad_checksum_count++;
+        return;
+    }
+#if __DEBUG__
+    simptcp_print_packet(buffer);
+#endif
+    /* Demultiplex packet */
+
+    if ((fd=demultiplex_packet(buffer,&(slot->udp_remote))) >=0)
+        /* the packets is destined to an open simptcp socket */
+    {
+        /* the application waits on the socket condition for the changes
+           made by the PDU processing */
+        sock = get_simptcp_socket(fd);
+        lock_simptcp_socket(sock);
+        /* header prediction first : the expected PDU of an established
+           connection skips the state machine */
+        if (simptcp_fast_path(sock, buffer, len))
+            simptcp_entity.stats.rx_fast_path_count++;
+        else
+        {
+            simptcp_entity.stats.rx_slow_path_count++;
+            /* path MTU probes are out of the sequence space, whatever the state */
+            if (simptcp_get_flags(buffer) & PROBE)
+                simptcp_pmtu_process_probe(sock, buffer, len);
+            else
+                sock->socket_state->process_simptcp_pdu(sock,buffer,len);
+        }
+        signal_simptcp_socket(sock);
+        unlock_simptcp_socket(sock);
+    }
+    else
+        simptcp_entity.stats.rx_no_socket_count++;
+}
+
+/*!
+ * \fn void process_incoming_pdus()
+ * \brief lit par lots (recvmmsg) les PDU simpTCP en attente sur le socket UDP dans
+ * l'anneau de reception puis traite le lot entier. S'arrete des qu'un lot n'est
+ * pas plein (socket UDP vide, epoll signalera les prochaines arrivees) ou apres
+ * #SIMPTCP_RX_BATCHES_PER_WAKEUP lots : les timers, le pacing et l'emission ne
+ * doivent pas attendre que le socket UDP se vide. epoll etant declenche sur
+ * niveau, le reste sera lu a l'iteration suivante du handler.
+ */
+void process_incoming_pdus()
+{
+    unsigned int i;
+    unsigned int batches = 0;
+    int n;
+
+    do
+    {
+        for (i = 0; i < simptcp_entity.rx_batch_size; i++)
+            simptcp_entity.in_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+
+        n = libc_recvmmsg(simptcp_entity.udp_fd, simptcp_entity.in_msgs,
+                          simptcp_entity.rx_batch_size, MSG_DONTWAIT, NULL);
+        if (n < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+                perror("recvmmsg on simptcp UDP socket failed");
+            return;
+        }
+        simptcp_entity.stats.rx_batch_count++;
+        simptcp_entity.stats.rx_pdu_count += n;
+        if ((unsigned int) n > simptcp_entity.stats.rx_max_batch)
+            simptcp_entity.stats.rx_max_batch = n;
+
+        for (i = 0; i < (unsigned int) n; i++)
+            process_simptcp_pdu(&(simptcp_entity.in_ring[i]),
+                                simptcp_entity.in_msgs[i].msg_len);
+    }
+    while (((unsigned int) n == simptcp_entity.rx_batch_size) &&
+            (++batches < SIMPTCP_RX_BATCHES_PER_WAKEUP));
+}
+
+/*!
+ * \fn int init_rx_ring()
+ * \brief alloue l'anneau de reception de l'entite (rx_batch_size elements de
+ * max_pdu_size octets) et prepare les descripteurs recvmmsg pointant sur chacun
+ * de ses elements
+ * \return -1 si echec (avec errno positionne), 0 sinon.
+ */
+int init_rx_ring()
+{
+    unsigned int i;
+    unsigned int n = simptcp_entity.rx_batch_size;
+    char * buffers;
+
+    simptcp_entity.in_ring = calloc(n, sizeof(struct simptcp_rx_slot));
+    simptcp_entity.in_msgs = calloc(n, sizeof(struct mmsghdr));
+    simptcp_entity.in_iovs = calloc(n, sizeof(struct iovec));
+    /* one spare byte per PDU for the odd length checksum padding */
+    buffers = malloc(n * (simptcp_entity.max_pdu_size + 1));
+    if (!simptcp_entity.in_ring || !simptcp_entity.in_msgs ||
+            !simptcp_entity.in_iovs || !buffers)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        simptcp_entity.in_ring[i].buffer = buffers + i * (simptcp_entity.max_pdu_size + 1);
+        simptcp_entity.in_iovs[i].iov_base = simptcp_entity.in_ring[i].buffer;
+        simptcp_entity.in_iovs[i].iov_len = simptcp_entity.max_pdu_size;
+        simptcp_entity.in_msgs[i].msg_hdr.msg_name = &(simptcp_entity.in_ring[i].udp_remote);
+        simptcp_entity.in_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        simptcp_entity.in_msgs[i].msg_hdr.msg_iov = &(simptcp_entity.in_iovs[i]);
+        simptcp_entity.in_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return 0;
+}
+
+/*!
+ * \fn void flush_tx_queue()
+ * \brief emet par sendmmsg les PDU de la file d'emission. Les PDU que le socket
+ * UDP ne peut accepter (EAGAIN) restent dans la file jusqu'a la prochaine
+ * iteration du handler. L'appelant doit detenir out_mutex.
+ */
+void flush_tx_queue()
+{
+    unsigned int sent = 0;
+    unsigned int i;
+    int n;
+
+    while (sent < simptcp_entity.out_len)
+    {
+        n = libc_sendmmsg(simptcp_entity.udp_fd, &(simptcp_entity.out_msgs[sent]),
+                          simptcp_entity.out_len - sent, MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                break;
+            /* the first PDU of the batch could not be sent : drop it (path
+               MTU probes larger than the interface MTU are expected to) */
+            if (errno != EMSGSIZE)
+                perror("sendmmsg on simptcp UDP socket failed");
+            simptcp_entity.stats.tx_error_count++;
+            sent++;
+            continue;
+        }
+        simptcp_entity.stats.tx_batch_count++;
+        simptcp_entity.stats.tx_pdu_count += n;
+        if ((unsigned int) n > simptcp_entity.stats.tx_max_batch)
+            simptcp_entity.stats.tx_max_batch = n;
+        sent += n;
+    }
+
+    /* move the PDUs left over to the head of the queue */
+    for (i = sent; i < simptcp_entity.out_len; i++)
+    {
+        memcpy(simptcp_entity.out_ring[i - sent].buffer, simptcp_entity.out_ring[i].buffer,
+               simptcp_entity.out_iovs[i].iov_len);
+        memcpy(&(simptcp_entity.out_ring[i - sent].udp_remote),
+               &(simptcp_entity.out_ring[i].udp_remote), sizeof(struct sockaddr_in));
+        simptcp_entity.out_iovs[i - sent].iov_len = simptcp_entity.out_iovs[i].iov_len;
+    }
+    simptcp_entity.out_len -= sent;
+}
+
+/*!
+ * \fn void simptcp_entity_flush()
+ * \brief emet tous les PDU en attente dans la file d'emission de l'entite
+ */
+void simptcp_entity_flush()
+{
+    pthread_mutex_lock(&(simptcp_entity.out_mutex));
+    flush_tx_queue();
+    pthread_mutex_unlock(&(simptcp_entity.out_mutex));
+}
+
+/*!
+ * \fn int simptcp_entity_enqueue_pdu(const char * pdu, int len, struct sockaddr_in * udp_remote)
+ * \brief place un PDU simpTCP dans la file d'emission de l'entite. La file est videe
+ * (sendmmsg) une fois par iteration du handler ou des qu'elle atteint
+ * #SIMPTCP_TX_HIGH_WATER PDU. Appelee depuis l'application, reveille le handler.
+ * \param pdu PDU a emettre (copie dans la file)
+ * \param len taille en octets du PDU
+ * \param udp_remote adresse du socket UDP destinataire
+ * \return len si succes, -1 si echec (avec errno positionne)
+ */
+int simptcp_entity_enqueue_pdu(const char * pdu, int len, struct sockaddr_in * udp_remote)
+{
+    struct simptcp_tx_slot * slot;
+
+    if ((len <= 0) || ((unsigned int) len > simptcp_entity.max_pdu_size))
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    pthread_mutex_lock(&(simptcp_entity.out_mutex));
+    if (simptcp_entity.out_len == SIMPTCP_TX_QUEUE_SIZE)
+        flush_tx_queue();
+    if (simptcp_entity.out_len == SIMPTCP_TX_QUEUE_SIZE)
+    {
+        pthread_mutex_unlock(&(simptcp_entity.out_mutex));
+        errno = ENOBUFS;
+        return -1;
+    }
+    slot = &(simptcp_entity.out_ring[simptcp_entity.out_len]);
+    memcpy(slot->buffer, pdu, len);
+    memcpy(&(slot->udp_remote), udp_remote, sizeof(struct sockaddr_in));
+    simptcp_entity.out_iovs[simptcp_entity.out_len].iov_len = len;
+    simptcp_entity.out_len++;
+    if (simptcp_entity.out_len >= SIMPTCP_TX_HIGH_WATER)
+        flush_tx_queue();
+    pthread_mutex_unlock(&(simptcp_entity.out_mutex));
+
+    /* the handler drains the queue at the end of its iteration */
+    simptcp_entity_wakeup();
+    return len;
+}
+
 /*!
  * \fn void * simptcp_entity_handler()
  * \brief handler lance au demarrage de SimpTCP (au lancement de l'application utilisant
@@ -155,17 +484,18 @@ int demultiplex_packet(char * buffer,struct sockaddr_in * udp_remote)
  * 1) a l'arrivee arrivee d'Un PDU SimpTCP -> determine le socket Simptcp
  * Concerne puis traite le paquet 2) detection de timeout sur les timers utilises
  * par les socket SimpTCP et lancer les traitements appropries
+ * Le handler reste bloque dans epoll_wait tant qu'aucun PDU n'est arrive, que le
+ * timerfd (arme sur la prochaine echeance) n'a pas expire et que l'application
+ * ne l'a pas reveille (#simptcp_entity_wakeup).
  */
 
 void * simptcp_entity_handler()
 {
-    /* simptcp receive buffer */
-    char* buffer =  simptcp_entity.in_buffer;
-    /* udp remotre SAP from which the packet originates */
-    struct sockaddr_in udp_remote;
-    unsigned int slen = sizeof(struct sockaddr_in);
-    int fd; /* simptcp socket file descriptor */
-    struct timeval t0;
+    struct epoll_event events[3];
+    uint64_t expirations;
+    uint64_t now;
+    struct simptcp_timer *timer;
+    int nfds, i;
 
 #if __DEBUG__
     printf("function %s called\n", __func__);
@@ -173,64 +503,184 @@ void * simptcp_entity_handler()
 
     while (1)
     {
-
-        usleep(10);
-        /* check for a new arriving packet */
-        simptcp_entity.in_len = libc_recvfrom(simptcp_entity.udp_fd,buffer,
-                                              MAX_SIMPTCP_BUFFER_SIZE,0,
-                                              (struct sockaddr*) &udp_remote, &slen);
-
-        if (simptcp_entity.in_len != -1)
+        nfds = epoll_wait(simptcp_entity.epoll_fd, events, 3, -1);
+        if (nfds < 0)
         {
-#if __DEBUG__
-            printf("************************************************************\n"
-                   "Received packet of size %d on %s:%hu\n",
-                   simptcp_entity.in_len, inet_ntoa(udp_remote.sin_addr),
-                   simptcp_get_dport(buffer));
-#endif
-            /* check if corrupted */
-            if (!simptcp_check_checksum(buffer,simptcp_entity.in_len))
-            {
-#if __DEBUG__
-
-                printf("Dropping corrupted packet (bad checksum) \n");
-                simptcp_print_packet(buffer);
-#endif
-                /* TODO : on pourrait prévoir un memset */
-                continue ;
-            }
-            else   /* clean simptcp packet */
-            {
-#if __DEBUG__
-                simptcp_print_packet(buffer);
-#endif
-                /* Demultiplex packet */
-
-                if ((fd=demultiplex_packet(buffer,&udp_remote)) >=0)
-                    /* the packets is destined to an open simptcp socket */
-                    simptcp_entity.simptcp_socket_descriptors[fd]->socket_state->process_simptcp_pdu(simptcp_entity.simptcp_socket_descriptors[fd],buffer,simptcp_entity.in_len);
-            }
+            if (errno != EINTR)
+                perror("epoll_wait failed");
+            continue;
         }
-        //   else if ((simptcp_entity.in_len ==-1) && (errno != EAGAIN))
-        //return -1;
-
-        /* check for timeouts */
 
-        for (fd=0; fd< MAX_OPEN_SOCK; fd++)
+        for (i = 0; i < nfds; i++)
         {
-            gettimeofday(&t0,NULL);
-            if (((simptcp_entity.simptcp_socket_descriptors[fd]) != NULL) &&
-                    (has_active_timer(simptcp_entity.simptcp_socket_descriptors[fd])) &&
-                    (is_timeout(simptcp_entity.simptcp_socket_descriptors[fd])))
-            {
-                /* timeout detected on the open socket */
-                simptcp_entity.simptcp_socket_descriptors[fd]->socket_state->handle_timeout(simptcp_entity.simptcp_socket_descriptors[fd]);
-            }
+            if (events[i].data.fd == simptcp_entity.udp_fd)
+                /* check for new arriving packets */
+                process_incoming_pdus();
+            else if (libc_read(events[i].data.fd, &expirations, sizeof(expirations)) < 0)
+                /* timer_fd expiration or wakeup_fd notification : acknowledge */
+                perror("read on simptcp entity event fd failed");
         }
 
+        /* handle the due timers : a single clock read per iteration */
+        now = simptcp_timer_now();
+        while ((timer = simptcp_timer_next_expired(now)) != NULL)
+            handle_simptcp_timer(timer);
+
+        /* release the PDUs held by pacing, then transmit the PDUs queued
+           during this iteration */
+        simptcp_pacing_run();
+        simptcp_entity_flush();
+
+        /* the sockets closed by the application are no longer held by the
+           handler : recycle them */
+        recycle_simptcp_sockets();
+
+        arm_entity_timer(now);
     } /* while(1) */
 }
 
+/*!
+ * \fn int add_entity_event(int fd)
+ * \brief ajoute un descripteur a l'ensemble surveille par l'epoll de l'entite
+ * \param fd descripteur a surveiller en lecture
+ * \return -1 si echec (avec errno positionne), 0 sinon.
+ */
+int add_entity_event(int fd)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(simptcp_entity.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+
+/*!
+ * \fn int init_tx_ring()
+ * \brief alloue la file d'emission de l'entite (elements de max_pdu_size
+ * octets) et prepare les descripteurs sendmmsg pointant sur chacun de ses elements
+ * \return -1 si echec (avec errno positionne), 0 sinon.
+ */
+int init_tx_ring()
+{
+    unsigned int i;
+    char * buffers;
+
+    simptcp_entity.out_ring = calloc(SIMPTCP_TX_QUEUE_SIZE, sizeof(struct simptcp_tx_slot));
+    simptcp_entity.out_msgs = calloc(SIMPTCP_TX_QUEUE_SIZE, sizeof(struct mmsghdr));
+    simptcp_entity.out_iovs = calloc(SIMPTCP_TX_QUEUE_SIZE, sizeof(struct iovec));
+    buffers = malloc(SIMPTCP_TX_QUEUE_SIZE * simptcp_entity.max_pdu_size);
+    if (!simptcp_entity.out_ring || !simptcp_entity.out_msgs ||
+            !simptcp_entity.out_iovs || !buffers)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < SIMPTCP_TX_QUEUE_SIZE; i++)
+    {
+        simptcp_entity.out_ring[i].buffer = buffers + i * simptcp_entity.max_pdu_size;
+        simptcp_entity.out_iovs[i].iov_base = simptcp_entity.out_ring[i].buffer;
+        simptcp_entity.out_msgs[i].msg_hdr.msg_name = &(simptcp_entity.out_ring[i].udp_remote);
+        simptcp_entity.out_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        simptcp_entity.out_msgs[i].msg_hdr.msg_iov = &(simptcp_entity.out_iovs[i]);
+        simptcp_entity.out_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    simptcp_entity.out_len = 0;
+    return pthread_mutex_init(&(simptcp_entity.out_mutex), NULL);
+}
+
+/*!
+ * \fn int simptcp_set_rx_batch_size(unsigned int n)
+ * \brief fixe le nombre maximal de PDU lus par un appel a recvmmsg (taille de
+ * l'anneau de reception). Doit etre appelee avant #start_simptcp
+ * \param n taille du lot, entre 1 et #SIMPTCP_MAX_RX_BATCH
+ * \return -EINVAL si n est hors bornes, -EBUSY si l'entite est deja lancee, 0 sinon.
+ */
+int simptcp_set_rx_batch_size(unsigned int n)
+{
+    if ((n == 0) || (n > SIMPTCP_MAX_RX_BATCH))
+        return -EINVAL;
+    if (simptcp_entity.in_ring != NULL)
+        return -EBUSY;
+    simptcp_entity.rx_batch_size = n;
+    return 0;
+}
+
+/*!
+ * \fn int simptcp_set_mtu(unsigned int mtu)
+ * \brief fixe la MTU du chemin vers les pairs (taille des paquets IP), dont
+ * derivent la taille des anneaux d'emission et de reception et le MSS annonce
+ * par les sockets. Doit etre appelee avant #start_simptcp
+ * \param mtu MTU en octets, entre #SIMPTCP_MIN_MTU et #SIMPTCP_MAX_MTU (loopback)
+ * \return -EINVAL si mtu est hors bornes, -EBUSY si l'entite est deja lancee, 0 sinon.
+ */
+int simptcp_set_mtu(unsigned int mtu)
+{
+    if ((mtu < SIMPTCP_MIN_MTU) || (mtu > SIMPTCP_MAX_MTU))
+        return -EINVAL;
+    if (simptcp_entity.in_ring != NULL)
+        return -EBUSY;
+    simptcp_entity.mtu = mtu;
+    return 0;
+}
+
+/*!
+ * \fn int simptcp_set_pmtu_discovery(int on)
+ * \brief active la decouverte de la PMTU [RFC8899] : le socket UDP de l'entite
+ * positionne le bit DF (IP_PMTUDISC_PROBE, sans tenir compte des messages ICMP)
+ * et les emetteurs sondent le chemin. Doit etre appelee avant #start_simptcp
+ * \param on 1 pour activer, 0 sinon (par defaut)
+ * \return -EBUSY si l'entite est deja lancee, 0 sinon.
+ */
+int simptcp_set_pmtu_discovery(int on)
+{
+    if (simptcp_entity.in_ring != NULL)
+        return -EBUSY;
+    simptcp_entity.pmtu_discovery = (on != 0);
+    return 0;
+}
+
+/*!
+ * \fn int simptcp_set_rx_loss_rate(double rate)
+ * \brief emule un lien avec pertes : chaque PDU recu est ignore avec la
+ * probabilite rate (tests et mesures de performance)
+ * \param rate probabilite de perte, entre 0 (aucune perte, par defaut) et 1 exclu
+ * \return -EINVAL si rate est hors bornes, 0 sinon.
+ */
+int simptcp_set_rx_loss_rate(double rate)
+{
+    if ((rate < 0) || (rate >= 1))
+        return -EINVAL;
+    simptcp_entity.rx_loss_rate = rate;
+    return 0;
+}
+
+/*!
+ * \fn void print_simptcp_entity_stats()
+ * \brief affiche sur la sortie standard les compteurs de l'entite simpTCP
+ */
+void print_simptcp_entity_stats()
+{
+    printf("----------------------------------------\n");
+    printf("MTU       : %u%s\n", simptcp_entity.mtu,
+           simptcp_entity.pmtu_discovery ? " (path MTU discovery)" : "");
+    printf("receive batch size       : %u\n", simptcp_entity.rx_batch_size);
+    printf("receive batches       : %lu\n", simptcp_entity.stats.rx_batch_count);
+    printf("received PDUs       : %lu\n", simptcp_entity.stats.rx_pdu_count);
+    printf("largest batch       : %u\n", simptcp_entity.stats.rx_max_batch);
+    printf("corrupted PDUs       : %lu\n", simptcp_entity.stats.rx_bad_checksum_count);
+    printf("malformed PDUs       : %lu\n", simptcp_entity.stats.rx_bad_header_count);
+    printf("unmatched PDUs       : %lu\n", simptcp_entity.stats.rx_no_socket_count);
+    printf("emulated losses       : %lu\n", simptcp_entity.stats.rx_emulated_loss_count);
+    printf("predicted PDUs (fast path)       : %lu\n", simptcp_entity.stats.rx_fast_path_count);
+    printf("state machine PDUs (slow path)       : %lu\n", simptcp_entity.stats.rx_slow_path_count);
+    printf("transmit batches       : %lu\n", simptcp_entity.stats.tx_batch_count);
+    printf("transmitted PDUs       : %lu\n", simptcp_entity.stats.tx_pdu_count);
+    printf("largest transmit batch       : %u\n", simptcp_entity.stats.tx_max_batch);
+    printf("transmit errors       : %lu\n", simptcp_entity.stats.tx_error_count);
+    printf("----------------------------------------\n");
+}
 
 /*!
  * \fn int start_simptcp(int local_udp)
@@ -243,6 +693,8 @@ void * simptcp_entity_handler()
 int start_simptcp(int local_udp)
 {
     int res = -1;
+    int buffer_size;
+    int pmtudisc = IP_PMTUDISC_PROBE;
 
 #if __DEBUG__
     printf("function %s called\n", __func__);
@@ -269,11 +721,80 @@ int start_simptcp(int local_udp)
         perror("bind UDP socket for simptcp failed");
         return res;
     }
+
+    if (simptcp_entity.mtu == 0)
+        simptcp_entity.mtu = SIMPTCP_DEFAULT_MTU;
+    simptcp_entity.max_pdu_size = SIMPTCP_MTU_PDU_SIZE(simptcp_entity.mtu);
+    if (simptcp_entity.pmtu_discovery)
+    {
+        if (libc_setsockopt(simptcp_entity.udp_fd, IPPROTO_IP, IP_MTU_DISCOVER,
+                            &pmtudisc, sizeof(pmtudisc)) < 0)
+        {
+            perror("IP_MTU_DISCOVER on simptcp UDP socket failed");
+            return -1;
+        }
+    }
+    /* the default UDP buffers only hold a few large datagrams : let them hold
+       a full transmit queue, which a sender keeping its window full sends
+       back to back; the kernel charges each datagram about twice its size
+       (best effort, bounded by the system maximum) */
+    if (simptcp_entity.mtu > SIMPTCP_DEFAULT_MTU)
+    {
+        buffer_size = 2 * SIMPTCP_TX_QUEUE_SIZE * simptcp_entity.max_pdu_size;
+        libc_setsockopt(simptcp_entity.udp_fd, SOL_SOCKET, SO_RCVBUF,
+                        &buffer_size, sizeof(buffer_size));
+        libc_setsockopt(simptcp_entity.udp_fd, SOL_SOCKET, SO_SNDBUF,
+                        &buffer_size, sizeof(buffer_size));
+    }
+
+    /* event sources the handler blocks on */
+    simptcp_entity.epoll_fd = epoll_create1(0);
+    simptcp_entity.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    simptcp_entity.wakeup_fd = eventfd(0, EFD_NONBLOCK);
+    if ((simptcp_entity.epoll_fd < 0) || (simptcp_entity.timer_fd < 0) ||
+            (simptcp_entity.wakeup_fd < 0))
+    {
+        perror("Creation of simptcp entity event descriptors failed");
+        return -1;
+    }
+    if ((add_entity_event(simptcp_entity.udp_fd) < 0) ||
+            (add_entity_event(simptcp_entity.timer_fd) < 0) ||
+            (add_entity_event(simptcp_entity.wakeup_fd) < 0))
+    {
+        perror("epoll_ctl on simptcp entity event descriptors failed");
+        return -1;
+    }
+
+    if (init_simptcp_descriptors() < 0)
+    {
+        perror("Allocation of simptcp descriptor table failed");
+        return -1;
+    }
+
+    simptcp_timer_wheel_init(simptcp_timer_now());
+
+    if (simptcp_demux_init(simptcp_entity.max_open_sockets) < 0)
+    {
+        perror("Allocation of simptcp demultiplexing tables failed");
+        return -1;
+    }
+
     simptcp_entity.simptcp_socket_list=NULL;
     simptcp_entity.simptcp_socket_states=&(simptcp_socket_states);
     simptcp_entity.open_simptcp_connections=0;
-    simptcp_entity.open_simptcp_sockets=0;
-    memset(simptcp_entity.in_buffer, 0,MAX_SIMPTCP_BUFFER_SIZE);
+    if (simptcp_entity.rx_batch_size == 0)
+        simptcp_entity.rx_batch_size = SIMPTCP_DEFAULT_RX_BATCH;
+    memset(&(simptcp_entity.stats), 0, sizeof(struct simptcp_entity_stats));
+    if (init_rx_ring() < 0)
+    {
+        perror("Allocation of simptcp receive ring failed");
+        return -1;
+    }
+    if (init_tx_ring() < 0)
+    {
+        perror("Allocation of simptcp transmit queue failed");
+        return -1;
+    }
 
 
     /* launch a separate process that will execute simptcp_handler in parallel
@@ -11,12 +11,15 @@
 #include <sys/socket.h>
 #include <netinet/in.h>         /* for htons,.. */
 #include <arpa/inet.h>
-#include <unistd.h>             /* for usleep() */
 #include <sys/time.h>           /* for gettimeofday,..*/
 
 #include <libc_socket.h>
+#include <simptcp_api.h>          /* for IPPROTO_SIMPTCP socket options */
 #include <simptcp_packet.h>
 #include <simptcp_entity.h>
+#include <simptcp_demux.h>
+#include <simptcp_pmtu.h>
+#include <simptcp_pacing.h>
 #include "simptcp_func_var.c"    /* for socket related functions' prototypes */
 #include <term_colors.h>        /* for color macros */
 #define __PREFIX__              "[" COLOR("SIMPTCP_LIB", BRIGHT_YELLOW) " ] "
@@ -90,14 +93,18 @@ void init_simptcp_socket(struct simptcp_socket *sock, unsigned int lport)
 
     assert(sock != NULL);
     pthread_mutex_init(&(sock->mutex_socket), NULL);
+    pthread_cond_init(&(sock->cond_socket), NULL);
 
     lock_simptcp_socket(sock);
 
     /* Initialization code */
 
     sock->socket_type = unknown;
+    sock->demux_next = NULL;
+    sock->demux_table = demux_none;
     sock->new_conn_req=NULL;
     sock->pending_conn_req=0;
+    sock->released=0;
 
     /* set simpctp local socket address */
     memset(&(sock->local_simptcp), 0, sizeof (struct sockaddr));
@@ -116,34 +123,215 @@ void init_simptcp_socket(struct simptcp_socket *sock, unsigned int lport)
     memset(sock->out_buffer, 0, SIMPTCP_SOCKET_MAX_BUFFER_SIZE);
     sock->out_len=0;
     sock->nbr_retransmit=0;
-    sock->timer_duration=1500;
+    sock->timer_duration=SIMPTCP_INITIAL_RTO;
     /* protocol entity receiving side */
     sock->socket_state_receiver=-1;
     sock->next_ack_num=0;
-    memset(sock->in_buffer, 0, SIMPTCP_SOCKET_MAX_BUFFER_SIZE);
-    sock->in_len=0;
 
-    /* timeut initialization */
-    sock->timeout.tv_sec=0;
-    sock->timeout.tv_usec=0;
+    /* timers initialization */
+    simptcp_timer_init(sock, sock->timers);
     /* MIB statistics initialisation  */
     sock->simptcp_send_count=0;
     sock->simptcp_receive_count=0;
     sock->simptcp_in_errors_count=0;
     sock->simptcp_retransmit_count=0;
+    sock->simptcp_dupack_count=0;
+    sock->simptcp_fast_retransmit_count=0;
+    sock->simptcp_fast_recovery_count=0;
+    sock->simptcp_paced_count=0;
+    sock->simptcp_window_probe_count=0;
 
 
     /* Add Optional field initialisations */
+    sock->rtt_estimate = 0;
+    sock->rtt_variance = 0;
+    sock->last_rtt = 0;
+    sock->rtt_samples = 0;
+    sock->rto_min = SIMPTCP_DEFAULT_RTO_MIN;
+    sock->rto_max = SIMPTCP_DEFAULT_RTO_MAX;
+    sock->go_back_n = 0;
+    sock->sending_window_size = SIMPTCP_DEFAULT_WINDOW;
+    sock->sending_window_base = 0;
+    memset(&(sock->rtx_queue), 0, sizeof(struct simptcp_pdu_queue));
+    sock->snd_unsent = 0;
+    sock->snd_queue_size = 0;
+    sock->dupacks = 0;
+    sock->fast_recovery = 0;
+    sock->recover = 0;
+    sock->snd_wnd = 0;
+    sock->rtx_bytes = 0;
+    sock->persist_backoff = 0;
+    sock->delivered = 0;
+    sock->delivered_at = 0;
+    simptcp_cc_set(sock, SIMPTCP_CC_NEWRENO);
+    sock->max_pacing_rate = 0;
+    sock->pacing_tokens = 0;
+    sock->pacing_stamp = 0;
+    sock->pacing_listed = 0;
+    sock->pacing_next = NULL;
+    sock->receiving_window_size = SIMPTCP_DEFAULT_WINDOW;
+    sock->receiving_window_base = 0;
+    memset(&(sock->in_queue), 0, sizeof(struct simptcp_pdu_ring));
+    sock->in_offset = 0;
+    sock->sack = 0;
+    sock->timestamps = 1;
+    sock->ts_recent = 0;
+    sock->ts_recent_valid = 0;
+    memset(&(sock->ooo_buffer), 0, sizeof(struct simptcp_reorder_buffer));
+    sock->delack_timeout = 0;
+    sock->delack_pending = 0;
+    sock->quickack = SIMPTCP_QUICKACKS;
+    sock->rcv_wnd = 0;
+    sock->wscale_ok = 0;
+    sock->snd_wscale = 0;
+    sock->rcv_wscale = 0;
+    sock->mss = SIMPTCP_MTU_MSS(simptcp_entity.mtu);
+    sock->plpmtu = 0;
+    sock->pmtu_max = 0;
+    sock->pmtu_probe_size = 0;
+    sock->pmtu_probe_id = 0;
+    sock->pmtu_probe_count = 0;
     unlock_simptcp_socket(sock);
 
 }
 
 
 
+/*! \fn int simptcp_set_max_open_sockets(unsigned int n)
+* \brief fixe le nombre maximal de sockets simpTCP ouverts simultanement.
+* Doit etre appelee avant #start_simptcp (la table de descripteurs est dimensionnee au demarrage)
+* \param n nombre maximal de sockets
+* \return -EINVAL si n est nul, -EBUSY si la table est deja allouee, 0 sinon
+*/
+int simptcp_set_max_open_sockets(unsigned int n)
+{
+    if (n == 0)
+        return -EINVAL;
+    if (simptcp_entity.simptcp_socket_descriptors != NULL)
+        return -EBUSY;
+    simptcp_entity.max_open_sockets = n;
+    return 0;
+}
+
+/*! \fn int init_simptcp_descriptors()
+* \brief alloue le repertoire de la table de descripteurs (un pointeur par bloc de
+* #SIMPTCP_FD_CHUNK descripteurs). Les blocs eux-memes sont alloues au fur et a
+* mesure que la table grandit et ne sont jamais deplaces : la lecture de la table
+* (#get_simptcp_socket) se fait sans verrou.
+* \return -ENOMEM si echec, 0 sinon
+*/
+int init_simptcp_descriptors()
+{
+    unsigned int chunks;
+
+    if (simptcp_entity.max_open_sockets == 0)
+        simptcp_entity.max_open_sockets = SIMPTCP_DEFAULT_MAX_OPEN_SOCK;
+    chunks = (simptcp_entity.max_open_sockets + SIMPTCP_FD_CHUNK - 1) / SIMPTCP_FD_CHUNK;
+
+    simptcp_entity.simptcp_socket_descriptors = calloc(chunks, sizeof(struct simptcp_socket **));
+    if (!simptcp_entity.simptcp_socket_descriptors)
+        return -ENOMEM;
+    simptcp_entity.descriptors_high_water = 0;
+    simptcp_entity.free_descriptors = NULL;
+    simptcp_entity.free_descriptors_count = 0;
+    simptcp_entity.free_descriptors_size = 0;
+    simptcp_entity.free_sockets = NULL;
+    simptcp_entity.released_sockets = NULL;
+    simptcp_entity.open_simptcp_sockets = 0;
+    pthread_mutex_init(&(simptcp_entity.descriptors_mutex), NULL);
+    return 0;
+}
+
+/*! \fn struct simptcp_socket * get_simptcp_socket(int fd)
+* \brief renvoie le socket simpTCP associe a un descripteur
+* \param fd descripteur du socket simpTCP
+* \return pointeur sur la structure #simptcp_socket, NULL si fd n'est pas un descripteur simpTCP ouvert
+*/
+struct simptcp_socket * get_simptcp_socket(int fd)
+{
+    struct simptcp_socket ** chunk;
+
+    if ((fd < 0) || ((unsigned int) fd >= simptcp_entity.max_open_sockets) ||
+            (simptcp_entity.simptcp_socket_descriptors == NULL))
+        return NULL;
+    chunk = __atomic_load_n(&(simptcp_entity.simptcp_socket_descriptors[fd / SIMPTCP_FD_CHUNK]),
+                            __ATOMIC_ACQUIRE);
+    if (chunk == NULL)
+        return NULL;
+    return __atomic_load_n(&(chunk[fd % SIMPTCP_FD_CHUNK]), __ATOMIC_ACQUIRE);
+}
+
+/*! \fn static void set_simptcp_socket(int fd, struct simptcp_socket * sock)
+* \brief associe un socket a un descripteur deja alloue (NULL pour le liberer)
+*/
+static void set_simptcp_socket(int fd, struct simptcp_socket * sock)
+{
+    __atomic_store_n(&(simptcp_entity.simptcp_socket_descriptors[fd / SIMPTCP_FD_CHUNK][fd % SIMPTCP_FD_CHUNK]),
+                     sock, __ATOMIC_RELEASE);
+}
+
+/*! \fn static int alloc_simptcp_descriptor()
+* \brief reserve un descripteur : le dernier libere s'il y en a un, sinon le
+* suivant jamais utilise (en ajoutant un bloc a la table si necessaire).
+* L'appelant doit detenir descriptors_mutex.
+* \return descripteur reserve, -ENOMEM ou -ENFILE si echec
+*/
+static int alloc_simptcp_descriptor()
+{
+    struct simptcp_socket ** chunk;
+    int fd;
+
+    if (simptcp_entity.free_descriptors_count > 0)
+        return simptcp_entity.free_descriptors[--simptcp_entity.free_descriptors_count];
+
+    if (simptcp_entity.descriptors_high_water >= simptcp_entity.max_open_sockets)
+        return -ENFILE;
+    fd = simptcp_entity.descriptors_high_water;
+    if (simptcp_entity.simptcp_socket_descriptors[fd / SIMPTCP_FD_CHUNK] == NULL)
+    {
+        chunk = calloc(SIMPTCP_FD_CHUNK, sizeof(struct simptcp_socket *));
+        if (!chunk)
+            return -ENOMEM;
+        __atomic_store_n(&(simptcp_entity.simptcp_socket_descriptors[fd / SIMPTCP_FD_CHUNK]),
+                         chunk, __ATOMIC_RELEASE);
+    }
+    simptcp_entity.descriptors_high_water++;
+    return fd;
+}
+
+/*! \fn static struct simptcp_socket * alloc_simptcp_pcb()
+* \brief prend une structure #simptcp_socket dans le pool, qui est reapprovisionne
+* par blocs de #SIMPTCP_PCB_SLAB structures. La memoire du pool n'est jamais rendue
+* au systeme : une recherche concurrente (demultiplexage) sur un socket recycle
+* ne peut pas provoquer de faute. L'appelant doit detenir descriptors_mutex.
+* \return pointeur sur la structure, NULL si echec
+*/
+static struct simptcp_socket * alloc_simptcp_pcb()
+{
+    struct simptcp_socket * slab;
+    struct simptcp_socket * sock;
+    int i;
+
+    if (simptcp_entity.free_sockets == NULL)
+    {
+        slab = malloc(SIMPTCP_PCB_SLAB * sizeof(struct simptcp_socket));
+        if (!slab)
+            return NULL;
+        for (i = 0; i < SIMPTCP_PCB_SLAB; i++)
+        {
+            slab[i].pool_next = simptcp_entity.free_sockets;
+            simptcp_entity.free_sockets = &(slab[i]);
+        }
+    }
+    sock = simptcp_entity.free_sockets;
+    simptcp_entity.free_sockets = sock->pool_next;
+    return sock;
+}
+
 /*! \fn int create_simptcp_socket()
 * \brief cree un nouveau socket SimpTCP et l'initialise.
-* parcourt la table de  descripteur a la recheche d'une entree libre. S'il en trouve, cree
-* une nouvelle instance de la structure simpTCP, la rattache a la table de descrpteurs et l'initialise.
+* reserve un descripteur (en reutilisant en priorite un descripteur libere), prend
+* une structure simpTCP dans le pool, la rattache a la table de descripteurs et l'initialise.
 * \return descripteur du socket simpTCP cree ou une erreur en cas d'echec
 */
 int create_simptcp_socket()
@@ -155,33 +343,140 @@ int create_simptcp_socket()
     int fd;
     struct simptcp_socket*  new_sock;
 
-
+    pthread_mutex_lock(&(simptcp_entity.descriptors_mutex));
     /* get a free simptcp socket descriptor */
-    for (fd=0; fd< MAX_OPEN_SOCK; fd++)
+    fd = alloc_simptcp_descriptor();
+    if (fd < 0)
+    {
+        /* The maximum number of open simptcp
+         socket reached  */
+        pthread_mutex_unlock(&(simptcp_entity.descriptors_mutex));
+        return fd;
+    }
+    /* Allocating memory for the new simptcp_socket */
+    new_sock = alloc_simptcp_pcb();
+    if (!new_sock)
+    {
+        simptcp_entity.free_descriptors[simptcp_entity.free_descriptors_count++] = fd;
+        pthread_mutex_unlock(&(simptcp_entity.descriptors_mutex));
+        return -ENOMEM;
+    }
+    simptcp_entity.open_simptcp_sockets++;
+    pthread_mutex_unlock(&(simptcp_entity.descriptors_mutex));
+
+    /* initialize the simptcp socket control block with
+     local port number set to 15000+fd */
+    init_simptcp_socket(new_sock,15000+fd);
+    new_sock->fd = fd;
+
+    set_simptcp_socket(fd, new_sock);
+    /* return the socket descriptor */
+    return fd;
+}
+
+/*! \fn int release_simptcp_socket(int fd)
+* \brief libere un socket simpTCP ferme par l'application : il est confie a
+* l'entite, seule a pouvoir le recycler (#recycle_simptcp_sockets) puisqu'elle
+* peut encore le detenir (PDU demultiplexe, timer echu)
+* \param fd descripteur du socket simpTCP
+* \return -EBADF si fd n'est pas un descripteur simpTCP ouvert, 0 sinon
+*/
+int release_simptcp_socket(int fd)
+{
+    struct simptcp_socket * sock = get_simptcp_socket(fd);
+
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    if (sock == NULL)
+        return -EBADF;
+
+    pthread_mutex_lock(&(simptcp_entity.descriptors_mutex));
+    if (sock->released)
+    {
+        pthread_mutex_unlock(&(simptcp_entity.descriptors_mutex));
+        return -EBADF;
+    }
+    sock->released = 1;
+    sock->pool_next = simptcp_entity.released_sockets;
+    simptcp_entity.released_sockets = sock;
+    pthread_mutex_unlock(&(simptcp_entity.descriptors_mutex));
+
+    /* the handler recycles it at the end of its iteration */
+    simptcp_entity_wakeup();
+    return 0;
+}
+
+/*! \fn static void recycle_simptcp_socket(struct simptcp_socket * sock)
+* \brief retire un socket des tables de demultiplexage, du tourniquet de
+* cadencement et de la roue de timers, puis rend sa structure au pool et son
+* descripteur a la pile des descripteurs libres. Les demandes de connexion
+* qu'un socket d'ecoute n'a pas acceptees sont recyclees avec lui.
+* Appelee par le thread de l'entite seulement, qui ne detient alors aucun socket.
+* \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+*/
+static void recycle_simptcp_socket(struct simptcp_socket * sock)
+{
+    int * stack;
+    int kind;
+
+    simptcp_demux_remove(sock);
+    simptcp_pacing_remove(sock);
+    // Un timer echu avant la fermeture a pu etre relance par son traitement.
+    for (kind = 0; kind < SIMPTCP_TIMER_KINDS; kind++)
+        stop_simptcp_timer(sock, kind);
+    while (sock->pending_conn_req > 0)
+        recycle_simptcp_socket(sock->new_conn_req[--sock->pending_conn_req]);
+
+    pthread_mutex_lock(&(simptcp_entity.descriptors_mutex));
+    set_simptcp_socket(sock->fd, NULL);
+    if (simptcp_entity.free_descriptors_count == simptcp_entity.free_descriptors_size)
     {
-        if ((simptcp_entity.simptcp_socket_descriptors[fd]) == NULL)
+        stack = realloc(simptcp_entity.free_descriptors,
+                        (simptcp_entity.free_descriptors_size + SIMPTCP_FD_CHUNK) * sizeof(int));
+        if (stack)
         {
-            /* this is a free descriptor */
-            /* Allocating memory for the new simptcp_socket */
-            new_sock =
-                (struct simptcp_socket *) malloc(sizeof(struct simptcp_socket));
-            if (!new_sock)
-            {
-                return -ENOMEM;
-            }
-            /* initialize the simptcp socket control block with
-             local port number set to 15000+fd */
-            init_simptcp_socket(new_sock,15000+fd);
-            simptcp_entity.open_simptcp_sockets++;
-
-            simptcp_entity.simptcp_socket_descriptors[fd]=new_sock;
-            /* return the socket descriptor */
-            return fd;
+            simptcp_entity.free_descriptors = stack;
+            simptcp_entity.free_descriptors_size += SIMPTCP_FD_CHUNK;
         }
-    } /* for */
-    /* The maximum number of open simptcp
-     socket reached  */
-    return -ENFILE;
+    }
+    // Sans memoire pour la pile, le descripteur est perdu, pas la structure.
+    if (simptcp_entity.free_descriptors_count < simptcp_entity.free_descriptors_size)
+        simptcp_entity.free_descriptors[simptcp_entity.free_descriptors_count++] = sock->fd;
+
+    free(sock->new_conn_req);
+    sock->new_conn_req = NULL;
+    simptcp_queue_free(&(sock->rtx_queue));
+    simptcp_ring_free(&(sock->in_queue));
+    simptcp_reorder_free(&(sock->ooo_buffer));
+    pthread_mutex_destroy(&(sock->mutex_socket));
+    pthread_cond_destroy(&(sock->cond_socket));
+    sock->pool_next = simptcp_entity.free_sockets;
+    simptcp_entity.free_sockets = sock;
+    simptcp_entity.open_simptcp_sockets--;
+    pthread_mutex_unlock(&(simptcp_entity.descriptors_mutex));
+}
+
+/*! \fn void recycle_simptcp_sockets()
+* \brief recycle les sockets fermes par l'application depuis la derniere
+* iteration du handler de l'entite (#release_simptcp_socket)
+*/
+void recycle_simptcp_sockets()
+{
+    struct simptcp_socket * sock;
+    struct simptcp_socket * next;
+
+    pthread_mutex_lock(&(simptcp_entity.descriptors_mutex));
+    sock = simptcp_entity.released_sockets;
+    simptcp_entity.released_sockets = NULL;
+    pthread_mutex_unlock(&(simptcp_entity.descriptors_mutex));
+
+    for (; sock != NULL; sock = next)
+    {
+        next = sock->pool_next;
+        recycle_simptcp_socket(sock);
+    }
 }
 
 /*! \fn void print_simptcp_socket(struct simptcp_socket *sock)
@@ -207,13 +502,37 @@ void print_simptcp_socket(struct simptcp_socket *sock)
 
     printf("Receiving side \n");
     printf("receiver state       : %d\n", sock->socket_state_receiver);
-    printf("Receive  buffer occupation : %d\n", sock->in_len);
+    printf("Receive queue occupation : %u/%u PDUs\n",
+           simptcp_ring_count(&(sock->in_queue)), sock->in_queue.size);
     printf("next ack number : %u\n", sock->next_ack_num);
+    printf("ACK delay : %u ms (%u PDUs unacknowledged)\n", sock->delack_timeout,
+           sock->delack_pending);
+    printf("MSS : %u\n", sock->mss);
+    printf("receive window : %u bytes advertised, %u bytes free (scale %u)\n",
+           sock->rcv_wnd, simptcp_rcv_space(sock), sock->rcv_wscale);
+    printf("Send queue occupation : %u/%u PDUs (%u not sent yet)\n",
+           sock->rtx_queue.count, simptcp_snd_queue_size(sock), sock->snd_unsent);
+    printf("peer receive window : %u bytes, %u bytes in flight (scale %u)\n",
+           sock->snd_wnd, sock->rtx_bytes, sock->snd_wscale);
+    if (sock->plpmtu != 0)
+        printf("path MTU : %u (probing %u)\n", sock->plpmtu, sock->pmtu_probe_size);
 
     printf("send count       : %lu\n", sock->simptcp_send_count);
     printf("receive count       : %lu\n", sock->simptcp_receive_count);
     printf("receive error count       : %lu\n", sock->simptcp_in_errors_count);
     printf("retransmit count       : %lu\n", sock->simptcp_retransmit_count);
+    printf("duplicate ACK count       : %lu\n", sock->simptcp_dupack_count);
+    printf("fast retransmit count       : %lu (%lu fast recoveries)\n",
+           sock->simptcp_fast_retransmit_count, sock->simptcp_fast_recovery_count);
+    printf("paced PDU count       : %lu\n", sock->simptcp_paced_count);
+    printf("zero window probe count       : %lu\n", sock->simptcp_window_probe_count);
+    printf("smoothed RTT       : %.3f ms (variation %.3f ms, %lu samples)\n",
+           sock->rtt_estimate * 1000, sock->rtt_variance * 1000, sock->rtt_samples);
+    printf("retransmission timeout       : %d ms\n", getTimeoutDuration(sock));
+    printf("congestion control       : %s, cwnd %u PDUs, ssthresh %u PDUs\n",
+           sock->cc->name, sock->cwnd, sock->ssthresh);
+    if (simptcp_pacing_rate(sock) > 0)
+        printf("pacing rate       : %.1f Mbit/s\n", simptcp_pacing_rate(sock) * 8 / 1e6);
     printf("----------------------------------------\n");
 }
 
@@ -260,107 +579,1409 @@ int unlock_simptcp_socket(struct simptcp_socket *sock)
     return pthread_mutex_unlock(&(sock->mutex_socket));
 }
 
+/*! \fn int wait_simptcp_socket(struct simptcp_socket *sock)
+* \brief bloque l'application jusqu'a ce que l'entite protocolaire ait traite un
+* evenement (PDU recu, timeout) pour ce socket. L'appelant doit avoir verrouille le
+* socket (#lock_simptcp_socket) ; le verrou est relache pendant l'attente et repris
+* au reveil. A utiliser dans une boucle qui reteste la condition attendue.
+* \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+* \return 0 si succes, -1 ou un code d'erreur pthread sinon
+*/
+int wait_simptcp_socket(struct simptcp_socket *sock)
+{
+    if (!sock)
+        return -1;
+
+    return pthread_cond_wait(&(sock->cond_socket), &(sock->mutex_socket));
+}
+
+/*! \fn int signal_simptcp_socket(struct simptcp_socket *sock)
+* \brief reveille les appels de l'application en attente sur ce socket
+* (#wait_simptcp_socket). Appelee par l'entite protocolaire, socket verrouille.
+* \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+* \return 0 si succes, -1 ou un code d'erreur pthread sinon
+*/
+int signal_simptcp_socket(struct simptcp_socket *sock)
+{
+    if (!sock)
+        return -1;
+
+    return pthread_cond_broadcast(&(sock->cond_socket));
+}
+
+/*! \fn void start_simptcp_timer(struct simptcp_socket * sock, int kind, int duration)
+ * \brief arme (ou re-arme) l'un des timers du socket dans la roue de timers de l'entite
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param kind timer concerne (#simptcp_timer_kinds)
+ * \param duration duree a mesurer en ms
+*/
+void start_simptcp_timer(struct simptcp_socket * sock, int kind, int duration)
+{
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+    assert(sock!=NULL);
+
+    simptcp_timer_arm(&(sock->timers[kind]), duration);
+    /* the entity handler sleeps until the earliest deadline : let it re-arm */
+    simptcp_entity_wakeup();
+}
+
+/*! \fn void stop_simptcp_timer(struct simptcp_socket * sock, int kind)
+ * \brief desarme l'un des timers du socket
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param kind timer concerne (#simptcp_timer_kinds)
+ */
+void stop_simptcp_timer(struct simptcp_socket * sock, int kind)
+{
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+    assert(sock!=NULL);
+    simptcp_timer_cancel(&(sock->timers[kind]));
+}
+
 /*! \fn void start_timer(struct simptcp_socket * sock, int duration)
- * \brief lance le timer associe au socket en fixant l'instant ou la duree a mesurer "duration" sera ecoulee (champ "timeout" de #simptcp_socket)
+ * \brief lance le timer de retransmission associe au socket
  * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
  * \param duration duree a mesurer en ms
 */
 void start_timer(struct simptcp_socket * sock, int duration)
 {
-    struct timeval t0;
+    start_simptcp_timer(sock, SIMPTCP_TIMER_RTO, duration);
+}
+
+/*! \fn void stop_timer(struct simptcp_socket * sock)
+ * \brief stoppe le timer de retransmission associe au socket
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void stop_timer(struct simptcp_socket * sock)
+{
+    stop_simptcp_timer(sock, SIMPTCP_TIMER_RTO);
+}
+
+/*! \fn int send_out_buffer(struct simptcp_socket *sock)
+ * \brief place le PDU memorise dans le out_buffer du socket dans la file d'emission
+ * de l'entite (videe par sendmmsg a chaque iteration du handler)
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return taille du PDU si succes, -1 si echec (avec errno positionne)
+ */
+int send_out_buffer(struct simptcp_socket *sock)
+{
+    return simptcp_entity_enqueue_pdu(sock->out_buffer,
+                                      simptcp_get_total_len(sock->out_buffer),
+                                      &(sock->remote_udp));
+}
+
+/*! \fn u_int32_t simptcp_rcv_space(struct simptcp_socket *sock)
+ * \brief espace libre de la file de reception : charge utile que le pair peut
+ * encore emettre au dela du dernier PDU acquitte sans qu'un PDU soit perdu
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return espace libre en octets
+ */
+u_int32_t simptcp_rcv_space(struct simptcp_socket *sock)
+{
+    unsigned int size = sock->in_queue.slots ? sock->in_queue.size :
+                        sock->receiving_window_size;
+
+    return (size - simptcp_ring_count(&(sock->in_queue))) * sock->mss;
+}
+
+/*! \fn static u_int16_t simptcp_advertised_window(struct simptcp_socket *sock, unsigned char shift)
+ * \brief fenetre a annoncer : espace libre de la file de reception divise par
+ * 2^shift, retenu dans rcv_wnd
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param shift facteur d'echelle de la fenetre
+ * \return valeur du champ window_size
+ */
+static u_int16_t simptcp_advertised_window(struct simptcp_socket *sock, unsigned char shift)
+{
+    u_int32_t window = simptcp_rcv_space(sock);
+
+    window >>= shift;
+    if (window > UINT16_MAX)
+        window = UINT16_MAX;
+    sock->rcv_wnd = window << shift;
+    return window;
+}
+
+/*! \fn void set_simptcp_window(struct simptcp_socket *sock, char *pdu)
+ * \brief annonce l'espace libre de la file de reception dans le champ
+ * window_size d'un PDU construit et recalcule son checksum. La fenetre est
+ * divisee par 2^rcv_wscale, sauf dans un SYN [RFC7323].
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param pdu PDU a emettre
+ */
+void set_simptcp_window(struct simptcp_socket *sock, char *pdu)
+{
+    unsigned char shift = (simptcp_get_flags(pdu) & SYN) ? 0 : sock->rcv_wscale;
+
+    simptcp_set_win_size(pdu, simptcp_advertised_window(sock, shift));
+    simptcp_add_checksum(pdu, simptcp_get_total_len(pdu));
+}
+
+/*! \fn void set_simptcp_ack(struct simptcp_socket *sock, char *pdu, uint64_t now)
+ * \brief un PDU de donnees de la file d'emission part (ou repart) : il porte
+ * l'acquittement, la fenetre et l'option timestamp du moment, ce qui dispense
+ * d'un ACK seul pour les PDU recus depuis le dernier acquittement. Le checksum
+ * est corrige sans reparcourir la charge utile.
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param pdu PDU a emettre
+ * \param now date d'emission en us
+ */
+void set_simptcp_ack(struct simptcp_socket *sock, char *pdu, uint64_t now)
+{
+    simptcp_update_ack(pdu, sock->next_ack_num,
+                       simptcp_advertised_window(sock, sock->rcv_wscale));
+    // ts_ecr nul : aucune date du pair a renvoyer.
+    if (sock->timestamps)
+        simptcp_update_ts(pdu, now, sock->ts_recent_valid ? sock->ts_recent : 0);
+    if (sock->delack_pending > 0)
+    {
+        sock->delack_pending = 0;
+        stop_simptcp_timer(sock, SIMPTCP_TIMER_DELACK);
+    }
+}
+
+/*! \fn int send_simptcp_ack(struct simptcp_socket *sock)
+ * \brief emet un acquittement cumulatif (numero du prochain PDU attendu : next_ack_num),
+ * complete par les blocs SACK des PDU recus hors sequence et par la date
+ * d'emission du plus ancien PDU en sequence non acquitte (option timestamp).
+ * Il porte le numero du prochain PDU de donnees sans le consommer : le pair
+ * ne l'attend pas dans sa file de reception. Il est construit dans un tampon
+ * local (le out_buffer garde le SYN ou le FIN a re-emettre) et desarme le
+ * timer d'ACK retarde.
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return taille du PDU si succes, -1 si echec
+ */
+int send_simptcp_ack(struct simptcp_socket *sock)
+{
+    char pdu[SIMPTCP_GHEADER_SIZE + SIMPTCP_MAX_OPTIONS_SIZE];
+    struct simptcp_options options;
+    int res;
+
+    // Les PDU recus hors sequence sont signales par l'option SACK.
+    options.present = 0;
+    if (sock->ts_recent_valid)
+    {
+        options.present |= SIMPTCP_TS_OPTION;
+        options.ts_val = simptcp_timer_now_us();
+        options.ts_ecr = sock->ts_recent;
+    }
+    if (sock->ooo_buffer.count > 0)
+    {
+        options.present |= SIMPTCP_SACK_OPTION;
+        options.sack_blocks = simptcp_reorder_sack_blocks(&(sock->ooo_buffer),
+                              sock->next_ack_num, options.sack,
+                              SIMPTCP_MAX_SACK_BLOCKS);
+    }
+    // Construit directement dans un tampon local, sans allocation.
+    simptcp_write_pdu(pdu,
+                      &sock->local_simptcp,
+                      &sock->remote_simptcp,
+                      NULL, // payload
+                      0, // len
+                      sock->next_seq_num + 1, // seq, non consomme
+                      sock->next_ack_num, // ack
+                      ACK,
+                      &options);
+    set_simptcp_window(sock, pdu);
+    res = simptcp_entity_enqueue_pdu(pdu, simptcp_get_total_len(pdu), &(sock->remote_udp));
+    // Cet ACK acquitte aussi les PDU dont l'acquittement etait retarde.
+    if (sock->delack_pending > 0)
+    {
+        sock->delack_pending = 0;
+        stop_simptcp_timer(sock, SIMPTCP_TIMER_DELACK);
+    }
+    return res;
+}
+
+/*! \fn void handle_simptcp_delack_timeout(struct simptcp_socket *sock)
+ * \brief expiration du timer d'ACK retarde : les PDU recus en sequence depuis
+ * le dernier ACK sont acquittes
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void handle_simptcp_delack_timeout(struct simptcp_socket *sock)
+{
 #if __DEBUG__
     printf("function %s called\n", __func__);
 #endif
-    assert(sock!=NULL);
 
-    gettimeofday(&t0,NULL);
+    if ((sock->delack_pending > 0) &&
+            (sock->socket_state == &(simptcp_entity.simptcp_socket_states->established)))
+        send_simptcp_ack(sock);
+}
+
+/*! \fn int transmit_simptcp_pdu(struct simptcp_socket *sock, struct simptcp_queued_pdu *queued)
+ * \brief premiere emission du plus ancien PDU non encore emis de la file
+ * d'emission : il passe en vol, avec sa date d'emission et l'etat de la
+ * livraison pour les echantillons de RTT et de debit
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param queued PDU de la file d'emission
+ * \return taille du PDU si succes, -1 si echec (avec errno positionne)
+ */
+int transmit_simptcp_pdu(struct simptcp_socket *sock, struct simptcp_queued_pdu *queued)
+{
+    uint64_t now = simptcp_timer_now_us();
+    int res;
+
+    // Apres une periode sans PDU en vol, le debit se mesure depuis cet envoi.
+    if (simptcp_in_flight(sock) == 0)
+        sock->delivered_at = now;
+    // Acquittement porte par le PDU ; la date d'emission (us) sera renvoyee
+    // par le recepteur dans son ACK.
+    set_simptcp_ack(sock, queued->pdu, now);
+    queued->sent_at = now;
+    queued->delivered = sock->delivered;
+    queued->delivered_at = sock->delivered_at;
+    res = simptcp_entity_enqueue_pdu(queued->pdu, queued->len, &(sock->remote_udp));
+    if (res < 0)
+        return -1;
+    sock->snd_unsent--;
+    sock->rtx_bytes += queued->len - simptcp_get_head_len(queued->pdu);
+    sock->simptcp_send_count++;
+    if (!has_active_timer(sock))
+        start_timer(sock, getTimeoutDuration(sock));
+#if __DEBUG__
+    printf("***** SEND: SEQ=%d, ACK=%d\n", queued->seq, sock->next_ack_num);
+#endif
+    return res;
+}
+
+/*! \fn unsigned int simptcp_in_flight(struct simptcp_socket *sock)
+ * \brief nombre de PDU emis et non acquittes : ceux de tete de la file
+ * d'emission
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return nombre de PDU en vol
+ */
+unsigned int simptcp_in_flight(struct simptcp_socket *sock)
+{
+    return sock->rtx_queue.count - sock->snd_unsent;
+}
+
+/*! \fn unsigned int simptcp_snd_queue_size(struct simptcp_socket *sock)
+ * \brief capacite de la file d'emission : celle fixee par SO_SNDBUF, sinon
+ * #SIMPTCP_DEFAULT_SEND_QUEUE PDU et au moins deux fenetres d'emission (le
+ * PDU suivant est deja en file quand un ACK libere la fenetre)
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return capacite en PDU
+ */
+unsigned int simptcp_snd_queue_size(struct simptcp_socket *sock)
+{
+    if (sock->snd_queue_size > 0)
+        return sock->snd_queue_size;
+    return 2 * sock->sending_window_size > SIMPTCP_DEFAULT_SEND_QUEUE ?
+           2 * sock->sending_window_size : SIMPTCP_DEFAULT_SEND_QUEUE;
+}
+
+/*! \fn int simptcp_snd_allowed(struct simptcp_socket *sock, struct simptcp_queued_pdu *queued)
+ * \brief le PDU peut-il partir : un seul PDU en vol en stop-and-wait, au plus
+ * une fenetre en Go-Back-N, bornee par la fenetre de congestion, et dans
+ * tous les cas l'espace libre annonce par le recepteur
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param queued prochain PDU a emettre de la file d'emission
+ * \return 1 si le PDU peut etre emis, 0 sinon
+ */
+int simptcp_snd_allowed(struct simptcp_socket *sock, struct simptcp_queued_pdu *queued)
+{
+    unsigned int flight = simptcp_in_flight(sock);
+
+    if (flight >= (sock->go_back_n ? sock->sending_window_size : 1))
+        return 0;
+    if (sock->go_back_n && (flight >= simptcp_cc_window(sock)))
+        return 0;
+    return sock->rtx_bytes + queued->len - simptcp_get_head_len(queued->pdu) <=
+           sock->snd_wnd;
+}
+
+/*! \fn static int simptcp_persist_duration(struct simptcp_socket *sock)
+ * \brief intervalle entre deux sondes de fenetre nulle : le RTO, double a
+ * chaque sonde sans reponse, borne par rto_max
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return duree en ms
+ */
+static int simptcp_persist_duration(struct simptcp_socket *sock)
+{
+    unsigned long duration = (unsigned long) getTimeoutDuration(sock) << sock->persist_backoff;
+
+    return duration < sock->rto_max ? duration : sock->rto_max;
+}
+
+/*! \fn void simptcp_persist_arm(struct simptcp_socket *sock)
+ * \brief la fenetre du recepteur retient la file d'emission : sans PDU en vol,
+ * aucun ACK ne la rouvrira, le timer de persistance la sonde
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void simptcp_persist_arm(struct simptcp_socket *sock)
+{
+    if ((simptcp_in_flight(sock) == 0) &&
+            !simptcp_timer_pending(&(sock->timers[SIMPTCP_TIMER_PERSIST])))
+        start_simptcp_timer(sock, SIMPTCP_TIMER_PERSIST, simptcp_persist_duration(sock));
+}
+
+/*! \fn void handle_simptcp_persist_timeout(struct simptcp_socket *sock)
+ * \brief expiration du timer de persistance : la fenetre du recepteur est
+ * fermee et aucun PDU n'est en vol, donc aucun ACK ne viendra la rouvrir (ou
+ * celui qui l'a rouverte est perdu). Un PDU vide de numero deja acquitte la
+ * sonde : le recepteur y repond par un ACK qui porte sa fenetre.
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void handle_simptcp_persist_timeout(struct simptcp_socket *sock)
+{
+    struct simptcp_queued_pdu *queued = NULL;
+    unsigned int seq;
+
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    if (sock->snd_unsent > 0)
+        queued = simptcp_queue_at(&(sock->rtx_queue),
+                                  sock->rtx_queue.count - sock->snd_unsent);
+    if (((sock->socket_state != &(simptcp_entity.simptcp_socket_states->established)) &&
+            (sock->socket_state != &(simptcp_entity.simptcp_socket_states->closewait))) ||
+            (simptcp_in_flight(sock) > 0) || (queued == NULL) ||
+            simptcp_snd_allowed(sock, queued))
+    {
+        sock->persist_backoff = 0;
+        return;
+    }
+    // Le numero qui precede le premier PDU non emis est deja acquitte.
+    seq = (u_int16_t) (queued->seq - 1);
+    simptcp_write_pdu(sock->out_buffer,
+                      &sock->local_simptcp,
+                      &sock->remote_simptcp,
+                      NULL, // payload
+                      0, // len
+                      seq, // seq, deja acquitte
+                      sock->next_ack_num, // ack
+                      0,
+                      NULL);
+    if (send_out_buffer(sock) >= 0)
+        sock->simptcp_window_probe_count++;
+#if __DEBUG__
+    printf("***** WINDOW PROBE: SEQ=%d, window %u\n", seq, sock->snd_wnd);
+#endif
+    if (sock->persist_backoff < SIMPTCP_MAX_PERSIST_BACKOFF)
+        sock->persist_backoff++;
+    start_simptcp_timer(sock, SIMPTCP_TIMER_PERSIST, simptcp_persist_duration(sock));
+}
+
+/*! \fn int retransmit_simptcp_window(struct simptcp_socket *sock)
+ * \brief re-emet les PDU non acquittes de la file de retransmission et relance
+ * le timer : tous (Go-Back-N), sauf ceux que le recepteur a deja signales
+ * par l'option SACK (selective repeat) ; ceux qui n'ont jamais ete emis
+ * restent en file
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return nombre de PDU re-emis, -1 si echec
+ */
+int retransmit_simptcp_window(struct simptcp_socket *sock)
+{
+    struct simptcp_queued_pdu *queued;
+    unsigned int i;
+    int sent = 0;
+
+    for (i = 0; i < simptcp_in_flight(sock); i++)
+    {
+        queued = simptcp_queue_at(&(sock->rtx_queue), i);
+        if (queued->sacked)
+            continue;
+        set_simptcp_ack(sock, queued->pdu, simptcp_timer_now_us());
+        if (simptcp_entity_enqueue_pdu(queued->pdu, queued->len, &(sock->remote_udp)) < 0)
+            return -1;
+        simptcp_pacing_charge(sock, queued->len);
+        queued->retransmitted = 1;
+        sock->simptcp_retransmit_count++;
+        sent++;
+    }
+    if (simptcp_in_flight(sock) > 0)
+        start_timer(sock, getTimeoutDuration(sock));
+    return sent;
+}
+
+/*! \fn int fast_retransmit_simptcp_pdu(struct simptcp_socket *sock)
+ * \brief re-emet le premier PDU non acquitte (ni signale par l'option SACK) de
+ * la file de retransmission, sans attendre l'expiration du timer : sur
+ * #SIMPTCP_DUPACK_THRESHOLD ACK dupliques (fast retransmit) et sur chaque
+ * acquittement partiel de la phase de fast recovery [RFC6582]
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return nombre de PDU re-emis (0 ou 1), -1 si echec
+ */
+int fast_retransmit_simptcp_pdu(struct simptcp_socket *sock)
+{
+    struct simptcp_queued_pdu *queued;
+    unsigned int i;
+
+    for (i = 0; i < simptcp_in_flight(sock); i++)
+    {
+        queued = simptcp_queue_at(&(sock->rtx_queue), i);
+        if (queued->sacked)
+            continue;
+        set_simptcp_ack(sock, queued->pdu, simptcp_timer_now_us());
+        if (simptcp_entity_enqueue_pdu(queued->pdu, queued->len, &(sock->remote_udp)) < 0)
+            return -1;
+        simptcp_pacing_charge(sock, queued->len);
+        queued->retransmitted = 1;
+        sock->simptcp_retransmit_count++;
+        sock->simptcp_fast_retransmit_count++;
+        start_timer(sock, getTimeoutDuration(sock));
+        return 1;
+    }
+    return 0;
+}
+
+/*! \fn int repacketize_simptcp_queue(struct simptcp_socket *sock)
+ * \brief redecoupe au MSS courant (#simptcp_pmtu_mss) les PDU de la file
+ * d'emission qui le depassent, et les renumerote a partir du premier d'entre
+ * eux : apres une baisse de la PMTU, ils ne passeraient sinon jamais. Seuls
+ * les PDU qui suivent le dernier PDU signale par l'option SACK sont
+ * redecoupes, le recepteur detient celui-ci sous son numero. Les fragments
+ * d'un PDU en vol sont en vol (ils seront re-emis), ceux d'un PDU non emis
+ * restent en file ; tous sauf le dernier portent le flag FRAG.
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return nombre de PDU de la file, -1 si echec (file inchangee)
+ */
+int repacketize_simptcp_queue(struct simptcp_socket *sock)
+{
+    struct simptcp_pdu_queue queue;
+    struct simptcp_queued_pdu *queued, *piece;
+    unsigned int i, first = 0, count = 0, unsent = 0, seq;
+    unsigned int flight = simptcp_in_flight(sock), mss = simptcp_pmtu_mss(sock);
+    int hlen, payload, max, offset, chunk, split = 0;
+    unsigned char flags;
+
+    for (i = 0; i < sock->rtx_queue.count; i++)
+        if (simptcp_queue_at(&(sock->rtx_queue), i)->sacked)
+            first = i + 1;
+    for (i = 0; i < sock->rtx_queue.count; i++) {
+        queued = simptcp_queue_at(&(sock->rtx_queue), i);
+        hlen = simptcp_get_head_len(queued->pdu);
+        max = mss - (hlen - SIMPTCP_GHEADER_SIZE);
+        payload = queued->len - hlen;
+        if ((i >= first) && (payload > max)) {
+            count += (payload + max - 1) / max;
+            split = 1;
+        }
+        else
+            count++;
+    }
+    if (!split)
+        return sock->rtx_queue.count;
+
+    memset(&queue, 0, sizeof(queue));
+    if (simptcp_queue_init(&queue, count > sock->rtx_queue.size ? count : sock->rtx_queue.size,
+                           sock->rtx_queue.pdu_size) < 0)
+        return -1;
+    seq = simptcp_queue_at(&(sock->rtx_queue), first)->seq;
+    for (i = 0; i < sock->rtx_queue.count; i++) {
+        queued = simptcp_queue_at(&(sock->rtx_queue), i);
+        hlen = simptcp_get_head_len(queued->pdu);
+        max = (i < first) ? queued->len : mss - (hlen - SIMPTCP_GHEADER_SIZE);
+        payload = queued->len - hlen;
+        flags = simptcp_get_flags(queued->pdu);
+        offset = 0;
+        do {
+            // L'en-tete (options comprises) est repris, l'acquittement et la
+            // date seront mis a jour a l'emission.
+            chunk = payload - offset <= max ? payload - offset : max;
+            piece = simptcp_queue_push(&queue, queued->pdu, hlen, queued->seq);
+            memcpy(piece->pdu + hlen, queued->pdu + hlen + offset, chunk);
+            piece->len = hlen + chunk;
+            if (i >= first) {
+                piece->seq = seq++;
+                simptcp_set_seq_num(piece->pdu, piece->seq);
+                simptcp_set_flags(piece->pdu, offset + chunk < payload ? flags | FRAG : flags);
+                simptcp_set_total_len(piece->pdu, piece->len);
+                simptcp_add_checksum(piece->pdu, piece->len);
+            }
+            piece->sacked = queued->sacked;
+            piece->retransmitted = queued->retransmitted;
+            piece->sent_at = queued->sent_at;
+            piece->delivered = queued->delivered;
+            piece->delivered_at = queued->delivered_at;
+            if (i >= flight)
+                unsent++;
+            offset += chunk;
+        }
+        while (offset < payload);
+    }
+    simptcp_queue_free(&(sock->rtx_queue));
+    sock->rtx_queue = queue;
+    sock->snd_unsent = unsent;
+    sock->next_seq_num = seq - 1;
+    return count;
+}
+
+/*! \fn int set_simptcp_socket_option(struct simptcp_socket * sock, int optname, const void *optval, socklen_t optlen)
+ * \brief fixe une option de niveau IPPROTO_SIMPTCP (voir simptcp_api.h)
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param optname option
+ * \param optval valeur (int)
+ * \param optlen taille de la valeur
+ * \return 0 si succes, -1 si echec (avec errno positionne)
+ */
+int set_simptcp_socket_option(struct simptcp_socket * sock, int optname,
+                              const void *optval, socklen_t optlen)
+{
+    int value;
+    int res = 0;
+
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    if ((optval == NULL) || (optlen < sizeof(int)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    value = *((const int *) optval);
+
+    lock_simptcp_socket(sock);
+    switch (optname)
+    {
+    case SIMPTCP_GO_BACK_N:
+        /* switching mode with PDUs in flight would mix both disciplines */
+        if (sock->rtx_queue.count > 0)
+            res = -EBUSY;
+        else
+            sock->go_back_n = (value != 0);
+        break;
+    case SIMPTCP_SENDING_WINDOW:
+        if ((value <= 0) || (value > UINT16_MAX / 2))
+            res = -EINVAL;
+        else if (sock->rtx_queue.count > 0)
+            res = -EBUSY;
+        else
+            sock->sending_window_size = value;
+        break;
+    case SIMPTCP_RECEIVING_WINDOW:
+        if ((value <= 0) || (value > UINT16_MAX / 2))
+            res = -EINVAL;
+        /* the reader peeks at the ring without the socket lock, and the
+           window scale announced in the SYN depends on this size : the
+           connection must not be opened yet */
+        else if ((sock->socket_state != &(simptcp_entity.simptcp_socket_states->closed)) &&
+                 (sock->socket_state != &(simptcp_entity.simptcp_socket_states->listen)))
+            res = -EBUSY;
+        else
+        {
+            /* re-allocated to the new size with the first in sequence PDU */
+            simptcp_ring_free(&(sock->in_queue));
+            simptcp_reorder_free(&(sock->ooo_buffer));
+            sock->receiving_window_size = value;
+        }
+        break;
+    case SIMPTCP_SACK:
+        if (sock->ooo_buffer.count > 0)
+            res = -EBUSY;
+        else
+            sock->sack = (value != 0);
+        break;
+    case SIMPTCP_TIMESTAMPS:
+        sock->timestamps = (value != 0);
+        break;
+    case SIMPTCP_RTO_MIN:
+        if ((value <= 0) || (value > sock->rto_max))
+            res = -EINVAL;
+        else
+            sock->rto_min = value;
+        break;
+    case SIMPTCP_RTO_MAX:
+        if ((value <= 0) || (value < sock->rto_min))
+            res = -EINVAL;
+        else
+            sock->rto_max = value;
+        break;
+    case SIMPTCP_DELAYED_ACK:
+        if ((value < 0) || (value > SIMPTCP_MAX_DELACK))
+            res = -EINVAL;
+        else
+            sock->delack_timeout = value;
+        break;
+    case SIMPTCP_MAX_PACING_RATE:
+        if (value < 0)
+            res = -EINVAL;
+        else
+            sock->max_pacing_rate = value;
+        break;
+    case SIMPTCP_CONGESTION:
+        /* the new algorithm would not know the PDUs in flight */
+        if (sock->rtx_queue.count > 0)
+            res = -EBUSY;
+        else
+            res = simptcp_cc_set(sock, value);
+        break;
+    case SIMPTCP_MAXSEG:
+        /* announced in the SYN : the connection must not be opened yet */
+        if ((value < SIMPTCP_MTU_MSS(SIMPTCP_MIN_MTU)) ||
+                (value > SIMPTCP_MTU_MSS(simptcp_entity.mtu)))
+            res = -EINVAL;
+        else if ((sock->socket_state != &(simptcp_entity.simptcp_socket_states->closed)) &&
+                 (sock->socket_state != &(simptcp_entity.simptcp_socket_states->listen)))
+            res = -EBUSY;
+        else
+            sock->mss = value;
+        break;
+    default:
+        res = -ENOPROTOOPT;
+        break;
+    }
+    unlock_simptcp_socket(sock);
+
+    if (res < 0)
+    {
+        errno = -res;
+        return -1;
+    }
+    return 0;
+}
+
+/*! \fn int get_simptcp_socket_option(struct simptcp_socket * sock, int optname, void *optval, socklen_t *optlen)
+ * \brief lit une option de niveau IPPROTO_SIMPTCP (voir simptcp_api.h)
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param optname option
+ * \param [out] optval valeur (int)
+ * \param [in,out] optlen taille de la valeur
+ * \return 0 si succes, -1 si echec (avec errno positionne)
+ */
+int get_simptcp_socket_option(struct simptcp_socket * sock, int optname,
+                              void *optval, socklen_t *optlen)
+{
+    int value;
+
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    if ((optval == NULL) || (optlen == NULL) || (*optlen < sizeof(int)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    switch (optname)
+    {
+    case SIMPTCP_GO_BACK_N:
+        value = sock->go_back_n;
+        break;
+    case SIMPTCP_SENDING_WINDOW:
+        value = sock->sending_window_size;
+        break;
+    case SIMPTCP_RECEIVING_WINDOW:
+        value = sock->receiving_window_size;
+        break;
+    case SIMPTCP_SACK:
+        value = sock->sack;
+        break;
+    case SIMPTCP_TIMESTAMPS:
+        value = sock->timestamps;
+        break;
+    case SIMPTCP_RTO_MIN:
+        value = sock->rto_min;
+        break;
+    case SIMPTCP_RTO_MAX:
+        value = sock->rto_max;
+        break;
+    case SIMPTCP_MAXSEG:
+        value = sock->mss;
+        break;
+    case SIMPTCP_DELAYED_ACK:
+        value = sock->delack_timeout;
+        break;
+    case SIMPTCP_CONGESTION:
+        value = simptcp_cc_get(sock);
+        break;
+    case SIMPTCP_CWND:
+        value = sock->cwnd;
+        break;
+    case SIMPTCP_PACING_RATE:
+        value = sock->pacing_rate < INT32_MAX ? sock->pacing_rate : INT32_MAX;
+        break;
+    case SIMPTCP_MAX_PACING_RATE:
+        value = sock->max_pacing_rate;
+        break;
+    default:
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+    *((int *) optval) = value;
+    *optlen = sizeof(int);
+    return 0;
+}
+
+/*! \fn int set_simptcp_socket_buffer(struct simptcp_socket * sock, int optname, const void *optval, socklen_t optlen)
+ * \brief fixe la taille d'un tampon du socket (options SO_RCVBUF et SO_SNDBUF
+ * de niveau SOL_SOCKET) : la valeur, en octets, est arrondie a un nombre
+ * entier de PDU du MSS courant
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param optname option (SO_RCVBUF ou SO_SNDBUF)
+ * \param optval valeur en octets (int)
+ * \param optlen taille de la valeur
+ * \return 0 si succes, -1 si echec (avec errno positionne)
+ */
+int set_simptcp_socket_buffer(struct simptcp_socket * sock, int optname,
+                              const void *optval, socklen_t optlen)
+{
+    int value, pdus;
+    int res = 0;
+
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    if ((optval == NULL) || (optlen < sizeof(int)) || (*((const int *) optval) <= 0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    value = *((const int *) optval);
+    if ((optname != SO_RCVBUF) && (optname != SO_SNDBUF))
+    {
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+    lock_simptcp_socket(sock);
+    pdus = (value + sock->mss - 1) / sock->mss;
+    if (optname == SO_RCVBUF)
+    {
+        unlock_simptcp_socket(sock);
+        return set_simptcp_socket_option(sock, SIMPTCP_RECEIVING_WINDOW, &pdus,
+                                         sizeof(pdus));
+    }
+    /* re-allocated to the new size with the next send */
+    if (pdus > UINT16_MAX / 2)
+        res = -EINVAL;
+    else if (sock->rtx_queue.count > 0)
+        res = -EBUSY;
+    else
+        sock->snd_queue_size = pdus;
+    unlock_simptcp_socket(sock);
+    if (res < 0)
+    {
+        errno = -res;
+        return -1;
+    }
+    return 0;
+}
+
+/*! \fn int get_simptcp_socket_buffer(struct simptcp_socket * sock, int optname, void *optval, socklen_t *optlen)
+ * \brief lit la taille d'un tampon du socket (options SO_RCVBUF et SO_SNDBUF
+ * de niveau SOL_SOCKET)
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param optname option (SO_RCVBUF ou SO_SNDBUF)
+ * \param [out] optval valeur en octets (int)
+ * \param [in,out] optlen taille de la valeur
+ * \return 0 si succes, -1 si echec (avec errno positionne)
+ */
+int get_simptcp_socket_buffer(struct simptcp_socket * sock, int optname,
+                              void *optval, socklen_t *optlen)
+{
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    if ((optval == NULL) || (optlen == NULL) || (*optlen < sizeof(int)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((optname != SO_RCVBUF) && (optname != SO_SNDBUF))
+    {
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+    if (optname == SO_RCVBUF)
+        *((int *) optval) = sock->receiving_window_size * sock->mss;
+    else
+        *((int *) optval) = simptcp_snd_queue_size(sock) * sock->mss;
+    *optlen = sizeof(int);
+    return 0;
+}
+
+/*! \fn int resendBuffer(struct simptcp_socket *sock)
+ * \brief re-emet le dernier PDU de controle (SYN, FIN...) du out_buffer et
+ * relance le timer de retransmission
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return 0 si succes, -1 si echec
+ */
+int resendBuffer(struct simptcp_socket *sock) {
+    stop_timer(sock);
+    int res = send_out_buffer(sock);
+    if (res == -1) {
+        printf("ERROR: Retransmission failed.\n");
+        return res;
+    }
+    sock->simptcp_retransmit_count++;
+    start_timer(sock, getTimeoutDuration(sock));
+
+    return 0;
+}
+/*! \fn int has_active_timer(struct simptcp_socket * sock)
+ * \brief Indique si le timer de retransmission associe a un socket simpTCP est actif ou pas
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return 1 si timer actif, 0 sinon
+ */
+int has_active_timer(struct simptcp_socket * sock)
+{
+    return simptcp_timer_pending(&(sock->timers[SIMPTCP_TIMER_RTO]));
+}
+
+/*! \fn int getTimeoutDuration(struct simptcp_socket * sock)
+ * \brief Obtient la durée du timeout à mettre dans start timer :
+ * RTO = SRTT + max(G, 4 * RTTVAR) [RFC6298], G etant la granularite de la roue
+ * de timers (1 ms), borne par rto_min et rto_max et double a chaque
+ * retransmission consecutive du premier PDU non acquitte (backoff exponentiel)
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return duree du timeout en ms
+ */
+int getTimeoutDuration(struct simptcp_socket * sock)
+{
+    double rto;
+    int i;
+
+    if (sock->rtt_samples == 0)
+        rto = sock->timer_duration;
+    else
+        rto = (sock->rtt_estimate +
+               (4 * sock->rtt_variance > 0.001 ? 4 * sock->rtt_variance : 0.001)) * 1000;
+    if (rto < sock->rto_min)
+        rto = sock->rto_min;
+    for (i = 0; (i < (unsigned char) sock->nbr_retransmit) && (rto < sock->rto_max); i++)
+        rto *= 2;
+    if (rto > sock->rto_max)
+        rto = sock->rto_max;
+    return rto;
+}
+
+/*! \fn void update_simptcp_rtt(struct simptcp_socket * sock, double rtt)
+ * \brief met a jour SRTT et RTTVAR avec une mesure de RTT (Jacobson/Karels, [RFC6298])
+ * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param rtt RTT mesure, en s
+ */
+void update_simptcp_rtt(struct simptcp_socket * sock, double rtt)
+{
+    double delta;
+
+    if (sock->rtt_samples == 0)
+    {
+        sock->rtt_estimate = rtt;
+        sock->rtt_variance = rtt / 2;
+    }
+    else
+    {
+        delta = sock->rtt_estimate - rtt;
+        sock->rtt_variance = 0.75 * sock->rtt_variance + 0.25 * (delta < 0 ? -delta : delta);
+        sock->rtt_estimate = 0.875 * sock->rtt_estimate + 0.125 * rtt;
+    }
+    sock->last_rtt = rtt;
+    sock->rtt_samples++;
+}
+
+int checkSequenceNumber(struct simptcp_socket *sock, void *buf) {
+    int seq = simptcp_get_seq_num(buf);
+    int expected = (u_int16_t) sock->next_ack_num; // numeros sur 16 bits
+    if (seq == expected) {
+        printf("Good sequence number : expected %d, got %d\n", expected, seq);
+        return 1;
+    }
+    else {
+        printf("Bad sequence number : expected %d, got %d\n", expected, seq);
+        return 0;
+    }
+}
+
+
+
+/*! \fn static void negotiate_simptcp_mss(struct simptcp_socket *sock, const char *pdu)
+ * \brief retient le plus petit du MSS local et du MSS annonce par le SYN du pair
+ * (#SIMPTCP_MAX_SIZE, celui d'Ethernet, si le pair n'annonce pas le sien)
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param pdu SYN ou SYN/ACK recu
+ */
+static void negotiate_simptcp_mss(struct simptcp_socket *sock, const char *pdu)
+{
+    struct simptcp_options options;
+    unsigned int peer_mss = SIMPTCP_MAX_SIZE;
+
+    if ((simptcp_get_options(pdu, &options) == 0) &&
+            (options.present & SIMPTCP_MSS_OPTION))
+        peer_mss = options.mss;
+    /* room left for the header options and some payload */
+    if (peer_mss < SIMPTCP_MTU_MSS(SIMPTCP_MIN_MTU))
+        peer_mss = SIMPTCP_MTU_MSS(SIMPTCP_MIN_MTU);
+    if (peer_mss < sock->mss)
+        sock->mss = peer_mss;
+}
+
+/*! \fn static unsigned char simptcp_wscale(struct simptcp_socket *sock)
+ * \brief plus petit facteur d'echelle qui permet d'annoncer la file de
+ * reception entiere dans les 16 bits du champ window_size
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return decalage a annoncer dans l'option window scale
+ */
+static unsigned char simptcp_wscale(struct simptcp_socket *sock)
+{
+    u_int32_t space = sock->receiving_window_size * sock->mss;
+    unsigned char shift = 0;
+
+    while ((shift < SIMPTCP_MAX_WSCALE) && ((space >> shift) > UINT16_MAX))
+        shift++;
+    return shift;
+}
+
+/*! \fn static void negotiate_simptcp_window(struct simptcp_socket *sock, const char *pdu)
+ * \brief retient la fenetre du SYN ou SYN/ACK du pair (jamais mise a
+ * l'echelle) et son facteur d'echelle ; les fenetres ne sont mises a
+ * l'echelle que si les deux SYN portent l'option [RFC7323]. A appeler avant
+ * #negotiate_simptcp_mss, rcv_wscale etant celui qu'annonce le SYN local.
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param pdu SYN ou SYN/ACK recu
+ */
+static void negotiate_simptcp_window(struct simptcp_socket *sock, const char *pdu)
+{
+    struct simptcp_options options;
+
+    if ((simptcp_get_options(pdu, &options) == 0) &&
+            (options.present & SIMPTCP_WSCALE_OPTION))
+    {
+        sock->wscale_ok = 1;
+        sock->snd_wscale = options.wscale;
+    }
+    else
+    {
+        sock->wscale_ok = 0;
+        sock->snd_wscale = 0;
+        sock->rcv_wscale = 0;
+    }
+    sock->snd_wnd = simptcp_get_win_size(pdu);
+}
+
+/*! \fn static int simptcp_rcv_window_update_due(struct simptcp_socket* sock)
+ * \brief mise a jour de fenetre due : l'espace libere a au moins double la
+ * fenetre annoncee (et d'un MSS, contre le syndrome de la fenetre stupide
+ * [RFC1122]) ; sans elle l'emetteur attendrait sa sonde de persistance
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \return 1 si un ACK doit annoncer la nouvelle fenetre, 0 sinon
+ */
+static int simptcp_rcv_window_update_due(struct simptcp_socket* sock)
+{
+    u_int32_t space = simptcp_rcv_space(sock);
+
+    return (space >= 2 * sock->rcv_wnd) && (space - sock->rcv_wnd >= sock->mss);
+}
+
+/*! \fn ssize_t recv_simptcp_in_queue(struct simptcp_socket* sock, void *buf, size_t n)
+ * \brief delivre a l'application le plus ancien message de la file de
+ * reception : ses fragments sont copies dans buf au fil de leur arrivee (sans
+ * copie intermediaire), en attendant le dernier tant que la connexion est
+ * etablie. Si buf est plus court que le message, la suite est delivree par
+ * les appels suivants. La file est un anneau dont ce thread est le seul
+ * consommateur : le socket n'est verrouille que pour attendre l'entite ou
+ * annoncer la fenetre.
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param [out] buf  pointeur sur le message recu
+ * \param n taille en octet de buf
+ * \return taille en octet du message recu, 0 si la connexion est fermee par le pair
+ */
+static ssize_t recv_simptcp_in_queue(struct simptcp_socket* sock, void *buf, size_t n)
+{
+    struct simptcp_queued_pdu *queued;
+    int hlen, length, last;
+    size_t copied = 0;
+
+    for (;;)
+    {
+        if ((queued = simptcp_ring_peek(&(sock->in_queue))) == NULL)
+        {
+            // Anneau vide : l'entite signale chaque PDU, socket verrouille.
+            lock_simptcp_socket(sock);
+            while (((queued = simptcp_ring_peek(&(sock->in_queue))) == NULL) &&
+                    (sock->socket_state == &(simptcp_entity.simptcp_socket_states->established)))
+                wait_simptcp_socket(sock);
+            unlock_simptcp_socket(sock);
+            if (queued == NULL)
+                break;
+        }
+
+        // Quand on a un fragment => on le donne à l'user.
+        hlen = simptcp_get_head_len(queued->pdu);
+        length = queued->len - hlen - sock->in_offset;
+        last = (simptcp_get_flags(queued->pdu) & FRAG) == 0;
+        if (length > n - copied)
+        {
+            // buf plein : le reste du fragment attend le prochain appel.
+            memcpy((char *) buf + copied, queued->pdu + hlen + sock->in_offset, n - copied);
+            sock->in_offset += n - copied;
+            copied = n;
+            break;
+        }
+        memcpy((char *) buf + copied, queued->pdu + hlen + sock->in_offset, length);
+        copied += length;
+        sock->in_offset = 0;
+        simptcp_ring_pop(&(sock->in_queue));
+        if (simptcp_rcv_window_update_due(sock))
+        {
+            lock_simptcp_socket(sock);
+            if ((sock->socket_state == &(simptcp_entity.simptcp_socket_states->established)) &&
+                    simptcp_rcv_window_update_due(sock))
+                send_simptcp_ack(sock);
+            unlock_simptcp_socket(sock);
+        }
+        if (last || (copied == n))
+            break;
+    }
 
-    sock->timeout.tv_sec=t0.tv_sec + (duration/1000);
-    sock->timeout.tv_usec=t0.tv_usec + (duration %1000)*1000;
+    return copied;
 }
 
-/*! \fn void stop_timer(struct simptcp_socket * sock)
- * \brief stoppe le timer en reinitialisant le champ "timeout" de #simptcp_socket
- * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
- */
-void stop_timer(struct simptcp_socket * sock)
-{
-#if __DEBUG__
-    printf("function %s called\n", __func__);
-#endif
-    assert(sock!=NULL);
-    sock->timeout.tv_sec=0;
-    sock->timeout.tv_usec=0;
-}
 
-int resendBuffer(struct simptcp_socket *sock) {
-                                                                                                                                                                                                                                                                                                                                                                                    return 0;
-    stop_timer(sock);
-    int res = libc_sendto(simptcp_entity.udp_fd,
-                          sock->out_buffer,
-                          simptcp_get_total_len(sock->out_buffer),
-                          0,
-                          (struct sockaddr *) &(sock->remote_udp),
-                          sizeof(struct sockaddr_in));
-    if (res == -1) {
-        printf("ERROR: Sending FIN failed.\n");
-        return res;
+/*! \fn static unsigned int release_simptcp_acked(struct simptcp_socket* sock, u_int16_t ack, const struct simptcp_options* options, struct simptcp_rate_sample* rs)
+ * \brief libere de la file d'emission les PDU en vol anterieurs a ack
+ * (acquittement cumulatif) et en tire les mesures de RTT, de delai aller et
+ * de debit de livraison ; relance ou arrete le timer de retransmission
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param ack numero d'acquittement du PDU recu
+ * \param options options du PDU recu (seule l'option timestamp est lue)
+ * \param [out] rs mesures pour le controle de congestion
+ * \return nombre de PDU acquittes
+ */
+static unsigned int release_simptcp_acked(struct simptcp_socket* sock, u_int16_t ack,
+                                          const struct simptcp_options* options,
+                                          struct simptcp_rate_sample* rs)
+{
+    struct simptcp_queued_pdu *queued, *newest;
+    uint64_t prior_delivered_at = 0;
+    unsigned int i, acked, acked_bytes = 0, flight = simptcp_in_flight(sock);
+
+    // Seuls les PDU en vol peuvent etre acquittes.
+    for (i = 0, newest = NULL; i < flight; i++) {
+        queued = simptcp_queue_at(&(sock->rtx_queue), i);
+        if (simptcp_seq_cmp(queued->seq, ack) >= 0)
+            break;
+        newest = queued;
+        acked_bytes += queued->len - simptcp_get_head_len(queued->pdu);
     }
-    start_timer(sock, getTimeoutDuration(sock));
-
-    return 0;
+    acked = i;
+    memset(rs, 0, sizeof(*rs));
+    if (newest != NULL) {
+        // La date d'emission renvoyee par le recepteur donne une mesure de
+        // RTT, meme pour un PDU retransmis ; sans elle, regle de Karn :
+        // seul l'acquittement d'un PDU jamais retransmis est une mesure sure.
+        if (options->present & SIMPTCP_TS_OPTION)
+            rs->rtt = (u_int32_t) ((u_int32_t) simptcp_timer_now_us() - options->ts_ecr) / 1e6;
+        else if (!newest->retransmitted)
+            rs->rtt = (simptcp_timer_now_us() - newest->sent_at) / 1e6;
+        if (rs->rtt > 0)
+            update_simptcp_rtt(sock, rs->rtt);
+        rs->prior_delivered = newest->delivered;
+        prior_delivered_at = newest->delivered_at;
+    }
+    // Delai aller : date d'emission de l'ACK (horloge du recepteur) moins
+    // celle du PDU qu'il acquitte (horloge locale).
+    if (options->present & SIMPTCP_TS_OPTION) {
+        rs->owd = (int32_t) (options->ts_val - options->ts_ecr) / 1e6;
+        rs->owd_valid = 1;
+    }
+    // Acquittement cumulatif : libere tous les PDU anterieurs a ack_num.
+    for (i = 0; i < acked; i++)
+        simptcp_queue_pop(&(sock->rtx_queue));
+    sock->rtx_bytes -= acked_bytes;
+    // Fenetre rouverte : fin des sondes de persistance.
+    if (sock->snd_wnd >= sock->rtx_bytes + sock->mss) {
+        sock->persist_backoff = 0;
+        stop_simptcp_timer(sock, SIMPTCP_TIMER_PERSIST);
+    }
+    if (acked > 0) {
+        // Debit de livraison : PDU livres depuis l'envoi du plus recent
+        // PDU acquitte, rapportes a la duree ecoulee depuis.
+        rs->acked = acked;
+        sock->delivered += acked;
+        sock->delivered_at = simptcp_timer_now_us();
+        rs->delivered = sock->delivered - rs->prior_delivered;
+        rs->interval_us = sock->delivered_at - prior_delivered_at;
+        sock->nbr_retransmit = 0;
+        sock->sending_window_base = ack;
+        if (simptcp_in_flight(sock) == 0)
+            stop_timer(sock);
+        else
+            start_timer(sock, getTimeoutDuration(sock));
+    }
+    return acked;
 }
-/*! \fn int has_active_timer(struct simptcp_socket * sock)
- * \brief Indique si le timer associe a un socket simpTCP est actif ou pas
- * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
- * \return 1 si timer actif, 0 sinon
+
+/*! \fn static void process_simptcp_ack(struct simptcp_socket* sock, void* buf, int len)
+ * \brief partie emission du traitement d'un PDU portant le flag ACK (ACK seul
+ * ou PDU de donnees du pair) : fenetre du pair, liberation des PDU acquittes
+ * de la file d'emission, mesures de RTT et de debit, fast retransmit. Les PDU
+ * que les fenetres liberees permettent sont emis par l'appelant, apres le
+ * traitement des donnees du PDU dont ils porteront l'acquittement.
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param buf pointeur sur le PDU simpTCP recu
+ * \param len taille en octets du PDU recu
  */
-int has_active_timer(struct simptcp_socket * sock)
+static void process_simptcp_ack(struct simptcp_socket* sock, void* buf, int len)
 {
-    return (sock->timeout.tv_sec!=0) || (sock->timeout.tv_usec!=0);
+    u_int16_t seq = simptcp_get_seq_num(buf);
+    u_int16_t ack = simptcp_get_ack_num(buf);
+    struct simptcp_queued_pdu *queued;
+    struct simptcp_options options;
+    struct simptcp_rate_sample rs;
+    unsigned int i, acked, flight = simptcp_in_flight(sock);
+    u_int32_t prior_wnd = sock->snd_wnd;
+    int block, dupack = 0;
+
+    // Seul le PDU le plus recent met a jour la fenetre [RFC793] : numero de
+    // sequence plus grand, ou egal (un ACK seul ne le consomme pas) avec un
+    // acquittement au moins aussi avance.
+    if ((simptcp_seq_cmp(seq, sock->snd_wl1) > 0) ||
+            ((seq == sock->snd_wl1) && (simptcp_seq_cmp(ack, sock->snd_wl2) >= 0))) {
+        sock->snd_wnd = (u_int32_t) simptcp_get_win_size(buf) << sock->snd_wscale;
+        sock->snd_wl1 = seq;
+        sock->snd_wl2 = ack;
+    }
+    if ((simptcp_get_head_len(buf) == SIMPTCP_GHEADER_SIZE) ||
+            (simptcp_get_options(buf, &options) < 0))
+        options.present = 0;
+    // ts_ecr nul : le pair n'avait aucune date a renvoyer.
+    if ((options.present & SIMPTCP_TS_OPTION) && (options.ts_ecr == 0))
+        options.present &= ~SIMPTCP_TS_OPTION;
+    acked = release_simptcp_acked(sock, ack, &options, &rs);
+    // Tableau des SACK : les PDU deja recus ne seront pas retransmis.
+    if (options.present & SIMPTCP_SACK_OPTION) {
+        for (i = 0; i < simptcp_in_flight(sock); i++) {
+            queued = simptcp_queue_at(&(sock->rtx_queue), i);
+            for (block = 0; block < options.sack_blocks; block++)
+                if ((simptcp_seq_cmp(queued->seq, options.sack[block][0]) >= 0) &&
+                        (simptcp_seq_cmp(queued->seq, options.sack[block][1]) < 0))
+                    queued->sacked = 1;
+        }
+    }
+    // Fast retransmit [RFC5681] : le PDU attendu par le recepteur est
+    // re-emis apres SIMPTCP_DUPACK_THRESHOLD ACK dupliques, sans attendre le
+    // timer ; fast recovery [RFC6582] : chaque acquittement partiel revele
+    // la perte du PDU suivant, re-emis a son tour, jusqu'a l'acquittement
+    // de tous les PDU emis avant la detection de la perte.
+    if (acked > 0) {
+        sock->dupacks = 0;
+        if (sock->fast_recovery) {
+            if (simptcp_seq_cmp(ack, sock->recover) > 0)
+                sock->fast_recovery = 0;
+            else
+                fast_retransmit_simptcp_pdu(sock);
+        }
+    }
+    // Un ACK qui change la fenetre est une mise a jour, pas un doublon.
+    else if ((flight > 0) && (sock->snd_wnd == prior_wnd) &&
+             (simptcp_get_head_len(buf) == simptcp_get_total_len(buf)) &&
+             (simptcp_seq_cmp(ack,
+                              simptcp_queue_at(&(sock->rtx_queue), 0)->seq) == 0)) {
+        sock->simptcp_dupack_count++;
+        dupack = 1;
+        if ((sock->dupacks < SIMPTCP_DUPACK_THRESHOLD) &&
+                (++sock->dupacks == SIMPTCP_DUPACK_THRESHOLD) &&
+                !sock->fast_recovery) {
+#if __DEBUG__
+            printf("***** FAST RETRANSMIT: SEQ=%d\n", ack);
+#endif
+            sock->fast_recovery = 1;
+            sock->recover = simptcp_queue_at(&(sock->rtx_queue), flight - 1)->seq;
+            sock->simptcp_fast_recovery_count++;
+            // La fenetre de congestion tient compte des ACK dupliques recus.
+            sock->cc->on_loss(sock);
+            dupack = 0;
+            fast_retransmit_simptcp_pdu(sock);
+        }
+    }
+    if ((acked > 0) || dupack)
+        sock->cc->on_ack(sock, &rs);
 }
 
-/*! \fn int is_timeout(struct simptcp_socket * sock)
- * \brief Indique si la duree mesuree par le timer associe a un socket simpTCP est actifs'est ecoulee ou pas
- * \param sock  pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
- * \return 1 si duree ecoulee, 0 sinon
+/*! \fn static void process_simptcp_data(struct simptcp_socket* sock, void* buf, int len)
+ * \brief partie reception du traitement d'un PDU de donnees ou d'un FIN :
+ * file de reception (ou de reordonnancement s'il est hors sequence) et
+ * acquittement, immediat ou retarde
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP
+ * \param buf pointeur sur le PDU simpTCP recu
+ * \param len taille en octets du PDU recu
  */
-int is_timeout(struct simptcp_socket * sock)
+static void process_simptcp_data(struct simptcp_socket* sock, void* buf, int len)
 {
-    struct timeval t0;
+    int seq = simptcp_get_seq_num(buf);
+    int expected = (u_int16_t) sock->next_ack_num; // numeros sur 16 bits
+    struct simptcp_queued_pdu *queued;
+    struct simptcp_options options;
 
-    assert(sock!=NULL);
-    /* make sure that the timer is launched */
-    assert(has_active_timer(sock));
+#if __DEBUG__
+    printf("***** PKT RECU: SEQ=%d, ACK=%d\n", simptcp_get_seq_num(buf), simptcp_get_ack_num(buf));
+#endif
 
-    gettimeofday(&t0, NULL);
-    return ((sock->timeout.tv_sec < t0.tv_sec) ||
-            ( (sock->timeout.tv_sec == t0.tv_sec) && (sock->timeout.tv_usec < t0.tv_usec)));
+    if (seq != expected) {
+        // Hors sequence (perte ou doublon) : on rappelle le prochain PDU attendu.
+#if __DEBUG__
+        printf("Bad sequence number : expected %d, got %d\n", expected, seq);
+#endif
+        sock->simptcp_in_errors_count++;
+        // Selective repeat : le PDU est conserve jusqu'a l'arrivee des precedents.
+        if (sock->sack && (simptcp_seq_cmp(seq, expected) > 0) &&
+                ((simptcp_get_flags(buf) & FIN) == 0) &&
+                ((sock->ooo_buffer.slots != NULL) ||
+                 (simptcp_reorder_init(&(sock->ooo_buffer), sock->receiving_window_size,
+                                       SIMPTCP_GHEADER_SIZE + sock->mss) == 0)))
+            simptcp_reorder_store(&(sock->ooo_buffer), (u_int16_t) (seq - expected),
+                                  buf, len, seq);
+        // Perte probable : ACK immediat, et pour les PDU qui suivent.
+        sock->quickack = SIMPTCP_QUICKACKS;
+        send_simptcp_ack(sock);
+        return;
+    }
+    // Date d'emission renvoyee dans les ACK : celle du plus ancien PDU en
+    // sequence non acquitte, pour que le RTT mesure inclue le delai d'ACK [RFC7323].
+    if ((sock->delack_pending == 0) &&
+            (simptcp_get_head_len(buf) > SIMPTCP_GHEADER_SIZE) &&
+            (simptcp_get_options(buf, &options) == 0) &&
+            (options.present & SIMPTCP_TS_OPTION)) {
+        sock->ts_recent = options.ts_val;
+        sock->ts_recent_valid = 1;
+    }
+    if ((simptcp_get_flags(buf) & FIN) == FIN) {
+        // Si le paquet est un FIN => on passe dans l'état closewait.
+        sock->next_ack_num++;
+        send_simptcp_ack(sock);
+        sock->socket_state = &(simptcp_entity.simptcp_socket_states->closewait);
+        return;
+    }
+    // Stockage du PDU dans la file de reception ; s'il n'y a plus de place
+    // il est ignore et sera retransmis par l'emetteur.
+    if ((sock->in_queue.slots == NULL) &&
+            (simptcp_ring_init(&(sock->in_queue), sock->receiving_window_size,
+                                SIMPTCP_GHEADER_SIZE + sock->mss) < 0))
+        return;
+    if (!simptcp_ring_push(&(sock->in_queue), buf, len, seq)) {
+#if __DEBUG__
+        printf("Receive queue full, PDU %d dropped\n", seq);
+#endif
+        return;
+    }
+    sock->next_ack_num++;
+    sock->delack_pending++;
+    simptcp_reorder_advance(&(sock->ooo_buffer));
+    // Les PDU suivants deja recus hors sequence sont maintenant en sequence.
+    while (((queued = simptcp_reorder_first(&(sock->ooo_buffer))) != NULL) &&
+            simptcp_ring_push(&(sock->in_queue), queued->pdu, queued->len, queued->seq)) {
+        sock->next_ack_num++;
+        sock->delack_pending++;
+        simptcp_reorder_advance(&(sock->ooo_buffer));
+    }
+    sock->receiving_window_base = sock->next_ack_num - 1;
+    // ACK retarde [RFC1122] : un ACK pour deux PDU en sequence, ou a
+    // l'expiration du timer ; immediat en mode quick-ack (ouverture de la
+    // connexion, pertes) et tant que des PDU hors sequence restent a signaler.
+    if ((sock->delack_timeout == 0) || (sock->quickack > 0) ||
+            (sock->delack_pending >= 2) || (sock->ooo_buffer.count > 0)) {
+        if (sock->quickack > 0)
+            sock->quickack--;
+        send_simptcp_ack(sock);
+#if __DEBUG__
+        printf("***** ACK SENT: SEQ=%d, ACK=%d\n", sock->next_seq_num + 1, sock->next_ack_num);
+#endif
+    }
+    else if (!simptcp_timer_pending(&(sock->timers[SIMPTCP_TIMER_DELACK])))
+        start_simptcp_timer(sock, SIMPTCP_TIMER_DELACK, sock->delack_timeout);
 }
 
-/*
- * Obtient la durée du timeout à mettre dans start timer.
+/*! \fn int simptcp_fast_path(struct simptcp_socket* sock, char* pdu, int len)
+ * \brief prediction d'en-tete [Jacobson 1990] : dans l'etat "established",
+ * le PDU attendu (numero de sequence next_ack_num, flags ACK et
+ * eventuellement FRAG, fenetre inchangee, au plus l'option timestamp, ni
+ * recuperation de perte ni PDU hors sequence en attente) est soit un ACK seul
+ * qui fait avancer l'acquittement, soit un PDU de donnees qui tient dans la
+ * file de reception. Il est alors traite en ligne droite, sans passer par
+ * l'automate ni decoder les options ; les autres PDU sont laisses a
+ * l'automate sans qu'aucune variable du socket n'ait change.
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) du socket simpTCP (verrouille)
+ * \param pdu pointeur sur le PDU simpTCP recu (checksum verifie)
+ * \param len taille en octets du PDU recu
+ * \return 1 si le PDU a ete traite, 0 s'il doit passer par l'automate
  */
-int getTimeoutDuration(struct simptcp_socket * sock)
+int simptcp_fast_path(struct simptcp_socket* sock, char* pdu, int len)
 {
-    return sock->rtt_estimate * 4 * 1000;
-}
-
-int checkSequenceNumber(struct simptcp_socket *sock, void *buf) {
-    int seq = simptcp_get_seq_num(buf);
-    int expected = sock->next_ack_num;
-    if (seq == expected) {
-        printf("Good sequence number : expected %d, got %d\n", expected, seq);
-        return 1;
+    const simptcp_generic_header *header = (const simptcp_generic_header *) pdu;
+    const simptcp_option_header *option;
+    struct simptcp_options options;
+    struct simptcp_rate_sample rs;
+    u_int16_t seq, ack;
+    int payload, advance;
+
+    if ((sock->socket_state != &(simptcp_entity.simptcp_socket_states->established)) ||
+            ((header->flags & ~FRAG) != ACK) || sock->fast_recovery ||
+            (sock->ooo_buffer.count > 0))
+        return 0;
+    seq = ntohs(header->seq_num);
+    if ((seq != (u_int16_t) sock->next_ack_num) ||
+            (((u_int32_t) ntohs(header->window_size) << sock->snd_wscale) != sock->snd_wnd))
+        return 0;
+    // Seule l'option timestamp est lue, directement a sa place.
+    options.present = 0;
+    if (header->header_len == SIMPTCP_GHEADER_SIZE + SIMPTCP_TS_OPTION_SIZE) {
+        option = (const simptcp_option_header *) (pdu + SIMPTCP_GHEADER_SIZE);
+        if ((option->option_kind != SIMPTCP_TS_OPTION) ||
+                (option->option_len != 2 * sizeof(u_int32_t)))
+            return 0;
+        memcpy(&(options.ts_val), option + 1, sizeof(u_int32_t));
+        memcpy(&(options.ts_ecr), (const char *) (option + 1) + sizeof(u_int32_t),
+               sizeof(u_int32_t));
+        options.ts_val = ntohl(options.ts_val);
+        options.ts_ecr = ntohl(options.ts_ecr);
+        options.present = SIMPTCP_TS_OPTION;
     }
-    else {
-        printf("Bad sequence number : expected %d, got %d\n", expected, seq);
+    else if (header->header_len != SIMPTCP_GHEADER_SIZE)
+        return 0;
+    ack = ntohs(header->ack_num);
+    payload = ntohs(header->total_len) - header->header_len;
+    advance = (simptcp_in_flight(sock) > 0) &&
+              (simptcp_seq_cmp(ack, simptcp_queue_at(&(sock->rtx_queue), 0)->seq) > 0);
+    // ACK seul : prevu s'il acquitte de nouveaux PDU (les doublons et mises
+    // a jour de fenetre passent par l'automate) ; donnees : prevues si la
+    // file de reception les accepte.
+    if ((payload == 0) ? !advance : !simptcp_ring_push(&(sock->in_queue), pdu, len, seq))
         return 0;
+    if (payload > 0) {
+        if ((sock->delack_pending == 0) && (options.present & SIMPTCP_TS_OPTION)) {
+            sock->ts_recent = options.ts_val;
+            sock->ts_recent_valid = 1;
+        }
+        sock->next_ack_num++;
+        sock->delack_pending++;
+        simptcp_reorder_advance(&(sock->ooo_buffer));
+        sock->receiving_window_base = sock->next_ack_num - 1;
+    }
+    if ((simptcp_seq_cmp(seq, sock->snd_wl1) > 0) ||
+            ((seq == sock->snd_wl1) && (simptcp_seq_cmp(ack, sock->snd_wl2) >= 0))) {
+        sock->snd_wl1 = seq;
+        sock->snd_wl2 = ack;
     }
+    if (advance) {
+        // ts_ecr nul : le pair n'avait aucune date a renvoyer.
+        if ((options.present & SIMPTCP_TS_OPTION) && (options.ts_ecr == 0))
+            options.present &= ~SIMPTCP_TS_OPTION;
+        release_simptcp_acked(sock, ack, &options, &rs);
+        sock->dupacks = 0;
+        sock->cc->on_ack(sock, &rs);
+    }
+    if (payload > 0) {
+        if ((sock->delack_timeout == 0) || (sock->quickack > 0) ||
+                (sock->delack_pending >= 2)) {
+            if (sock->quickack > 0)
+                sock->quickack--;
+            send_simptcp_ack(sock);
+        }
+        else if (!simptcp_timer_pending(&(sock->timers[SIMPTCP_TIMER_DELACK])))
+            start_simptcp_timer(sock, SIMPTCP_TIMER_DELACK, sock->delack_timeout);
+    }
+    simptcp_pacing_output(sock);
+    return 1;
 }
 
-
-
 /*** socket state dependent functions ***/
 
 
@@ -387,9 +2008,11 @@ int closed_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struc
     if(len != sizeof(struct sockaddr_in))
         printf("bad address size\n");
 
+    lock_simptcp_socket(sock);
     sock->remote_simptcp = *((struct sockaddr_in *)addr);
     sock->remote_udp = *((struct sockaddr_in *)addr);
     sock->socket_type = client;
+    simptcp_demux_insert_connection(sock);
     // Numéro de séquence du premier pdu
     // Next seq num devra être incrémenté à la réception
     // du pdu ack. 
@@ -397,13 +2020,21 @@ int closed_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struc
 
     printf("***** SYN; SEQ=%d, ACK=%d\n", sock->next_seq_num, sock->next_ack_num);
 
-    char* pdu = simptcp_make_pdu(&sock->local_simptcp,
+    // Le SYN annonce le MSS local et le facteur d'echelle de la fenetre.
+    struct simptcp_options options;
+    sock->rcv_wscale = simptcp_wscale(sock);
+    options.present = SIMPTCP_MSS_OPTION | SIMPTCP_WSCALE_OPTION;
+    options.mss = sock->mss;
+    options.wscale = sock->rcv_wscale;
+    char* pdu = simptcp_make_pdu_with_options(&sock->local_simptcp,
                              &sock->remote_simptcp,
                              NULL, // payload
                              0, // len
                              sock->next_seq_num, // seq
                              0, // ack
-                             SYN);
+                             SYN,
+                             &options);
+    set_simptcp_window(sock, pdu);
 
     // Copie le pdu dans le out buffer.
     memcpy(sock->out_buffer, pdu, simptcp_get_total_len(pdu));
@@ -414,12 +2045,7 @@ int closed_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struc
 		
     free(pdu);
 
-    int res = libc_sendto(simptcp_entity.udp_fd,
-                     sock->out_buffer,
-                     simptcp_get_total_len(sock->out_buffer),
-                     0,
-                     (struct sockaddr*) &(sock->remote_udp),
-                     sizeof(struct sockaddr_in));
+    int res = send_out_buffer(sock);
     
     
 
@@ -432,7 +2058,18 @@ int closed_simptcp_socket_state_active_open (struct  simptcp_socket* sock, struc
         printf("sendto: success\n");
         start_timer(sock, getTimeoutDuration(sock));
         sock->socket_state = &(simptcp_entity.simptcp_socket_states->synsent);
+
+        // On attend la fin de l'ouverture de connexion (SYN/ACK recu ou echec).
+        while (sock->socket_state == &(simptcp_entity.simptcp_socket_states->synsent))
+            wait_simptcp_socket(sock);
+        if (sock->socket_state != &(simptcp_entity.simptcp_socket_states->established))
+        {
+            unlock_simptcp_socket(sock);
+            errno = ECONNREFUSED;
+            return -1;
+        }
     }
+    unlock_simptcp_socket(sock);
     return 0;
 }
 
@@ -451,6 +2088,7 @@ int closed_simptcp_socket_state_passive_open (struct simptcp_socket* sock, int n
 		// On passe à l'état listen.
 		sock->socket_state = &(simptcp_entity.simptcp_socket_states->listen);
         sock->socket_type = listening_server;
+        simptcp_demux_insert_listener(sock);
         sock->pending_conn_req = 0;
         sock->max_conn_req_backlog = n;
 
@@ -638,37 +2276,58 @@ int listen_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sock
 #endif
 
     // On attend tant qu'aucune connexion entrante n'est détectée.
+    lock_simptcp_socket(sock);
     while(sock->pending_conn_req == 0) 
-        usleep(100);
+        wait_simptcp_socket(sock);
     // On récupère le socket à traiter.
     // #OnEstPasMalins : pending_conn_req - 1 !!!! sinon segfault.
     struct simptcp_socket * conn_req = sock->new_conn_req[sock->pending_conn_req - 1];
     memcpy(addr, &conn_req->remote_simptcp, sizeof(struct sockaddr_in));
+    // MSS annonce par le SYN/ACK : celui du socket d'ecoute.
+    unsigned int mss = sock->mss;
     
     sock->pending_conn_req--;
-    
+    unlock_simptcp_socket(sock);
 
-    // ANCHOR_ACCEPT
-    sock->next_seq_num = get_initial_seq_num();
-    printf("****** SEND SYN/ACK : SEQ=%d, ACK=%d\n", sock->next_seq_num, sock->next_ack_num);
+    // Le fils est verrouille jusqu'a son passage en synrcvd : l'ACK du
+    // client ne peut pas etre traite avant.
+    lock_simptcp_socket(conn_req);
 
-    // On a reçu un syn => on renvoie un syn ack
-    char* pdu = simptcp_make_pdu(&sock->local_simptcp,
-                                         &sock->remote_simptcp,
+    // ANCHOR_ACCEPT
+    // Le SYN/ACK est construit, emis et re-emis par le fils, avec l'adresse
+    // et le numero d'acquittement memorises a la reception de son SYN : le
+    // socket d'ecoute sert d'autres clients pendant ce temps. Les donnees du
+    // fils suivront son SYN/ACK. // ANCHOR_B
+    conn_req->next_seq_num = get_initial_seq_num();
+    printf("****** SEND SYN/ACK : SEQ=%d, ACK=%d\n", conn_req->next_seq_num, conn_req->next_ack_num);
+
+    // On a reçu un syn => on renvoie un syn ack, qui annonce le MSS local
+    // et, si le SYN portait l'option, le facteur d'echelle de la fenetre.
+    struct simptcp_options options;
+    options.present = SIMPTCP_MSS_OPTION;
+    options.mss = mss;
+    if (conn_req->wscale_ok) {
+        options.present |= SIMPTCP_WSCALE_OPTION;
+        options.wscale = conn_req->rcv_wscale;
+    }
+    char* pdu = simptcp_make_pdu_with_options(&conn_req->local_simptcp,
+                                         &conn_req->remote_simptcp,
                                          NULL, // payload
                                          0, // len
-                                         sock->next_seq_num, // seq
-                                         sock->next_ack_num, // ack
-                                         ACK | SYN);
+                                         conn_req->next_seq_num, // seq
+                                         conn_req->next_ack_num, // ack
+                                         ACK | SYN,
+                                         &options);
+    set_simptcp_window(conn_req, pdu);
     
 	// Copie le pdu dans le out buffer.
-    memcpy(sock->out_buffer, pdu, simptcp_get_total_len(pdu));
+    memcpy(conn_req->out_buffer, pdu, simptcp_get_total_len(pdu));
+
+    // Le timer du fils re-emet le SYN/ACK dans l'etat synrcvd.
+    conn_req->socket_state = &(simptcp_entity.simptcp_socket_states->synrcvd);
 
 	// Envoie le pdu
-	int res = sendto(simptcp_entity.udp_fd, sock->out_buffer,
-				simptcp_get_total_len(sock->out_buffer), 0,
-				(struct sockaddr*) &(sock->remote_udp),
-				sizeof(struct sockaddr_in));
+	int res = send_out_buffer(conn_req);
 
 	free(pdu);
     
@@ -676,34 +2335,23 @@ int listen_simptcp_socket_state_accept (struct simptcp_socket* sock, struct sock
 	if (res == -1)
     {
         printf("Echec de l'envoi !!!!\n");
+        unlock_simptcp_socket(conn_req);
 		return -1;
     }
 
 	// Lance le timer.
-    start_timer(sock, getTimeoutDuration(sock));
+    start_timer(conn_req, getTimeoutDuration(conn_req));
 	
     
-    // Recherche du file descriptor
-    int newfd = -1;
-    int fd;
-    for (fd=0; fd< MAX_OPEN_SOCK; fd++)
-    {
-        if (conn_req==simptcp_entity.simptcp_socket_descriptors[fd])
-            newfd = fd;
-    }
-
-    // On update le numéro d'ack du socket fils. // ANCHOR_B
-    struct simptcp_socket *newsock = simptcp_entity.simptcp_socket_descriptors[newfd];
-    newsock->next_ack_num = sock->next_ack_num;
-    printf("MON FILS TU AS SEQ=%d, ACK=%d\n", newsock->next_seq_num, newsock->next_ack_num);
+    // Descripteur du socket fils
+    int newfd = conn_req->fd;
 
-    //print_simptcp_socket(simptcp_entity.simptcp_socket_descriptors[newfd]);
-    conn_req->socket_state = &(simptcp_entity.simptcp_socket_states->synrcvd);
     // On attend la réception du ack, qui fera tout passer à established.
     while(conn_req->socket_state != &(simptcp_entity.simptcp_socket_states->established))
     {
-        usleep(100);
+        wait_simptcp_socket(conn_req);
     }
+    unlock_simptcp_socket(conn_req);
 
     return newfd;
 }
@@ -816,35 +2464,50 @@ void listen_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* soc
 
     if((flags & SYN) == SYN)
     {
+        // File des demandes de connexion pleine : le SYN est ignore, le
+        // client le re-emettra.
+        if (sock->pending_conn_req >= sock->max_conn_req_backlog)
+            return;
         // Réception (ICI premier SYN)
         // On crée un nouveau socket dont on obtient le fd.
         int fd = create_simptcp_socket();
-        struct simptcp_socket* newsock = simptcp_entity.simptcp_socket_descriptors[fd]; 
+        if (fd < 0)
+        {
+            // Table des descripteurs pleine : le SYN est ignore.
+            return;
+        }
+        struct simptcp_socket* newsock = get_simptcp_socket(fd);
         newsock->socket_type = nonlistening_server; 
         newsock->remote_simptcp = sock->remote_simptcp;
         newsock->local_simptcp = sock->local_simptcp;
         newsock->remote_udp = sock->remote_udp;
+        // Les options IPPROTO_SIMPTCP sont heritees du socket d'ecoute.
+        newsock->go_back_n = sock->go_back_n;
+        newsock->sending_window_size = sock->sending_window_size;
+        newsock->snd_queue_size = sock->snd_queue_size;
+        newsock->receiving_window_size = sock->receiving_window_size;
+        newsock->sack = sock->sack;
+        newsock->timestamps = sock->timestamps;
+        newsock->rto_min = sock->rto_min;
+        newsock->rto_max = sock->rto_max;
+        newsock->mss = sock->mss;
+        newsock->delack_timeout = sock->delack_timeout;
+        newsock->max_pacing_rate = sock->max_pacing_rate;
+        simptcp_cc_set(newsock, simptcp_cc_get(sock));
+        newsock->rcv_wscale = simptcp_wscale(newsock);
+        negotiate_simptcp_window(newsock, buf);
+        negotiate_simptcp_mss(newsock, buf);
+        simptcp_demux_insert_connection(newsock);
+        // Le fils garde l'adresse du pair (ci-dessus) et le numero attendu :
+        // le socket d'ecoute les perd au PDU suivant. Son numero de sequence
+        // est celui de son SYN/ACK (accept).
+        newsock->next_ack_num = simptcp_get_seq_num(buf) + 1;
         // Ajout le nouveau socket à la file des connexions et on incrémente
         // le nombre de connexions en cours.
         sock->new_conn_req[sock->pending_conn_req] = newsock;
         sock->pending_conn_req++;
-        // On met àjour les numéros de séquence du nouveau socket.
-        newsock->next_seq_num = sock->next_seq_num + 1;
-        sock->next_ack_num = simptcp_get_seq_num(buf) + 1;
 
     }
-    else if((flags & ACK) == ACK)
-    {
-        // On récupère le fils
-        struct simptcp_socket* child = sock->new_conn_req[sock->pending_conn_req];
-        child->socket_state = &(simptcp_entity.simptcp_socket_states->established);
-        child->next_ack_num++;
-        memset(&sock->remote_simptcp, 0, sizeof(struct sockaddr_in));
-
-        sock->next_seq_num = get_initial_seq_num();
-        sock->next_ack_num = 0;
-        stop_timer(sock);
-    }
 
     
 }
@@ -1029,15 +2692,18 @@ void synsent_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* so
 #endif
     }
 
-    // On copie le packet dans le in_buffer.
-    memcpy(sock->in_buffer, buf, len);
     unsigned char flags = simptcp_get_flags(buf);
 		
     if((flags & SYN) == SYN)
     {
-		// Spécifie les bons numéros d'ack etc...
+        negotiate_simptcp_window(sock, buf);
+        negotiate_simptcp_mss(sock, buf);
+		// Spécifie les bons numéros d'ack etc... : le SYN a consomme le
+		// numero que precede ack_num, l'ACK ne consomme pas le suivant.
         sock->next_ack_num = simptcp_get_seq_num(buf) + 1;
-        sock->next_seq_num = simptcp_get_ack_num(buf);
+        sock->next_seq_num = (u_int16_t) (simptcp_get_ack_num(buf) - 1);
+        sock->snd_wl1 = simptcp_get_seq_num(buf);
+        sock->snd_wl2 = simptcp_get_ack_num(buf);
 
         printf("***** ACK: ACK=%d, SEQ=%d\n", sock->next_ack_num, sock->next_seq_num);
 		// On a reçu un syn, => on renvoie un ack
@@ -1045,7 +2711,7 @@ void synsent_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* so
                                      &sock->remote_simptcp,
                                      NULL, // payload
                                      0, // len
-                                     sock->next_seq_num, // seq
+                                     sock->next_seq_num + 1, // seq
                                      sock->next_ack_num, // ack
                                      ACK);
 
@@ -1053,12 +2719,7 @@ void synsent_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* so
         memcpy(sock->out_buffer, pdu, simptcp_get_total_len(pdu));
 
         // Envoie le pdu [TODO : au fils !!]
-        int res = sendto(simptcp_entity.udp_fd,
-                         sock->out_buffer,
-                         simptcp_get_total_len(sock->out_buffer),
-                         0,
-                         (struct sockaddr*) &(sock->remote_udp),
-                         sizeof(struct sockaddr_in));
+        int res = send_out_buffer(sock);
 
         free(pdu);
 
@@ -1300,23 +2961,23 @@ void synrcvd_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* so
 
 
     // ANCHOR SYNRCVD
-    // On copie le packet dans le in_buffer.
-    memcpy(sock->in_buffer, buf, len);
     unsigned char flags = simptcp_get_flags(buf);
 		
     if((flags & ACK) == ACK)
     {
-        int ack_num = simptcp_get_seq_num(buf);
-        printf("Attendu ack=%d, obtenu ack=%d\n", sock->next_seq_num,
+        int ack_num = simptcp_get_ack_num(buf);
+        printf("Attendu ack=%d, obtenu ack=%d\n", (u_int16_t) (sock->next_seq_num + 1),
                ack_num);
 
-        if(ack_num != sock->next_seq_num)
+        // L'ACK doit acquitter notre SYN/ACK ; il ne consomme pas de numero.
+        if(ack_num != (u_int16_t) (sock->next_seq_num + 1))
         {
             return; 
         }
 
-        // Spécifie les bons numéros d'ack etc...
-        sock->next_ack_num = ack_num + 1;
+        sock->snd_wnd = (u_int32_t) simptcp_get_win_size(buf) << sock->snd_wscale;
+        sock->snd_wl1 = simptcp_get_seq_num(buf);
+        sock->snd_wl2 = ack_num;
         stop_timer(sock);
         // On a reçu un syn ack
         sock->socket_state = &(simptcp_entity.simptcp_socket_states->established);
@@ -1425,43 +3086,104 @@ ssize_t established_simptcp_socket_state_send (struct simptcp_socket* sock, cons
 #if __DEBUG__
     printf("function %s called\n", __func__);
 #endif
-    // ANCHOR SEND
-    // Envoi depuis un client
-
-    // Numéro de séquence du premier pdu
-    sock->next_seq_num++;
-
-    char *pdu = simptcp_make_pdu(&sock->local_simptcp,
-                                 &sock->remote_simptcp,
-                                 buf, // payload
-                                 n, // len
-                                 sock->next_seq_num, // seq
-                                 sock->next_ack_num, // ack
-                                 0);
-
-    // Copie le pdu dans le out buffer.
-    memcpy(sock->out_buffer, pdu, simptcp_get_total_len(pdu));
-
-    free(pdu);
-
-    int oldAckNum = sock->next_ack_num;
-    int res = libc_sendto(simptcp_entity.udp_fd,
-                          sock->out_buffer,
-                          simptcp_get_total_len(sock->out_buffer),
-                          0,
-                          (struct sockaddr *) &(sock->remote_udp),
-                          sizeof(struct sockaddr_in));
-
-    printf("***** SEND: SEQ=%d, ACK=%d\n", sock->next_seq_num, sock->next_ack_num);
+    struct simptcp_options options;
+    unsigned int size, mss, fragments;
+    size_t len, sent = 0;
+    char *pdu;
+    int res;
+
+    // Un PDU vide ne se distinguerait pas d'un ACK seul, et recv() renvoie 0
+    // a la fermeture : rien a emettre.
+    if (n == 0)
+        return 0;
+    lock_simptcp_socket(sock);
+    // Le premier envoi lance la recherche de la PMTU.
+    if (simptcp_entity.pmtu_discovery && (sock->plpmtu == 0))
+        simptcp_pmtu_start(sock);
+    /* the capacity follows SO_SNDBUF and the sending window while the queue
+       is empty */
+    size = simptcp_snd_queue_size(sock);
+    if ((sock->rtx_queue.count == 0) &&
+            ((sock->rtx_queue.slots == NULL) || (sock->rtx_queue.size != size)))
+    {
+        res = simptcp_queue_init(&(sock->rtx_queue), size,
+                                 SIMPTCP_GHEADER_SIZE + sock->mss);
+        if (res < 0)
+        {
+            unlock_simptcp_socket(sock);
+            errno = -res;
+            return -1;
+        }
+    }
+    size = sock->rtx_queue.size;
+    options.present = sock->timestamps ? SIMPTCP_TS_OPTION : 0;
+    // Sans attente, le message entre en entier dans la file ou pas du tout.
+    if (flags & MSG_DONTWAIT)
+    {
+        mss = simptcp_pmtu_mss(sock) - simptcp_options_len(&options);
+        fragments = (n + mss - 1) / mss;
+        if ((fragments > size) || (fragments > size - sock->rtx_queue.count))
+        {
+            unlock_simptcp_socket(sock);
+            errno = fragments > size ? EMSGSIZE : EAGAIN;
+            return -1;
+        }
+    }
+    // Le message est decoupe en fragments d'un MSS ; tous sauf le dernier
+    // portent le flag FRAG, tous portent l'acquittement des donnees recues
+    // (mis a jour a leur emission). Ils sont copies dans la file d'emission,
+    // que l'emission vide au rythme des fenetres et des ACK : send()
+    // n'attend que si la file est pleine.
+    do
+    {
+        while ((sock->rtx_queue.count >= size) &&
+                (sock->socket_state == &(simptcp_entity.simptcp_socket_states->established)))
+            wait_simptcp_socket(sock);
+        if (sock->socket_state != &(simptcp_entity.simptcp_socket_states->established))
+        {
+            unlock_simptcp_socket(sock);
+            errno = EPIPE;
+            return -1;
+        }
 
-    // Si le client fait plusieurs send rapidement, on attend le ack avant de lancer le prochain
-    // send.
-    while (sock->next_ack_num == oldAckNum) {
-        usleep(100);
+        // ts_val est date au depart effectif du PDU.
+        if (sock->timestamps) {
+            options.ts_val = simptcp_timer_now_us();
+            options.ts_ecr = sock->ts_recent;
+        }
+        // La PMTU a pu baisser pendant l'attente.
+        mss = simptcp_pmtu_mss(sock);
+        len = n - sent <= mss - simptcp_options_len(&options) ?
+              n - sent : mss - simptcp_options_len(&options);
+        sock->next_seq_num++;
+        pdu = simptcp_make_pdu_with_options(&sock->local_simptcp,
+                                            &sock->remote_simptcp,
+                                            (char *) buf + sent, // payload
+                                            len, // len
+                                            sock->next_seq_num, // seq
+                                            sock->next_ack_num, // ack
+                                            (sent + len < n ? FRAG : 0) | ACK,
+                                            &options);
+        if (!pdu)
+        {
+            sock->next_seq_num--;
+            unlock_simptcp_socket(sock);
+            errno = ENOMEM;
+            return -1;
+        }
+        // Copie du PDU dans la file d'emission jusqu'a son acquittement ; il
+        // part aussitot si les fenetres et le cadencement le permettent.
+        simptcp_queue_push(&(sock->rtx_queue), pdu, simptcp_get_total_len(pdu),
+                           sock->next_seq_num);
+        free(pdu);
+        sock->snd_unsent++;
+        simptcp_pacing_output(sock);
+        sent += len;
     }
+    while (sent < n);
+    unlock_simptcp_socket(sock);
 
-    printf("***** OUT OF SEND. \n");
-    return 0;
+    return n;
 }
 /**
  * called when application calls recv
@@ -1480,21 +3202,7 @@ ssize_t established_simptcp_socket_state_recv (struct simptcp_socket* sock, void
 #if __DEBUG__
     printf("function %s called\n", __func__);
 #endif
-    // Attente de réception du paquet.
-    while (sock->in_len == 0) {
-        usleep(100);
-    }
-
-    // Quand on a un paquet => on le donne à l'user.
-    int hlen = simptcp_get_head_len(sock->in_buffer);
-    int length = sock->in_len - hlen;
-    length = length <= n ? length : n;
-
-    memcpy(buf, (sock->in_buffer + hlen), length);
-
-    sock->in_len = 0;
-
-    return length;
+    return recv_simptcp_in_queue(sock, buf, n);
 }
 
 /**
@@ -1535,23 +3243,26 @@ int established_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int
     // ANCHOR CLOSE
 
     // On suppose que c'est le client qui ferme la connexion.
+    lock_simptcp_socket(sock);
     if (sock->socket_type == nonlistening_server) {
         printf("***** WAITING FOR FIN FROM CLIENT. \n");
         while (sock->socket_state != &(simptcp_entity.simptcp_socket_states->closewait)) {
-            usleep(500);
+            wait_simptcp_socket(sock);
         }
         printf("***** CLOSE CALL DONE GO YO LAST ACK. \n");
-        sock->socket_state = &(simptcp_entity.simptcp_socket_states->closewait);
-        closewait_simptcp_socket_state_shutdown(sock, how);
-
-        // On attend le dernier ack
-        while (sock->socket_state != &(simptcp_entity.simptcp_socket_states->closed)) {
-            usleep(500);
-        }
-        return 0;
+        unlock_simptcp_socket(sock);
+        return closewait_simptcp_socket_state_shutdown(sock, how);
     }
     else if (sock->socket_type == client) {
-        // Incrémentation du seq number
+        // Les donnees en vol doivent etre acquittees avant le FIN.
+        while ((sock->rtx_queue.count > 0) &&
+                (sock->socket_state == &(simptcp_entity.simptcp_socket_states->established)))
+            wait_simptcp_socket(sock);
+        if (sock->socket_state != &(simptcp_entity.simptcp_socket_states->established)) {
+            unlock_simptcp_socket(sock);
+            return -1;
+        }
+        // Incrémentation du seq number : le FIN consomme un numero.
         sock->next_seq_num++;
         // On a reçu un syn, => on renvoie un ack
         char *pdu = simptcp_make_pdu(&sock->local_simptcp,
@@ -1560,34 +3271,34 @@ int established_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int
                                      0, // len
                                      sock->next_seq_num, // seq
                                      sock->next_ack_num, // ack
-                                     FIN);
+                                     FIN | ACK);
 
 
         // Copie le pdu dans le out buffer.
         memcpy(sock->out_buffer, pdu, simptcp_get_total_len(pdu));
 
         // Envoie le pdu
-        int res = sendto(simptcp_entity.udp_fd,
-                         sock->out_buffer,
-                         simptcp_get_total_len(sock->out_buffer),
-                         0,
-                         (struct sockaddr *) &(sock->remote_udp),
-                         sizeof(struct sockaddr_in));
+        int res = send_out_buffer(sock);
+
+        free(pdu);
 
         // Gestion de l'erreur.
-        if (res == -1)
+        if (res == -1) {
+            unlock_simptcp_socket(sock);
             return -1;
-
-        free(pdu);
+        }
 
 
+        // Le FIN est re-emis tant qu'il n'est pas acquitte.
+        start_timer(sock, getTimeoutDuration(sock));
         sock->socket_state = &(simptcp_entity.simptcp_socket_states->finwait1);
         printf("***** FIN SENT | WAITING FOR END OF PROTOCOL TO EXIT FUNCTION. \n");
         while (sock->socket_state != &(simptcp_entity.simptcp_socket_states->closed)) {
-            usleep(500);
+            wait_simptcp_socket(sock);
         }
         printf("***** SOCKET CLOSED PROPERLY !!\n");
     }
+    unlock_simptcp_socket(sock);
     return 0;
 
 }
@@ -1611,77 +3322,23 @@ void established_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket
     printf("function %s called\n", __func__);
 #endif
     // ANCHOR PROCESS
+    unsigned char flags = simptcp_get_flags(buf);
 
-    int seq = simptcp_get_seq_num(buf);
-    int expected = sock->next_ack_num;
-
-    if (sock->socket_type == nonlistening_server) {
-        printf("***** PKT RECU: SEQ=%d, ACK=%d\n", simptcp_get_seq_num(buf), simptcp_get_ack_num(buf));
-
-        if (seq == expected) {
-            sock->next_ack_num++;
-            printf("Good sequence number : expected %d, got %d\n", expected, seq);
-            // Cas où on reçoit un paquet
-            // 1. On stocke le paquet dans le in buffer.
-            int length = len < SIMPTCP_SOCKET_MAX_BUFFER_SIZE ? len : MAX_SIMPTCP_BUFFER_SIZE;
-            memcpy(sock->in_buffer, buf, length);
-            sock->in_len = len;
-
-            // 2. on renvoie un ack.
-            char *pdu = simptcp_make_pdu(&sock->local_simptcp,
-                                         &sock->remote_simptcp,
-                                         NULL, // payload
-                                         0, // len
-                                         sock->next_seq_num, // seq
-                                         sock->next_ack_num, // ack
-                                         ACK);
-
-            // Copie le pdu dans le out buffer.
-            memcpy(sock->out_buffer, pdu, simptcp_get_total_len(pdu));
-
-            free(pdu);
-
-            int res = libc_sendto(simptcp_entity.udp_fd,
-                                  sock->out_buffer,
-                                  simptcp_get_total_len(sock->out_buffer),
-                                  0,
-                                  (struct sockaddr *) &(sock->remote_udp),
-                                  sizeof(struct sockaddr_in));
-
-            printf("***** ACK SENT: SEQ=%d, ACK=%d (res = %d)\n", sock->next_seq_num, sock->next_ack_num, res);
-
-            // On incrémente le prochain seq number.
-            sock->next_seq_num++;
-
-            // Si le paquet est un FIN => on passe dans l'état closewait.
-            if ((simptcp_get_flags(buf) & FIN) == FIN) {
-                sock->socket_state = &(simptcp_entity.simptcp_socket_states->closewait);
-            }
-        }
-        else {
-            printf("Bad sequence number : expected %d, got %d\n", expected, seq);
-        }
-
-
-
-    }
-    else if (sock->socket_type == client) // client
-    {
-        printf("Sequence number : expected %d, got %d\n", expected, seq);
-        // Réception du ack.
-        if (seq == expected && ((simptcp_get_flags(buf) & ACK) == ACK)) {
-            sock->next_ack_num++;
-            stop_timer(sock);
-        }
-        else {
-            printf("BAD ACK\n");
-        }
-    }
-    else {
-        printf("WTF ????????????????\n");
-    }
-
-
+    // Les deux sens de transfert : l'acquittement porte par le PDU (ACK seul
+    // ou donnees du pair) libere la file d'emission, puis ses donnees vont
+    // dans la file de reception.
+    if ((flags & ACK) == ACK)
+        process_simptcp_ack(sock, buf, len);
+    if ((simptcp_get_total_len(buf) > simptcp_get_head_len(buf)) || ((flags & FIN) == FIN))
+        process_simptcp_data(sock, buf, len);
+    else if (simptcp_seq_cmp(simptcp_get_seq_num(buf), sock->next_ack_num) < 0)
+        // PDU vide de numero deja acquitte (sonde de fenetre) : l'ACK porte
+        // la fenetre courante.
+        send_simptcp_ack(sock);
+    // Place liberee dans les fenetres : les PDU en file partent, porteurs de
+    // l'acquittement des donnees recues, et send() peut en ajouter d'autres.
+    if ((flags & ACK) == ACK)
+        simptcp_pacing_output(sock);
 }
 
 /**
@@ -1699,8 +3356,22 @@ void established_simptcp_socket_state_handle_timeout (struct simptcp_socket* soc
     printf("function %s called\n", __func__);
 #endif
 
-
-    resendBuffer(sock);
+    // Go-Back-N : tous les PDU non acquittes sont re-emis.
+    if ((unsigned char) sock->nbr_retransmit >= MAX_RETRANSMIT) {
+        printf("Too many retransmissions, connection closed\n");
+        sock->socket_state = &(simptcp_entity.simptcp_socket_states->closed);
+        simptcp_demux_remove(sock);
+        return;
+    }
+    sock->nbr_retransmit++;
+    // Une fast recovery en cours est abandonnee.
+    sock->fast_recovery = 0;
+    sock->dupacks = 0;
+    sock->cc->on_rto(sock);
+    // Pertes repetees : la PMTU du chemin a peut-etre diminue.
+    if (sock->nbr_retransmit == SIMPTCP_PMTU_MAX_PROBES)
+        simptcp_pmtu_black_hole(sock);
+    retransmit_simptcp_window(sock);
 }
 
 
@@ -1806,7 +3477,8 @@ ssize_t closewait_simptcp_socket_state_recv (struct simptcp_socket* sock, void *
 #if __DEBUG__
     printf("function %s called\n", __func__);
 #endif
-    return 0;
+    // Donnees recues avant le FIN et pas encore lues.
+    return recv_simptcp_in_queue(sock, buf, n);
 
 }
 
@@ -1845,35 +3517,47 @@ int closewait_simptcp_socket_state_shutdown (struct simptcp_socket* sock, int ho
 #endif
 
     // ANCHOR CLOSEWAIT
+    lock_simptcp_socket(sock);
+    // Les donnees en file doivent etre acquittees avant le FIN.
+    while ((sock->rtx_queue.count > 0) &&
+            (sock->socket_state == &(simptcp_entity.simptcp_socket_states->closewait)))
+        wait_simptcp_socket(sock);
+    if (sock->socket_state != &(simptcp_entity.simptcp_socket_states->closewait)) {
+        unlock_simptcp_socket(sock);
+        return -1;
+    }
+    sock->next_seq_num++;
     char *pdu = simptcp_make_pdu(&sock->local_simptcp,
                                  &sock->remote_simptcp,
                                  NULL, // payload
                                  0, // len
                                  sock->next_seq_num, // seq
                                  sock->next_ack_num, // ack
-                                 FIN);
+                                 FIN | ACK);
 
     // Copie le pdu dans le out buffer.
     memcpy(sock->out_buffer, pdu, simptcp_get_total_len(pdu));
-    sock->next_seq_num++;
 
 
     free(pdu);
 
-    int res = libc_sendto(simptcp_entity.udp_fd,
-                          sock->out_buffer,
-                          simptcp_get_total_len(sock->out_buffer),
-                          0,
-                          (struct sockaddr *) &(sock->remote_udp),
-                          sizeof(struct sockaddr_in));
+    int res = send_out_buffer(sock);
 
     // Gestion de l'erreur.
-    if (res == -1)
+    if (res == -1) {
+        unlock_simptcp_socket(sock);
         return res;
+    }
 
     start_timer(sock, getTimeoutDuration(sock));
     sock->socket_state = &(simptcp_entity.simptcp_socket_states->lastack);
     printf("***** CLOSE CALL RECEIVED. GO TO LAST ACK.\n");
+
+    // On attend le dernier ack
+    while (sock->socket_state != &(simptcp_entity.simptcp_socket_states->closed)) {
+        wait_simptcp_socket(sock);
+    }
+    unlock_simptcp_socket(sock);
     return 0;
 
 }
@@ -1894,6 +3578,14 @@ void closewait_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket*
     printf("function %s called\n", __func__);
 #endif
 
+    // Le pair acquitte encore les donnees emises avant son FIN.
+    if ((simptcp_get_flags(buf) & ACK) == ACK) {
+        process_simptcp_ack(sock, buf, len);
+        simptcp_pacing_output(sock);
+    }
+    // FIN re-emis : l'ACK du FIN a ete perdu.
+    if ((simptcp_get_flags(buf) & FIN) == FIN)
+        send_simptcp_ack(sock);
 }
 
 /**
@@ -1910,7 +3602,8 @@ void closewait_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
     printf("function %s called\n", __func__);
 #endif
 
-    resendBuffer(sock);
+    // Seules des donnees emises avant le FIN du pair peuvent etre en vol.
+    established_simptcp_socket_state_handle_timeout(sock);
 }
 
 
@@ -2074,23 +3767,21 @@ void finwait1_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* s
 
     // ANCHOR FINWAIT1
     unsigned char flags = simptcp_get_flags(buf);
-    int expected = sock->next_ack_num;
-    if (simptcp_get_seq_num(buf) == expected) {
-        if ((flags & ACK) == ACK) {
-
-            // Spécifie les bons numéros d'ack etc...
-            sock->next_ack_num = simptcp_get_seq_num(buf) + 1;
-            // On a reçu un ack of fin
-            sock->socket_state = &(simptcp_entity.simptcp_socket_states->finwait2);
-            stop_timer(sock);
-            printf("***** ACK OF FIN RECEIVED\n");
-        }
-        else {
-            printf("***** UNEXPECTED PACKET IN FINWAIT1\n");
-        }
+    if (((flags & ACK) == ACK) &&
+            (simptcp_get_ack_num(buf) == (u_int16_t) (sock->next_seq_num + 1))) {
+        // On a reçu un ack of fin, seul ou porte par le FIN du pair (l'ACK
+        // seul a alors ete perdu).
+        sock->socket_state = &(simptcp_entity.simptcp_socket_states->finwait2);
+        stop_timer(sock);
+        printf("***** ACK OF FIN RECEIVED\n");
+        finwait2_simptcp_socket_state_process_simptcp_pdu(sock, buf, len);
     }
-    else {
-        printf("BAD SEQ : expected %d, got %d\n", expected, simptcp_get_seq_num(buf));
+    else if (simptcp_get_total_len(buf) > simptcp_get_head_len(buf)) {
+        // Donnees emises par le pair avant notre FIN : acquittees et ignorees.
+        finwait2_simptcp_socket_state_process_simptcp_pdu(sock, buf, len);
+    }
+    else if ((flags & ACK) == 0) {
+        printf("***** UNEXPECTED PACKET IN FINWAIT1\n");
     }
 }
 
@@ -2273,43 +3964,39 @@ void finwait2_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* s
 
     // ANCHOR FINWAIT2
     unsigned char flags = simptcp_get_flags(buf);
-    int expected = sock->next_ack_num;
-    if (simptcp_get_seq_num(buf) == expected) {
+    int expected = (u_int16_t) sock->next_ack_num; // numeros sur 16 bits
+    if (simptcp_get_total_len(buf) > simptcp_get_head_len(buf)) {
+        // L'application ne lira plus : les donnees du pair sont acquittees et
+        // ignorees, pour qu'il puisse vider sa file et emettre son FIN.
+        if (simptcp_get_seq_num(buf) == expected)
+            sock->next_ack_num++;
+        send_simptcp_ack(sock);
+    }
+    else if (simptcp_get_seq_num(buf) == expected) {
         if ((flags & FIN) == FIN) {
 
-            // On envoie le ACK
-            sock->next_seq_num++;
-            char *pdu = simptcp_make_pdu(&sock->local_simptcp,
-                                         &sock->remote_simptcp,
-                                         NULL, // payload
-                                         0, // len
-                                         sock->next_seq_num, // seq
-                                         sock->next_ack_num, // ack
-                                         ACK);
-            memcpy(sock->out_buffer, pdu, simptcp_get_total_len(pdu));
-            free(pdu);
-            int res = libc_sendto(simptcp_entity.udp_fd,
-                                  sock->out_buffer,
-                                  simptcp_get_total_len(sock->out_buffer),
-                                  0,
-                                  (struct sockaddr *) &(sock->remote_udp),
-                                  sizeof(struct sockaddr_in));
-
-            if (res == -1) {
+            // Spécifie les bons numéros d'ack etc... : le FIN consomme un
+            // numero, l'ACK qui l'acquitte non.
+            sock->next_ack_num = simptcp_get_seq_num(buf) + 1;
+            // On envoie le ACK ; il sera re-emis si le FIN l'est.
+            if (send_simptcp_ack(sock) == -1) {
                 printf("ERROR: Sending FIN failed.\n");
                 return;
             }
 
-            // Spécifie les bons numéros d'ack etc...
-            sock->next_ack_num = simptcp_get_seq_num(buf) + 1;
             // On a reçu un ack of fin
             sock->socket_state = &(simptcp_entity.simptcp_socket_states->timewait);
             printf("***** FIN RECEIVED | ACK OF FIN SENT\n");
 
-            start_timer(sock, getTimeoutDuration(sock));
+            stop_timer(sock);
+            start_simptcp_timer(sock, SIMPTCP_TIMER_TIME_WAIT, SIMPTCP_TIME_WAIT_DURATION);
         }
     }
-    else {
+    else if (simptcp_seq_cmp(simptcp_get_seq_num(buf), expected) < 0) {
+        // Sonde de fenetre du pair : l'ACK porte la fenetre courante.
+        send_simptcp_ack(sock);
+    }
+    else if ((flags & FIN) == FIN) {
         printf("BAD SEQ : expected %d, got %d\n", expected, simptcp_get_seq_num(buf));
     }
 }
@@ -2328,10 +4015,9 @@ void finwait2_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
     printf("function %s called\n", __func__);
 #endif
     sock->socket_state = &(simptcp_entity.simptcp_socket_states->closed);
+    simptcp_demux_remove(sock);
 
-    // DELETE TCB.
-    free(sock->in_buffer);
-    free(sock->out_buffer);
+    // Le TCB est rendu au pool par close().
     stop_timer(sock);
 }
 
@@ -2675,8 +4361,11 @@ void lastack_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* so
 
     // ANCHOR LASTACK
     unsigned char flags = simptcp_get_flags(buf);
-    if (checkSequenceNumber(sock, buf) && ((flags & ACK) == ACK)) {
+    // L'ACK de notre FIN : un acquittement de donnees en retard n'y suffit pas.
+    if (checkSequenceNumber(sock, buf) && ((flags & ACK) == ACK) &&
+            (simptcp_get_ack_num(buf) == (u_int16_t) (sock->next_seq_num + 1))) {
         sock->socket_state = &(simptcp_entity.simptcp_socket_states->closed);
+        simptcp_demux_remove(sock);
         stop_timer(sock);
         printf("****** SOCKET CLOSED PROPERLY.\n");
     }
@@ -2859,6 +4548,13 @@ void timewait_simptcp_socket_state_process_simptcp_pdu (struct simptcp_socket* s
 #if __DEBUG__
     printf("function %s called\n", __func__);
 #endif
+
+    // FIN re-emis : l'ACK du FIN a ete perdu ; il est re-emis et l'attente
+    // recommence [RFC793].
+    if ((simptcp_get_flags(buf) & FIN) == FIN) {
+        send_simptcp_ack(sock);
+        start_simptcp_timer(sock, SIMPTCP_TIMER_TIME_WAIT, SIMPTCP_TIME_WAIT_DURATION);
+    }
 }
 
 /**
@@ -2877,7 +4573,8 @@ void timewait_simptcp_socket_state_handle_timeout (struct simptcp_socket* sock)
 
     // ANCHOR TIMEWAIT TIMEOUT
     sock->socket_state = &(simptcp_entity.simptcp_socket_states->closed);
-    stop_timer(sock);
+    simptcp_demux_remove(sock);
+    stop_simptcp_timer(sock, SIMPTCP_TIMER_TIME_WAIT);
 }
 
 
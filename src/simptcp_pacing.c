@@ -0,0 +1,265 @@
+/*! \file simptcp_pacing.c
+*  \brief{Pacing of the data PDUs with a token bucket per connection. The
+*  functions are called with the socket locked, but for simptcp_pacing_run
+*  (entity handler) and simptcp_pacing_remove. The round robin list is shared
+*  by all sockets; its mutex is taken after the socket mutex, never before.}
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <simptcp_pacing.h>
+#include <simptcp_lib.h>
+#include <simptcp_queue.h>
+#include <simptcp_packet.h>
+#include <simptcp_timer.h>
+#include <simptcp_entity.h>
+
+/* connections holding PDUs that their bucket can pay for, in round robin order */
+static struct simptcp_socket *pacing_head = NULL;
+static struct simptcp_socket *pacing_tail = NULL;
+static pthread_mutex_t pacing_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * \fn static void pacing_append(struct simptcp_socket *sock)
+ * \brief ajoute un socket en fin de tourniquet (sans effet s'il y est deja)
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+static void pacing_append(struct simptcp_socket *sock)
+{
+    pthread_mutex_lock(&pacing_mutex);
+    if (!sock->pacing_listed)
+    {
+        sock->pacing_listed = 1;
+        sock->pacing_next = NULL;
+        if (pacing_tail)
+            pacing_tail->pacing_next = sock;
+        else
+            pacing_head = sock;
+        pacing_tail = sock;
+    }
+    pthread_mutex_unlock(&pacing_mutex);
+}
+
+/*!
+ * \fn static struct simptcp_socket *pacing_pop()
+ * \brief retire le socket en tete du tourniquet
+ * \return socket retire, NULL si le tourniquet est vide
+ */
+static struct simptcp_socket *pacing_pop()
+{
+    struct simptcp_socket *sock;
+
+    pthread_mutex_lock(&pacing_mutex);
+    sock = pacing_head;
+    if (sock)
+    {
+        pacing_head = sock->pacing_next;
+        if (!pacing_head)
+            pacing_tail = NULL;
+        sock->pacing_listed = 0;
+        sock->pacing_next = NULL;
+    }
+    pthread_mutex_unlock(&pacing_mutex);
+    return sock;
+}
+
+/*!
+ * \fn double simptcp_pacing_rate(struct simptcp_socket *sock)
+ * \brief debit d'emission d'une connexion : celui du controle de congestion,
+ * borne par l'option SIMPTCP_MAX_PACING_RATE
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return debit en octets/s, 0 si la connexion n'est pas cadencee
+ */
+double simptcp_pacing_rate(struct simptcp_socket *sock)
+{
+    double rate = sock->pacing_rate;
+
+    if ((sock->max_pacing_rate > 0) &&
+            ((rate == 0) || (rate > sock->max_pacing_rate)))
+        rate = sock->max_pacing_rate;
+    return rate;
+}
+
+/*!
+ * \fn static void pacing_refill(struct simptcp_socket *sock, double rate, uint64_t now)
+ * \brief remplit le seau de jetons au debit de la connexion depuis son
+ * dernier remplissage, dans la limite de sa profondeur
+ * (#SIMPTCP_PACING_QUANTUM us au debit, au moins #SIMPTCP_PACING_MIN_BURST PDU)
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param rate debit de la connexion, en octets/s
+ * \param now date courante en us
+ */
+static void pacing_refill(struct simptcp_socket *sock, double rate, uint64_t now)
+{
+    double depth = rate * SIMPTCP_PACING_QUANTUM / 1e6;
+
+    if (depth < SIMPTCP_PACING_MIN_BURST * sock->rtx_queue.pdu_size)
+        depth = SIMPTCP_PACING_MIN_BURST * sock->rtx_queue.pdu_size;
+    sock->pacing_tokens += rate * (now - sock->pacing_stamp) / 1e6;
+    if (sock->pacing_tokens > depth)
+        sock->pacing_tokens = depth;
+    sock->pacing_stamp = now;
+}
+
+/*!
+ * \fn static void pacing_wait(struct simptcp_socket *sock, double rate, int len)
+ * \brief arme le timer de cadencement pour l'instant ou le seau pourra payer
+ * un PDU de len octets (au moins un tick)
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param rate debit de la connexion, en octets/s
+ * \param len taille du PDU en attente
+ */
+static void pacing_wait(struct simptcp_socket *sock, double rate, int len)
+{
+    double delay = (len - sock->pacing_tokens) / rate * 1000; /* ms */
+
+    start_simptcp_timer(sock, SIMPTCP_TIMER_PACING, delay < 1 ? 1 : (int) delay + 1);
+}
+
+/*!
+ * \fn static int pacing_release(struct simptcp_socket *sock)
+ * \brief emet le plus ancien PDU non encore emis de la file d'emission si les
+ * fenetres et le seau de la connexion le permettent
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return 1 si le PDU a ete emis, 0 si une fenetre est pleine (un ACK ou le
+ * timer de persistance relancera l'emission) ou si le seau est vide (timer
+ * arme), -1 si la file d'emission de l'entite est pleine
+ */
+static int pacing_release(struct simptcp_socket *sock)
+{
+    struct simptcp_queued_pdu *queued;
+    double rate = simptcp_pacing_rate(sock);
+
+    queued = simptcp_queue_at(&(sock->rtx_queue),
+                              sock->rtx_queue.count - sock->snd_unsent);
+    if (!simptcp_snd_allowed(sock, queued))
+    {
+        // Fenetre du recepteur fermee sans PDU en vol : aucun ACK ne la
+        // rouvrira, le timer de persistance la sonde.
+        simptcp_persist_arm(sock);
+        return 0;
+    }
+    if (rate > 0)
+    {
+        pacing_refill(sock, rate, simptcp_timer_now_us());
+        if (sock->pacing_tokens < queued->len)
+        {
+            pacing_wait(sock, rate, queued->len);
+            sock->simptcp_paced_count++;
+            return 0;
+        }
+        sock->pacing_tokens -= queued->len;
+    }
+    if (transmit_simptcp_pdu(sock, queued) < 0)
+        return -1;
+    return 1;
+}
+
+/*!
+ * \fn void simptcp_pacing_output(struct simptcp_socket *sock)
+ * \brief emet les PDU de la file d'emission que les fenetres et le seau de
+ * jetons de la connexion permettent ; appelee quand send() en ajoute et
+ * quand un ACK libere de la place dans les fenetres
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void simptcp_pacing_output(struct simptcp_socket *sock)
+{
+    int res = 0;
+
+    // Deja dans le tourniquet ou en attente de jetons : l'entite s'en charge.
+    if (sock->pacing_listed ||
+            simptcp_timer_pending(&(sock->timers[SIMPTCP_TIMER_PACING])))
+        return;
+    while ((sock->snd_unsent > 0) && ((res = pacing_release(sock)) > 0))
+        ;
+    if (res < 0)
+        // File d'emission pleine : nouvel essai au prochain tick.
+        start_simptcp_timer(sock, SIMPTCP_TIMER_PACING, 1);
+}
+
+/*!
+ * \fn void simptcp_pacing_charge(struct simptcp_socket *sock, int len)
+ * \brief une retransmission ne peut attendre le seau : elle est emise a
+ * crediter, les PDU retenus attendront d'autant plus
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param len taille du PDU retransmis
+ */
+void simptcp_pacing_charge(struct simptcp_socket *sock, int len)
+{
+    double rate = simptcp_pacing_rate(sock);
+
+    if (rate == 0)
+        return;
+    pacing_refill(sock, rate, simptcp_timer_now_us());
+    sock->pacing_tokens -= len;
+}
+
+/*!
+ * \fn void simptcp_pacing_handle_timeout(struct simptcp_socket *sock)
+ * \brief le seau de la connexion s'est rempli : elle reprend sa place dans le
+ * tourniquet
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void simptcp_pacing_handle_timeout(struct simptcp_socket *sock)
+{
+    if (sock->snd_unsent > 0)
+        pacing_append(sock);
+}
+
+/*!
+ * \fn void simptcp_pacing_remove(struct simptcp_socket *sock)
+ * \brief retire du tourniquet un socket libere
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void simptcp_pacing_remove(struct simptcp_socket *sock)
+{
+    struct simptcp_socket **link;
+
+    pthread_mutex_lock(&pacing_mutex);
+    if (sock->pacing_listed)
+    {
+        for (link = &pacing_head; *link != sock; link = &((*link)->pacing_next))
+            ;
+        *link = sock->pacing_next;
+        if (pacing_tail == sock)
+        {
+            pacing_tail = pacing_head;
+            while (pacing_tail && pacing_tail->pacing_next)
+                pacing_tail = pacing_tail->pacing_next;
+        }
+        sock->pacing_listed = 0;
+    }
+    pthread_mutex_unlock(&pacing_mutex);
+}
+
+/*!
+ * \fn void simptcp_pacing_run()
+ * \brief emet les PDU retenus que les seaux permettent, un PDU par connexion
+ * a chaque tour : une connexion rapide ne retarde pas les autres. Une
+ * connexion dont le seau est vide quitte le tourniquet jusqu'a l'expiration
+ * de son timer de cadencement.
+ */
+void simptcp_pacing_run()
+{
+    struct simptcp_socket *sock;
+    int res;
+
+    while ((sock = pacing_pop()) != NULL)
+    {
+        lock_simptcp_socket(sock);
+        if (sock->snd_unsent > 0)
+        {
+            res = pacing_release(sock);
+            if (res < 0)
+                // File d'emission pleine : nouvel essai au prochain tick.
+                start_simptcp_timer(sock, SIMPTCP_TIMER_PACING, 1);
+            else if ((res > 0) && (sock->snd_unsent > 0))
+                pacing_append(sock);
+        }
+        unlock_simptcp_socket(sock);
+    }
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -357,8 +357,8 @@ u_int16_t simptcp_extract_data (char * pdu, void * payload)
     return dlen;
 }
 
-/*! \fn char* simptcp_make_sender_pdu(struct simptcp_socket* sock, void * payload, u_int16_t payload_len,
- *  u_int16_t seq_num, u_int16_t ack_num, unsigned char flags)
+/*! \fn char* simptcp_make_pdu(struct sockaddr_in* src, struct sockaddr_in* dst, void * payload,
+ *  u_int16_t payload_len, u_int16_t seq_num, u_int16_t ack_num, unsigned char flags)
  * \brief create and returns the address of a pdu whose data is given as
  * argument.
  *
@@ -370,33 +370,338 @@ char* simptcp_make_pdu(struct sockaddr_in* src,
                        u_int16_t seq_num,
                        u_int16_t ack_num,
                        unsigned char flags)
+{
+    return simptcp_make_pdu_with_options(src, dst, payload, payload_len,
+                                         seq_num, ack_num, flags, NULL);
+}
+
+/*! \fn int simptcp_options_len (const struct simptcp_options * options)
+ * \brief taille en octets des options presentes (en-tetes et valeurs)
+ * \param options options du PDU, NULL si aucune
+ * \return taille en octets
+ */
+int simptcp_options_len (const struct simptcp_options * options)
+{
+    int len = 0;
+
+    if (options == NULL)
+        return 0;
+    if (options->present & SIMPTCP_MSS_OPTION)
+        len += SIMPTCP_MSS_OPTION_SIZE;
+    if (options->present & SIMPTCP_SACK_OPTION)
+        len += sizeof(simptcp_option_header) +
+               options->sack_blocks * 2 * sizeof(u_int16_t);
+    if (options->present & SIMPTCP_TS_OPTION)
+        len += SIMPTCP_TS_OPTION_SIZE;
+    if (options->present & SIMPTCP_WSCALE_OPTION)
+        len += SIMPTCP_WSCALE_OPTION_SIZE;
+    return len;
+}
+
+/*! \fn static int simptcp_options_count (const struct simptcp_options * options)
+ * \brief nombre d'options presentes (et donc d'en-tetes d'option)
+ */
+static int simptcp_options_count (const struct simptcp_options * options)
+{
+    int count = 0;
+
+    if (options->present & SIMPTCP_MSS_OPTION)
+        count++;
+    if (options->present & SIMPTCP_SACK_OPTION)
+        count++;
+    if (options->present & SIMPTCP_TS_OPTION)
+        count++;
+    if (options->present & SIMPTCP_WSCALE_OPTION)
+        count++;
+    return count;
+}
+
+/*! \fn char* simptcp_make_pdu_with_options(struct sockaddr_in* src, struct sockaddr_in* dst, void * payload,
+ *  u_int16_t payload_len, u_int16_t seq_num, u_int16_t ack_num, unsigned char flags,
+ *  const struct simptcp_options * options)
+ * \brief comme #simptcp_make_pdu, en ajoutant les options presentes a l'en-tete
+ * (voir #simptcp_write_pdu)
+ * \return PDU alloue (a liberer par l'appelant), NULL si echec
+ */
+char* simptcp_make_pdu_with_options(struct sockaddr_in* src,
+                                    struct sockaddr_in* dst,
+                                    void * payload,
+                                    u_int16_t payload_len,
+                                    u_int16_t seq_num,
+                                    u_int16_t ack_num,
+                                    unsigned char flags,
+                                    const struct simptcp_options * options)
 {
     // Alloue la mémoire pour le PDU entier (header + payload)
-    u_int16_t total_length = payload_len + sizeof(simptcp_generic_header);
-    char * pdu = malloc(total_length);
+    /* un octet de plus pour le bourrage du checksum */
+    char * pdu = malloc(sizeof(simptcp_generic_header) + simptcp_options_len(options) +
+                        payload_len + 1);
+
+    if (!pdu)
+        return NULL;
+    simptcp_write_pdu(pdu, src, dst, payload, payload_len, seq_num, ack_num,
+                      flags, options);
+    return pdu;
+}
+
+/*! \fn int simptcp_write_pdu(char * pdu, struct sockaddr_in* src, struct sockaddr_in* dst, void * payload,
+ *  u_int16_t payload_len, u_int16_t seq_num, u_int16_t ack_num, unsigned char flags,
+ *  const struct simptcp_options * options)
+ * \brief construit un PDU dans un tampon fourni par l'appelant, sans allocation.
+ * Les en-tetes des options suivent l'en-tete generique ; leurs valeurs suivent
+ * les en-tetes, dans le meme ordre.
+ * \param pdu tampon d'au moins la taille totale du PDU plus un octet (bourrage du checksum)
+ * \param options options du PDU, NULL si aucune
+ * \return taille totale en octets du PDU
+ */
+int simptcp_write_pdu(char * pdu,
+                      struct sockaddr_in* src,
+                      struct sockaddr_in* dst,
+                      void * payload,
+                      u_int16_t payload_len,
+                      u_int16_t seq_num,
+                      u_int16_t ack_num,
+                      unsigned char flags,
+                      const struct simptcp_options * options)
+{
+    u_int16_t header_length = sizeof(simptcp_generic_header) +
+                              simptcp_options_len(options);
+    u_int16_t total_length = payload_len + header_length;
+    simptcp_option_header *option;
+    char *value;
+    int i;
+
     simptcp_set_total_len(pdu, total_length);
-    simptcp_set_head_len(pdu, sizeof(simptcp_generic_header));
+    simptcp_set_head_len(pdu, header_length);
     simptcp_set_seq_num(pdu, seq_num);
     simptcp_set_ack_num(pdu, ack_num);
 
     simptcp_set_sport(pdu, ntohs(src->sin_port));
     simptcp_set_dport(pdu, ntohs(dst->sin_port));
 
-    // Taille maximale du buffer receveur : on prend la taille max d'un
-    // pdu du réseau.
-    simptcp_set_win_size(pdu, ETH_MTU);
+    // Espace libre du recepteur : fixe par le socket (simptcp_set_win_size)
+    // pour les PDU qui l'annoncent, sinon la taille max d'un pdu du reseau.
+    simptcp_set_win_size(pdu, SIMPTCP_DEFAULT_MTU);
     simptcp_set_flags(pdu, flags);
 
+    if (header_length > sizeof(simptcp_generic_header))
+    {
+        option = (simptcp_option_header *) (pdu + sizeof(simptcp_generic_header));
+        value = (char *) (option + simptcp_options_count(options));
+        if (options->present & SIMPTCP_MSS_OPTION)
+        {
+            option->option_kind = SIMPTCP_MSS_OPTION;
+            option->option_len = sizeof(u_int16_t);
+            *((u_int16_t *) value) = htons(options->mss);
+            value += sizeof(u_int16_t);
+            option++;
+        }
+        if (options->present & SIMPTCP_SACK_OPTION)
+        {
+            option->option_kind = SIMPTCP_SACK_OPTION;
+            option->option_len = options->sack_blocks * 2 * sizeof(u_int16_t);
+            for (i = 0; i < options->sack_blocks; i++)
+            {
+                ((u_int16_t *) value)[0] = htons(options->sack[i][0]);
+                ((u_int16_t *) value)[1] = htons(options->sack[i][1]);
+                value += 2 * sizeof(u_int16_t);
+            }
+            option++;
+        }
+        if (options->present & SIMPTCP_TS_OPTION)
+        {
+            option->option_kind = SIMPTCP_TS_OPTION;
+            option->option_len = 2 * sizeof(u_int32_t);
+            ((u_int32_t *) value)[0] = htonl(options->ts_val);
+            ((u_int32_t *) value)[1] = htonl(options->ts_ecr);
+            value += 2 * sizeof(u_int32_t);
+            option++;
+        }
+        if (options->present & SIMPTCP_WSCALE_OPTION)
+        {
+            option->option_kind = SIMPTCP_WSCALE_OPTION;
+            option->option_len = sizeof(unsigned char);
+            *((unsigned char *) value) = options->wscale;
+            value += sizeof(unsigned char);
+            option++;
+        }
+    }
 
     if (payload != NULL) {
-        memcpy((pdu + sizeof(simptcp_generic_header)), payload, payload_len);
+        memcpy((pdu + header_length), payload, payload_len);
     }
 
     simptcp_add_checksum(pdu, total_length);
 
+    return total_length;
+}
 
-    return pdu;
+/*! \fn int simptcp_get_options (const char *buffer, struct simptcp_options * options)
+ * \brief decode les options d'un PDU SimpTCP ; les options inconnues sont ignorees
+ * \param buffer pointeur sur PDU simptcp
+ * \param [out] options options presentes
+ * \return 0 si succes, -1 si les options sont mal formees
+ */
+int simptcp_get_options (const char *buffer, struct simptcp_options * options)
+{
+    int hlen = simptcp_get_head_len(buffer);
+    const simptcp_option_header *first, *last, *option;
+    const char *value;
+    int i, used;
+
+    memset(options, 0, sizeof(struct simptcp_options));
+    if ((hlen < sizeof(simptcp_generic_header)) || (hlen > simptcp_get_total_len(buffer)))
+        return -1;
+
+    /* the option headers end where their values fill the rest of the header */
+    first = (const simptcp_option_header *) (buffer + sizeof(simptcp_generic_header));
+    for (used = sizeof(simptcp_generic_header), option = first; used < hlen; option++)
+    {
+        if ((const char *) (option + 1) > buffer + hlen)
+            return -1;
+        used += sizeof(simptcp_option_header) + option->option_len;
+    }
+    if (used != hlen)
+        return -1;
+
+    last = option;
+    value = (const char *) last;
+    for (option = first; option < last; option++)
+    {
+        switch (option->option_kind)
+        {
+        case SIMPTCP_MSS_OPTION:
+            if (option->option_len != sizeof(u_int16_t))
+                return -1;
+            options->present |= SIMPTCP_MSS_OPTION;
+            options->mss = ntohs(*((const u_int16_t *) value));
+            break;
+        case SIMPTCP_SACK_OPTION:
+            options->present |= SIMPTCP_SACK_OPTION;
+            options->sack_blocks = option->option_len / (2 * sizeof(u_int16_t));
+            if (options->sack_blocks > SIMPTCP_MAX_SACK_BLOCKS)
+                options->sack_blocks = SIMPTCP_MAX_SACK_BLOCKS;
+            for (i = 0; i < options->sack_blocks; i++)
+            {
+                options->sack[i][0] = ntohs(*((const u_int16_t *) value + 2 * i));
+                options->sack[i][1] = ntohs(*((const u_int16_t *) value + 2 * i + 1));
+            }
+            break;
+        case SIMPTCP_TS_OPTION:
+            if (option->option_len != 2 * sizeof(u_int32_t))
+                return -1;
+            options->present |= SIMPTCP_TS_OPTION;
+            options->ts_val = ntohl(*((const u_int32_t *) value));
+            options->ts_ecr = ntohl(*((const u_int32_t *) value + 1));
+            break;
+        case SIMPTCP_WSCALE_OPTION:
+            if (option->option_len != sizeof(unsigned char))
+                return -1;
+            options->present |= SIMPTCP_WSCALE_OPTION;
+            options->wscale = *((const unsigned char *) value);
+            if (options->wscale > SIMPTCP_MAX_WSCALE)
+                options->wscale = SIMPTCP_MAX_WSCALE;
+            break;
+        default:
+            break;
+        }
+        value += option->option_len;
+    }
+    return 0;
+}
+
+/*! \fn static u_int16_t simptcp_bytes_sum(const char *bytes, int offset, int len)
+ * \brief contribution au checksum de len octets situes a offset dans le PDU :
+ * chaque octet compte dans la moitie du mot de 16 bits qu'il occupe
+ * \param bytes pointeur sur les octets
+ * \param offset position du premier octet dans le PDU
+ * \param len nombre d'octets
+ * \return somme sur 16 bits
+ */
+static u_int16_t simptcp_bytes_sum(const char *bytes, int offset, int len)
+{
+    u_int16_t sum = 0, word;
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        word = 0;
+        ((char *) &word)[(offset + i) & 1] = bytes[i];
+        sum += word;
+    }
+    return sum;
+}
+
+/*! \fn static void simptcp_patch_field(char *buffer, char *field, const void *value, int len)
+ * \brief remplace len octets d'un PDU construit et corrige son checksum de la
+ * difference (somme sur 16 bits : le reste du PDU n'est pas reparcouru)
+ * \param buffer pointeur sur PDU simptcp
+ * \param field pointeur sur le champ a remplacer, dans buffer
+ * \param value nouvelle valeur, dans l'ordre du reseau
+ * \param len taille du champ en octets
+ */
+static void simptcp_patch_field(char *buffer, char *field, const void *value, int len)
+{
+    simptcp_generic_header *header = (simptcp_generic_header *) buffer;
+    u_int16_t checksum;
+
+    checksum = ntohs(header->checksum) - simptcp_bytes_sum(field, field - buffer, len);
+    memcpy(field, value, len);
+    checksum += simptcp_bytes_sum(field, field - buffer, len);
+    header->checksum = htons(checksum);
+}
+
+/*! \fn void simptcp_update_ack (char *buffer, u_int16_t ack, u_int16_t window)
+ * \brief remplace le numero d'acquittement et la fenetre d'un PDU au moment
+ * de son emission (acquittement porte par un PDU de donnees) et corrige son
+ * checksum
+ * \param buffer pointeur sur PDU simptcp
+ * \param ack prochain PDU attendu
+ * \param window fenetre annoncee, deja mise a l'echelle
+ */
+void simptcp_update_ack (char *buffer, u_int16_t ack, u_int16_t window)
+{
+    simptcp_generic_header *header = (simptcp_generic_header *) buffer;
+
+    ack = htons(ack);
+    window = htons(window);
+    simptcp_patch_field(buffer, (char *) &(header->ack_num), &ack, sizeof(ack));
+    simptcp_patch_field(buffer, (char *) &(header->window_size), &window, sizeof(window));
 }
+
+/*! \fn int simptcp_update_ts (char *buffer, u_int32_t ts_val, u_int32_t ts_ecr)
+ * \brief remplace les valeurs de l'option timestamp d'un PDU au moment de son
+ * emission et corrige son checksum
+ * \param buffer pointeur sur PDU simptcp
+ * \param ts_val nouvelle date d'emission
+ * \param ts_ecr date renvoyee au pair
+ * \return 0 si succes, -1 si le PDU ne porte pas l'option timestamp
+ */
+int simptcp_update_ts (char *buffer, u_int32_t ts_val, u_int32_t ts_ecr)
+{
+    int hlen = simptcp_get_head_len(buffer);
+    simptcp_option_header *first, *last, *option;
+    u_int32_t ts[2];
+    char *value;
+    int used;
+
+    first = (simptcp_option_header *) (buffer + sizeof(simptcp_generic_header));
+    for (used = sizeof(simptcp_generic_header), last = first; used < hlen; last++)
+        used += sizeof(simptcp_option_header) + last->option_len;
+    for (option = first, value = (char *) last; option < last; option++)
+    {
+        if (option->option_kind == SIMPTCP_TS_OPTION)
+        {
+            ts[0] = htonl(ts_val);
+            ts[1] = htonl(ts_ecr);
+            simptcp_patch_field(buffer, value, ts, sizeof(ts));
+            return 0;
+        }
+        value += option->option_len;
+    }
+    return -1;
+}
+
 /*!
  * \fn void simptcp_lprint_packet (char * buf)
  * \brief Fonction pour afficher un paquet.
@@ -0,0 +1,275 @@
+/*! \file simptcp_pmtu.c
+*  \brief{Packetization layer path MTU discovery [RFC8899]. The search of a
+*  connection is run by its sender, with the socket locked; the cache of the
+*  PMTU per destination is shared by all sockets.}
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <simptcp_pmtu.h>
+#include <simptcp_packet.h>
+#include <simptcp_entity.h>
+#include <simptcp_timer.h>
+
+/*!
+ * \struct simptcp_pmtu_cache_entry
+ * \brief PMTU found toward a destination
+ */
+struct simptcp_pmtu_cache_entry
+{
+    in_addr_t addr; /*!< destination IPv4 address (network byte order) */
+    unsigned int pmtu; /*!< largest packet size acknowledged, 0 : free entry */
+    uint64_t expires; /*!< date in ms after which the entry is ignored */
+};
+
+static struct simptcp_pmtu_cache_entry pmtu_cache[SIMPTCP_PMTU_CACHE_SIZE];
+static pthread_mutex_t pmtu_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* payload of the probes (padding) */
+static char probe_padding[SIMPTCP_MTU_MSS(SIMPTCP_MAX_MTU)];
+
+/*!
+ * \fn unsigned int simptcp_pmtu_cache_lookup(struct in_addr addr)
+ * \brief renvoie la PMTU memorisee pour une destination
+ * \param addr adresse IPv4 de la destination
+ * \return PMTU en octets, 0 si inconnue ou perimee
+ */
+unsigned int simptcp_pmtu_cache_lookup(struct in_addr addr)
+{
+    struct simptcp_pmtu_cache_entry *entry;
+    unsigned int pmtu = 0;
+
+    entry = &(pmtu_cache[ntohl(addr.s_addr) % SIMPTCP_PMTU_CACHE_SIZE]);
+    pthread_mutex_lock(&pmtu_cache_mutex);
+    if ((entry->pmtu != 0) && (entry->addr == addr.s_addr) &&
+            (entry->expires > simptcp_timer_now()))
+        pmtu = entry->pmtu;
+    pthread_mutex_unlock(&pmtu_cache_mutex);
+    return pmtu;
+}
+
+/*!
+ * \fn void simptcp_pmtu_cache_update(struct in_addr addr, unsigned int pmtu)
+ * \brief memorise la PMTU trouvee pour une destination (remplace l'entree
+ * d'une autre destination de meme indice)
+ * \param addr adresse IPv4 de la destination
+ * \param pmtu PMTU en octets
+ */
+void simptcp_pmtu_cache_update(struct in_addr addr, unsigned int pmtu)
+{
+    struct simptcp_pmtu_cache_entry *entry;
+
+    entry = &(pmtu_cache[ntohl(addr.s_addr) % SIMPTCP_PMTU_CACHE_SIZE]);
+    pthread_mutex_lock(&pmtu_cache_mutex);
+    entry->addr = addr.s_addr;
+    entry->pmtu = pmtu;
+    entry->expires = simptcp_timer_now() + SIMPTCP_PMTU_CACHE_LIFETIME;
+    pthread_mutex_unlock(&pmtu_cache_mutex);
+}
+
+/*!
+ * \fn static void send_simptcp_probe(struct simptcp_socket *sock)
+ * \brief emet une sonde de pmtu_probe_size octets (paquet IP) et arme le timer
+ * de perte de la sonde
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+static void send_simptcp_probe(struct simptcp_socket *sock)
+{
+    char *pdu;
+
+    sock->pmtu_probe_id++;
+    sock->pmtu_probe_count++;
+    pdu = simptcp_make_pdu(&sock->local_simptcp,
+                           &sock->remote_simptcp,
+                           probe_padding,
+                           SIMPTCP_MTU_MSS(sock->pmtu_probe_size),
+                           sock->pmtu_probe_id, // seq : numero de la sonde
+                           sock->next_ack_num,
+                           PROBE);
+    if (pdu != NULL)
+    {
+        /* a probe too large for the local interface is dropped by the entity */
+        simptcp_entity_enqueue_pdu(pdu, simptcp_get_total_len(pdu), &(sock->remote_udp));
+        free(pdu);
+    }
+    start_simptcp_timer(sock, SIMPTCP_TIMER_PMTU, getTimeoutDuration(sock));
+}
+
+/*!
+ * \fn static void next_simptcp_probe(struct simptcp_socket *sock)
+ * \brief choisit la taille de la sonde suivante (recherche dichotomique entre
+ * plpmtu et pmtu_max) et l'emet ; si les bornes sont assez proches, la
+ * recherche est terminee : son resultat est memorise pour la destination et
+ * une nouvelle recherche est programmee
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+static void next_simptcp_probe(struct simptcp_socket *sock)
+{
+    sock->pmtu_probe_count = 0;
+    if (sock->pmtu_max < sock->plpmtu + SIMPTCP_PMTU_SEARCH_STEP)
+    {
+        sock->pmtu_probe_size = 0;
+        simptcp_pmtu_cache_update(sock->remote_udp.sin_addr, sock->plpmtu);
+#if __DEBUG__
+        printf("***** PMTU : %u bytes\n", sock->plpmtu);
+#endif
+        start_simptcp_timer(sock, SIMPTCP_TIMER_PMTU, SIMPTCP_PMTU_RAISE_TIMER);
+        return;
+    }
+    sock->pmtu_probe_size = (sock->plpmtu + sock->pmtu_max + 1) / 2;
+    send_simptcp_probe(sock);
+}
+
+/*!
+ * \fn void simptcp_pmtu_start(struct simptcp_socket *sock)
+ * \brief demarre la recherche de la PMTU d'une connexion etablie : depuis la
+ * PMTU memorisee pour la destination s'il y en a une (la recherche est alors
+ * terminee), sinon depuis #SIMPTCP_PMTU_BASE en sondant d'abord la taille
+ * permise par le MSS
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void simptcp_pmtu_start(struct simptcp_socket *sock)
+{
+    unsigned int cached = simptcp_pmtu_cache_lookup(sock->remote_udp.sin_addr);
+
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    sock->pmtu_max = SIMPTCP_MSS_MTU(sock->mss);
+    sock->plpmtu = sock->pmtu_max < SIMPTCP_PMTU_BASE ? sock->pmtu_max : SIMPTCP_PMTU_BASE;
+    if (cached != 0)
+    {
+        sock->plpmtu = cached < sock->pmtu_max ? cached : sock->pmtu_max;
+        sock->pmtu_max = sock->plpmtu;
+        next_simptcp_probe(sock);
+        return;
+    }
+    sock->pmtu_probe_count = 0;
+    sock->pmtu_probe_size = sock->pmtu_max;
+    if (sock->pmtu_max < sock->plpmtu + SIMPTCP_PMTU_SEARCH_STEP)
+        next_simptcp_probe(sock);
+    else
+        send_simptcp_probe(sock);
+}
+
+/*!
+ * \fn unsigned int simptcp_pmtu_mss(struct simptcp_socket *sock)
+ * \brief taille maximale de la charge utile (options comprises) des PDU de donnees
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \return MSS de la connexion, reduit a la PMTU trouvee
+ */
+unsigned int simptcp_pmtu_mss(struct simptcp_socket *sock)
+{
+    if ((sock->plpmtu == 0) || (SIMPTCP_MTU_MSS(sock->plpmtu) >= sock->mss))
+        return sock->mss;
+    return SIMPTCP_MTU_MSS(sock->plpmtu);
+}
+
+/*!
+ * \fn void simptcp_pmtu_process_probe(struct simptcp_socket *sock, const char *pdu, int len)
+ * \brief traite un PDU PROBE recu, quel que soit l'etat du socket : une sonde
+ * du pair est acquittee (sans consommer de numero de sequence) ; l'acquittement
+ * de la sonde en cours porte plpmtu a sa taille et la recherche continue
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ * \param pdu PDU recu
+ * \param len taille en octets du PDU
+ */
+void simptcp_pmtu_process_probe(struct simptcp_socket *sock, const char *pdu, int len)
+{
+    char *ack;
+
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    if ((simptcp_get_flags(pdu) & ACK) == 0)
+    {
+        ack = simptcp_make_pdu(&sock->local_simptcp,
+                               &sock->remote_simptcp,
+                               NULL, 0,
+                               sock->next_seq_num,
+                               simptcp_get_seq_num(pdu), // ack : numero de la sonde
+                               PROBE | ACK);
+        if (ack != NULL)
+        {
+            simptcp_entity_enqueue_pdu(ack, simptcp_get_total_len(ack), &(sock->remote_udp));
+            free(ack);
+        }
+        return;
+    }
+    if ((sock->pmtu_probe_size == 0) ||
+            (simptcp_get_ack_num(pdu) != sock->pmtu_probe_id))
+        return;
+    stop_simptcp_timer(sock, SIMPTCP_TIMER_PMTU);
+    sock->plpmtu = sock->pmtu_probe_size;
+    next_simptcp_probe(sock);
+}
+
+/*!
+ * \fn void simptcp_pmtu_handle_timeout(struct simptcp_socket *sock)
+ * \brief expiration du timer PMTU : la sonde en cours est re-emise, ou apres
+ * #SIMPTCP_PMTU_MAX_PROBES pertes sa taille devient la borne superieure de la
+ * recherche ; une fois la recherche terminee, une nouvelle recherche reprend
+ * depuis la PMTU trouvee jusqu'a la taille permise par le MSS
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void simptcp_pmtu_handle_timeout(struct simptcp_socket *sock)
+{
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    if (sock->socket_state != &(simptcp_entity.simptcp_socket_states->established))
+        return;
+    if (sock->pmtu_probe_size == 0)
+    {
+        sock->pmtu_max = SIMPTCP_MSS_MTU(sock->mss);
+        next_simptcp_probe(sock);
+    }
+    else if (sock->pmtu_probe_count < SIMPTCP_PMTU_MAX_PROBES)
+        send_simptcp_probe(sock);
+    else
+    {
+        sock->pmtu_max = sock->pmtu_probe_size - 1;
+        next_simptcp_probe(sock);
+    }
+}
+
+/*!
+ * \fn void simptcp_pmtu_black_hole(struct simptcp_socket *sock)
+ * \brief les PDU de donnees ne sont plus acquittes : la PMTU du chemin a pu
+ * diminuer. Les nouveaux PDU sont dimensionnes pour #SIMPTCP_PMTU_BASE et une
+ * recherche reprend en dessous de l'ancienne PMTU. Les PDU de la file
+ * d'emission sont redecoupes a la nouvelle taille et renumerotes
+ * (#repacketize_simptcp_queue) : re-emis tels quels, ils seraient perdus.
+ * \param sock pointeur sur les variables d'etat (#simptcp_socket) d'un socket simpTCP
+ */
+void simptcp_pmtu_black_hole(struct simptcp_socket *sock)
+{
+#if __DEBUG__
+    printf("function %s called\n", __func__);
+#endif
+
+    if (sock->plpmtu <= SIMPTCP_PMTU_BASE)
+        return;
+#if __DEBUG__
+    printf("***** PMTU black hole : %u bytes no longer acknowledged\n", sock->plpmtu);
+#endif
+    sock->pmtu_max = sock->plpmtu - 1;
+    sock->plpmtu = SIMPTCP_PMTU_BASE;
+    simptcp_pmtu_cache_update(sock->remote_udp.sin_addr, sock->plpmtu);
+    if (repacketize_simptcp_queue(sock) < 0)
+    {
+        // faute de memoire, la file garde ses PDU a l'ancienne taille
+#if __DEBUG__
+        printf("***** PMTU black hole : send queue kept, out of memory\n");
+#endif
+    }
+    next_simptcp_probe(sock);
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,418 @@
+/*! \file simptcp_queue.c
+*  \brief{Fixed size FIFO of simptcp PDUs (retransmission and receive queues).
+*  Queues belong to a socket and are only accessed with the socket locked,
+*  but for the receive ring : the entity pushes with the socket locked, the
+*  reader pops without lock.}
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>              /* for errno macros */
+
+#include <simptcp_queue.h>
+
+/*!
+ * \fn static struct simptcp_queued_pdu *simptcp_alloc_slots(unsigned int size, unsigned int pdu_size)
+ * \brief alloue en un seul bloc size elements suivis de leurs tampons de PDU
+ * \param size nombre d'elements
+ * \param pdu_size taille maximale en octets d'un PDU
+ * \return elements alloues, NULL si echec
+ */
+static struct simptcp_queued_pdu *simptcp_alloc_slots(unsigned int size,
+        unsigned int pdu_size)
+{
+    struct simptcp_queued_pdu *slots;
+    char *buffers;
+    unsigned int i;
+
+    /* one spare byte per PDU for the odd length checksum padding */
+    slots = malloc(size * (sizeof(struct simptcp_queued_pdu) + pdu_size + 1));
+    if (!slots)
+        return NULL;
+    buffers = (char *) (slots + size);
+    for (i = 0; i < size; i++)
+        slots[i].pdu = buffers + i * (pdu_size + 1);
+    return slots;
+}
+
+/*!
+ * \fn int simptcp_queue_init(struct simptcp_pdu_queue *queue, unsigned int size, unsigned int pdu_size)
+ * \brief alloue (ou re-dimensionne) une file vide de size PDU
+ * \param queue file a initialiser
+ * \param size capacite de la file en PDU
+ * \param pdu_size taille maximale en octets d'un PDU de la file
+ * \return -EINVAL si size ou pdu_size est nul, -EBUSY si la file n'est pas vide, -ENOMEM si echec, 0 sinon
+ */
+int simptcp_queue_init(struct simptcp_pdu_queue *queue, unsigned int size,
+                       unsigned int pdu_size)
+{
+    struct simptcp_queued_pdu *slots;
+
+    if ((size == 0) || (pdu_size == 0))
+        return -EINVAL;
+    if (queue->count > 0)
+        return -EBUSY;
+    if ((queue->slots != NULL) && (queue->size == size) &&
+            (queue->pdu_size == pdu_size))
+    {
+        queue->head = 0;
+        return 0;
+    }
+    slots = simptcp_alloc_slots(size, pdu_size);
+    if (!slots)
+        return -ENOMEM;
+    free(queue->slots);
+    queue->slots = slots;
+    queue->size = size;
+    queue->pdu_size = pdu_size;
+    queue->head = 0;
+    return 0;
+}
+
+/*!
+ * \fn void simptcp_queue_free(struct simptcp_pdu_queue *queue)
+ * \brief libere les PDU de la file (la file peut etre re-allouee par #simptcp_queue_init)
+ */
+void simptcp_queue_free(struct simptcp_pdu_queue *queue)
+{
+    free(queue->slots);
+    queue->slots = NULL;
+    queue->size = 0;
+    queue->pdu_size = 0;
+    queue->head = 0;
+    queue->count = 0;
+}
+
+/*!
+ * \fn struct simptcp_queued_pdu *simptcp_queue_push(struct simptcp_pdu_queue *queue, const char *pdu, int len, unsigned int seq)
+ * \brief ajoute une copie d'un PDU en fin de file
+ * \param queue file
+ * \param pdu PDU a copier
+ * \param len taille en octets du PDU
+ * \param seq numero de sequence du PDU
+ * \return element de la file contenant la copie, NULL si la file est pleine (ou non allouee)
+ */
+struct simptcp_queued_pdu *simptcp_queue_push(struct simptcp_pdu_queue *queue,
+        const char *pdu, int len, unsigned int seq)
+{
+    struct simptcp_queued_pdu *slot;
+
+    if ((queue->count == queue->size) || (len > queue->pdu_size))
+        return NULL;
+    slot = &(queue->slots[(queue->head + queue->count) % queue->size]);
+    memcpy(slot->pdu, pdu, len);
+    slot->len = len;
+    slot->seq = seq;
+    slot->sacked = 0;
+    slot->retransmitted = 0;
+    queue->count++;
+    return slot;
+}
+
+/*!
+ * \fn struct simptcp_queued_pdu *simptcp_queue_at(struct simptcp_pdu_queue *queue, unsigned int i)
+ * \brief renvoie le i-eme PDU de la file (0 : le plus ancien)
+ */
+struct simptcp_queued_pdu *simptcp_queue_at(struct simptcp_pdu_queue *queue,
+        unsigned int i)
+{
+    return &(queue->slots[(queue->head + i) % queue->size]);
+}
+
+/*!
+ * \fn void simptcp_queue_pop(struct simptcp_pdu_queue *queue)
+ * \brief retire le PDU le plus ancien de la file
+ */
+void simptcp_queue_pop(struct simptcp_pdu_queue *queue)
+{
+    if (queue->count == 0)
+        return;
+    queue->head = (queue->head + 1) % queue->size;
+    queue->count--;
+}
+
+/*!
+ * \fn unsigned int simptcp_queue_ack(struct simptcp_pdu_queue *queue, unsigned int ack)
+ * \brief acquittement cumulatif : retire de la file les PDU de numero de sequence
+ * strictement inferieur a ack (numero du prochain PDU attendu par le recepteur)
+ * \return nombre de PDU retires
+ */
+unsigned int simptcp_queue_ack(struct simptcp_pdu_queue *queue, unsigned int ack)
+{
+    unsigned int acked = 0;
+
+    while ((queue->count > 0) &&
+            (simptcp_seq_cmp(queue->slots[queue->head].seq, ack) < 0))
+    {
+        simptcp_queue_pop(queue);
+        acked++;
+    }
+    return acked;
+}
+
+/*!
+ * \fn int simptcp_ring_init(struct simptcp_pdu_ring *ring, unsigned int size, unsigned int pdu_size)
+ * \brief alloue (ou re-dimensionne) un anneau vide de size PDU ; appelee par
+ * le producteur quand le consommateur n'y accede pas (anneau vide)
+ * \param ring anneau a initialiser
+ * \param size capacite de l'anneau en PDU
+ * \param pdu_size taille maximale en octets d'un PDU de l'anneau
+ * \return -EINVAL si size ou pdu_size est nul, -EBUSY si l'anneau n'est pas vide, -ENOMEM si echec, 0 sinon
+ */
+int simptcp_ring_init(struct simptcp_pdu_ring *ring, unsigned int size,
+                      unsigned int pdu_size)
+{
+    struct simptcp_queued_pdu *slots;
+
+    if ((size == 0) || (pdu_size == 0))
+        return -EINVAL;
+    if (simptcp_ring_count(ring) > 0)
+        return -EBUSY;
+    if ((ring->slots != NULL) && (ring->size == size) &&
+            (ring->pdu_size == pdu_size))
+        return 0;
+    slots = simptcp_alloc_slots(size + 1, pdu_size);
+    if (!slots)
+        return -ENOMEM;
+    free(ring->slots);
+    ring->slots = slots;
+    ring->size = size;
+    ring->pdu_size = pdu_size;
+    ring->head = 0;
+    // Publie l'anneau : le consommateur lit tail avant les elements.
+    __atomic_store_n(&(ring->tail), 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*!
+ * \fn void simptcp_ring_free(struct simptcp_pdu_ring *ring)
+ * \brief libere les PDU de l'anneau (l'anneau peut etre re-alloue par #simptcp_ring_init)
+ */
+void simptcp_ring_free(struct simptcp_pdu_ring *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+    ring->size = 0;
+    ring->pdu_size = 0;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+/*!
+ * \fn unsigned int simptcp_ring_count(struct simptcp_pdu_ring *ring)
+ * \brief nombre de PDU de l'anneau ; exact pour le cote appelant, une borne
+ * (inferieure pour le consommateur, superieure pour le producteur) de ce que
+ * l'autre cote fait au meme instant
+ */
+unsigned int simptcp_ring_count(struct simptcp_pdu_ring *ring)
+{
+    unsigned int head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+    unsigned int tail = __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE);
+
+    if (ring->slots == NULL)
+        return 0;
+    return (tail + ring->size + 1 - head) % (ring->size + 1);
+}
+
+/*!
+ * \fn struct simptcp_queued_pdu *simptcp_ring_push(struct simptcp_pdu_ring *ring, const char *pdu, int len, unsigned int seq)
+ * \brief producteur : ajoute une copie d'un PDU en fin d'anneau ; le PDU
+ * n'est visible du consommateur qu'une fois copie
+ * \param ring anneau
+ * \param pdu PDU a copier
+ * \param len taille en octets du PDU
+ * \param seq numero de sequence du PDU
+ * \return element de l'anneau contenant la copie, NULL si l'anneau est plein (ou non alloue)
+ */
+struct simptcp_queued_pdu *simptcp_ring_push(struct simptcp_pdu_ring *ring,
+        const char *pdu, int len, unsigned int seq)
+{
+    struct simptcp_queued_pdu *slot;
+    unsigned int next;
+
+    if ((ring->slots == NULL) || (len > ring->pdu_size))
+        return NULL;
+    next = (ring->tail + 1) % (ring->size + 1);
+    // Le consommateur libere les elements : lecture de head en acquire.
+    if (next == __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE))
+        return NULL;
+    slot = &(ring->slots[ring->tail]);
+    memcpy(slot->pdu, pdu, len);
+    slot->len = len;
+    slot->seq = seq;
+    __atomic_store_n(&(ring->tail), next, __ATOMIC_RELEASE);
+    return slot;
+}
+
+/*!
+ * \fn struct simptcp_queued_pdu *simptcp_ring_peek(struct simptcp_pdu_ring *ring)
+ * \brief consommateur : renvoie le PDU le plus ancien de l'anneau
+ * \return PDU, NULL si l'anneau est vide
+ */
+struct simptcp_queued_pdu *simptcp_ring_peek(struct simptcp_pdu_ring *ring)
+{
+    unsigned int tail = __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE);
+
+    if ((ring->slots == NULL) || (ring->head == tail))
+        return NULL;
+    return &(ring->slots[ring->head]);
+}
+
+/*!
+ * \fn void simptcp_ring_pop(struct simptcp_pdu_ring *ring)
+ * \brief consommateur : retire le PDU le plus ancien de l'anneau, dont
+ * l'element est rendu au producteur
+ */
+void simptcp_ring_pop(struct simptcp_pdu_ring *ring)
+{
+    if (simptcp_ring_peek(ring) == NULL)
+        return;
+    __atomic_store_n(&(ring->head), (ring->head + 1) % (ring->size + 1),
+                     __ATOMIC_RELEASE);
+}
+
+/*!
+ * \fn int simptcp_reorder_init(struct simptcp_reorder_buffer *buffer, unsigned int size, unsigned int pdu_size)
+ * \brief alloue (ou re-dimensionne) un tampon de re-ordonnancement vide de size PDU
+ * \param buffer tampon a initialiser
+ * \param size capacite du tampon en PDU (fenetre de reception)
+ * \param pdu_size taille maximale en octets d'un PDU du tampon
+ * \return -EINVAL si size ou pdu_size est nul, -EBUSY si le tampon n'est pas vide, -ENOMEM si echec, 0 sinon
+ */
+int simptcp_reorder_init(struct simptcp_reorder_buffer *buffer, unsigned int size,
+                         unsigned int pdu_size)
+{
+    struct simptcp_queued_pdu *slots;
+    unsigned int i;
+
+    if ((size == 0) || (pdu_size == 0))
+        return -EINVAL;
+    if (buffer->count > 0)
+        return -EBUSY;
+    if ((buffer->slots == NULL) || (buffer->size != size) ||
+            (buffer->pdu_size != pdu_size))
+    {
+        slots = simptcp_alloc_slots(size, pdu_size);
+        if (!slots)
+            return -ENOMEM;
+        free(buffer->slots);
+        buffer->slots = slots;
+        buffer->size = size;
+        buffer->pdu_size = pdu_size;
+    }
+    for (i = 0; i < size; i++)
+        buffer->slots[i].len = 0;
+    buffer->head = 0;
+    return 0;
+}
+
+/*!
+ * \fn void simptcp_reorder_free(struct simptcp_reorder_buffer *buffer)
+ * \brief libere les PDU du tampon de re-ordonnancement
+ */
+void simptcp_reorder_free(struct simptcp_reorder_buffer *buffer)
+{
+    free(buffer->slots);
+    buffer->slots = NULL;
+    buffer->size = 0;
+    buffer->pdu_size = 0;
+    buffer->head = 0;
+    buffer->count = 0;
+}
+
+/*!
+ * \fn int simptcp_reorder_store(struct simptcp_reorder_buffer *buffer, unsigned int offset, const char *pdu, int len, unsigned int seq)
+ * \brief conserve une copie d'un PDU recu hors sequence
+ * \param buffer tampon de re-ordonnancement
+ * \param offset ecart entre le numero de sequence du PDU et celui du PDU attendu
+ * \param pdu PDU a copier
+ * \param len taille en octets du PDU
+ * \param seq numero de sequence du PDU
+ * \return 1 si le PDU est conserve, 0 s'il l'etait deja, -1 s'il est hors de la fenetre
+ */
+int simptcp_reorder_store(struct simptcp_reorder_buffer *buffer, unsigned int offset,
+                          const char *pdu, int len, unsigned int seq)
+{
+    struct simptcp_queued_pdu *slot;
+
+    if ((offset >= buffer->size) || (len > buffer->pdu_size))
+        return -1;
+    slot = &(buffer->slots[(buffer->head + offset) % buffer->size]);
+    if (slot->len > 0)
+        return 0;
+    memcpy(slot->pdu, pdu, len);
+    slot->len = len;
+    slot->seq = seq;
+    buffer->count++;
+    return 1;
+}
+
+/*!
+ * \fn struct simptcp_queued_pdu *simptcp_reorder_first(struct simptcp_reorder_buffer *buffer)
+ * \brief renvoie le PDU attendu s'il a deja ete recu, NULL sinon
+ */
+struct simptcp_queued_pdu *simptcp_reorder_first(struct simptcp_reorder_buffer *buffer)
+{
+    struct simptcp_queued_pdu *slot;
+
+    if (buffer->count == 0)
+        return NULL;
+    slot = &(buffer->slots[buffer->head]);
+    return (slot->len > 0) ? slot : NULL;
+}
+
+/*!
+ * \fn void simptcp_reorder_advance(struct simptcp_reorder_buffer *buffer)
+ * \brief le PDU suivant devient le PDU attendu ; le PDU attendu, s'il etait
+ * conserve, est retire du tampon
+ */
+void simptcp_reorder_advance(struct simptcp_reorder_buffer *buffer)
+{
+    if (buffer->slots == NULL)
+        return;
+    if (buffer->slots[buffer->head].len > 0)
+    {
+        buffer->slots[buffer->head].len = 0;
+        buffer->count--;
+    }
+    buffer->head = (buffer->head + 1) % buffer->size;
+}
+
+/*!
+ * \fn int simptcp_reorder_sack_blocks(struct simptcp_reorder_buffer *buffer, unsigned int base, u_int16_t blocks[][2], int max_blocks)
+ * \brief calcule les blocs de PDU consecutifs conserves (du plus ancien au plus recent)
+ * \param buffer tampon de re-ordonnancement
+ * \param base numero de sequence du PDU attendu
+ * \param [out] blocks premier et suivant le dernier numero de sequence de chaque bloc
+ * \param max_blocks nombre maximal de blocs
+ * \return nombre de blocs
+ */
+int simptcp_reorder_sack_blocks(struct simptcp_reorder_buffer *buffer, unsigned int base,
+                                u_int16_t blocks[][2], int max_blocks)
+{
+    unsigned int offset, seen = 0;
+    int held, in_block = 0, n = 0;
+
+    for (offset = 1; (offset < buffer->size) && (seen < buffer->count); offset++)
+    {
+        held = buffer->slots[(buffer->head + offset) % buffer->size].len > 0;
+        if (held && !in_block)
+        {
+            if (n == max_blocks)
+                break;
+            blocks[n][0] = base + offset;
+            in_block = 1;
+        }
+        else if (!held && in_block)
+        {
+            blocks[n++][1] = base + offset;
+            in_block = 0;
+        }
+        seen += held;
+    }
+    if (in_block)
+        blocks[n++][1] = base + offset;
+    return n;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */
@@ -0,0 +1,376 @@
+/*! \file simptcp_timer.c
+*  \brief{Hashed hierarchical timer wheel of the simptcp entity.
+*  Level l holds the timers expiring within 64^(l+1) ticks of the current
+*  tick, hashed on the l-th group of 6 bits of their expiry date; a level is
+*  cascaded into the lower ones each time the lower ones wrap around. Arming
+*  and cancelling are O(1); the entity handler advances the wheel once per
+*  iteration and only visits the timers that are due.}
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <simptcp_timer.h>
+
+#define WHEEL_MASK (SIMPTCP_TIMER_WHEEL_SIZE - 1)
+#define LEVEL_SHIFT(l) ((l) * SIMPTCP_TIMER_WHEEL_BITS)
+#define EXPIRED_LEVEL SIMPTCP_TIMER_WHEEL_LEVELS /* level value of expired timers */
+
+/*!
+ * \struct simptcp_timer_wheel
+ * \brief roues de timers : une liste par slot, une bitmap des slots occupes par niveau
+ */
+struct simptcp_timer_wheel
+{
+    struct simptcp_timer *slots[SIMPTCP_TIMER_WHEEL_LEVELS][SIMPTCP_TIMER_WHEEL_SIZE];
+    uint64_t occupied[SIMPTCP_TIMER_WHEEL_LEVELS]; /*!< bit s set if slot s is not empty */
+    struct simptcp_timer *expired; /*!< due timers not yet handled */
+    uint64_t base; /*!< next tick to process */
+};
+
+static struct simptcp_timer_wheel wheel;
+/* timers are armed by the application threads and the entity handler */
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * \fn uint64_t simptcp_timer_now()
+ * \brief date courante (CLOCK_MONOTONIC) en ms
+ */
+uint64_t simptcp_timer_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*!
+ * \fn uint64_t simptcp_timer_now_us()
+ * \brief date courante (CLOCK_MONOTONIC) en us, pour la mesure des RTT
+ */
+uint64_t simptcp_timer_now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*!
+ * \fn void simptcp_timer_wheel_init(uint64_t now)
+ * \brief vide la roue et fixe son premier tick
+ * \param now date courante en ms
+ */
+void simptcp_timer_wheel_init(uint64_t now)
+{
+    pthread_mutex_lock(&wheel_mutex);
+    memset(&wheel, 0, sizeof(wheel));
+    wheel.base = now;
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+/*!
+ * \fn void simptcp_timer_init(struct simptcp_socket *sock, struct simptcp_timer *timers)
+ * \brief initialise les #SIMPTCP_TIMER_KINDS timers d'un socket (desarmes)
+ * \param sock socket proprietaire
+ * \param timers tableau des timers du socket
+ */
+void simptcp_timer_init(struct simptcp_socket *sock, struct simptcp_timer *timers)
+{
+    int kind;
+
+    for (kind = 0; kind < SIMPTCP_TIMER_KINDS; kind++)
+    {
+        timers[kind].next = NULL;
+        timers[kind].pprev = NULL;
+        timers[kind].expires = 0;
+        timers[kind].sock = sock;
+        timers[kind].kind = kind;
+    }
+}
+
+/*!
+ * \fn static void link_timer(struct simptcp_timer **head, struct simptcp_timer *timer)
+ * \brief insere un timer en tete d'une liste
+ */
+static void link_timer(struct simptcp_timer **head, struct simptcp_timer *timer)
+{
+    timer->next = *head;
+    if (timer->next != NULL)
+        timer->next->pprev = &(timer->next);
+    timer->pprev = head;
+    *head = timer;
+}
+
+/*!
+ * \fn static void unlink_timer(struct simptcp_timer *timer)
+ * \brief retire un timer arme de sa liste et met a jour la bitmap de son niveau
+ */
+static void unlink_timer(struct simptcp_timer *timer)
+{
+    *(timer->pprev) = timer->next;
+    if (timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+    if ((timer->level != EXPIRED_LEVEL) &&
+            (wheel.slots[timer->level][timer->slot] == NULL))
+        wheel.occupied[timer->level] &= ~(1ULL << timer->slot);
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/*!
+ * \fn static void insert_timer(struct simptcp_timer *timer)
+ * \brief range un timer dans le niveau correspondant a son echeance
+ * (directement dans la liste des timers echus si elle est depassee)
+ */
+static void insert_timer(struct simptcp_timer *timer)
+{
+    uint64_t expires = timer->expires;
+    uint64_t delta;
+    int level;
+
+    if (expires < wheel.base)
+    {
+        timer->level = EXPIRED_LEVEL;
+        link_timer(&(wheel.expired), timer);
+        return;
+    }
+    delta = expires - wheel.base;
+    for (level = 0; level < SIMPTCP_TIMER_WHEEL_LEVELS - 1; level++)
+    {
+        if (delta < (1ULL << LEVEL_SHIFT(level + 1)))
+            break;
+    }
+    if (delta >= (1ULL << LEVEL_SHIFT(level + 1)))
+        /* beyond the wheel range : park it at the farthest slot, it is
+           re-hashed when that slot is cascaded */
+        expires = wheel.base + (1ULL << LEVEL_SHIFT(level + 1)) - 1;
+
+    timer->level = level;
+    timer->slot = (expires >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+    link_timer(&(wheel.slots[level][timer->slot]), timer);
+    wheel.occupied[level] |= 1ULL << timer->slot;
+}
+
+/*!
+ * \fn void simptcp_timer_arm(struct simptcp_timer *timer, int duration)
+ * \brief arme (ou re-arme) un timer pour qu'il expire dans duration ms
+ * \param timer timer a armer
+ * \param duration duree en ms (une duree negative vaut 0)
+ */
+void simptcp_timer_arm(struct simptcp_timer *timer, int duration)
+{
+    uint64_t now = simptcp_timer_now();
+
+    pthread_mutex_lock(&wheel_mutex);
+    if (timer->pprev != NULL)
+        unlink_timer(timer);
+    timer->expires = now + (duration > 0 ? duration : 0);
+    insert_timer(timer);
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+/*!
+ * \fn void simptcp_timer_cancel(struct simptcp_timer *timer)
+ * \brief desarme un timer (sans effet s'il n'est pas arme)
+ * \param timer timer a desarmer
+ */
+void simptcp_timer_cancel(struct simptcp_timer *timer)
+{
+    pthread_mutex_lock(&wheel_mutex);
+    if (timer->pprev != NULL)
+        unlink_timer(timer);
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+/*!
+ * \fn int simptcp_timer_pending(struct simptcp_timer *timer)
+ * \brief indique si un timer est arme
+ * \return 1 si le timer est arme, 0 sinon
+ */
+int simptcp_timer_pending(struct simptcp_timer *timer)
+{
+    int res;
+
+    pthread_mutex_lock(&wheel_mutex);
+    res = (timer->pprev != NULL);
+    pthread_mutex_unlock(&wheel_mutex);
+    return res;
+}
+
+/*!
+ * \fn static void cascade(int level, int slot)
+ * \brief redistribue les timers d'un slot dans les niveaux inferieurs
+ */
+static void cascade(int level, int slot)
+{
+    struct simptcp_timer *timer = wheel.slots[level][slot];
+    struct simptcp_timer *next;
+
+    wheel.slots[level][slot] = NULL;
+    wheel.occupied[level] &= ~(1ULL << slot);
+    for (; timer != NULL; timer = next)
+    {
+        next = timer->next;
+        insert_timer(timer);
+    }
+}
+
+/*!
+ * \fn static int wheel_is_empty()
+ * \brief indique si aucun timer n'est range dans la roue
+ */
+static int wheel_is_empty()
+{
+    int level;
+
+    for (level = 0; level < SIMPTCP_TIMER_WHEEL_LEVELS; level++)
+    {
+        if (wheel.occupied[level] != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/*!
+ * \fn static void advance_wheel(uint64_t now)
+ * \brief traite tous les ticks jusqu'a now : les timers echus passent dans la
+ * liste expired. Les ticks sans timer de niveau 0 sont sautes jusqu'au prochain
+ * tour du niveau 0, ou directement jusqu'a now si la roue est vide.
+ */
+static void advance_wheel(uint64_t now)
+{
+    struct simptcp_timer *timer;
+    struct simptcp_timer *next;
+    uint64_t boundary;
+    int level, slot;
+
+    while (wheel.base <= now)
+    {
+        if (wheel_is_empty())
+        {
+            wheel.base = now + 1;
+            break;
+        }
+        slot = wheel.base & WHEEL_MASK;
+        if (slot == 0)
+        {
+            /* the lower level wrapped around : cascade the next slot of the
+               upper levels, as long as they wrap too */
+            for (level = 1; level < SIMPTCP_TIMER_WHEEL_LEVELS; level++)
+            {
+                slot = (wheel.base >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+                cascade(level, slot);
+                if (slot != 0)
+                    break;
+            }
+            slot = 0;
+        }
+        else if (wheel.occupied[0] == 0)
+        {
+            /* nothing before the next wrap around of level 0 */
+            boundary = (wheel.base | WHEEL_MASK) + 1;
+            wheel.base = (boundary <= now) ? boundary : now + 1;
+            continue;
+        }
+
+        timer = wheel.slots[0][slot];
+        wheel.slots[0][slot] = NULL;
+        wheel.occupied[0] &= ~(1ULL << slot);
+        for (; timer != NULL; timer = next)
+        {
+            next = timer->next;
+            timer->level = EXPIRED_LEVEL;
+            link_timer(&(wheel.expired), timer);
+        }
+        wheel.base++;
+    }
+}
+
+/*!
+ * \fn struct simptcp_timer *simptcp_timer_next_expired(uint64_t now)
+ * \brief fait avancer la roue jusqu'a now et renvoie un timer echu, desarme.
+ * A appeler en boucle jusqu'a obtenir NULL : un timer annule ou re-arme entre
+ * deux appels (par exemple par le traitement du precedent) n'est pas renvoye.
+ * \param now date courante en ms
+ * \return timer echu, NULL s'il n'y en a plus
+ */
+struct simptcp_timer *simptcp_timer_next_expired(uint64_t now)
+{
+    struct simptcp_timer *timer;
+
+    pthread_mutex_lock(&wheel_mutex);
+    advance_wheel(now);
+    timer = wheel.expired;
+    if (timer != NULL)
+        unlink_timer(timer);
+    pthread_mutex_unlock(&wheel_mutex);
+    return timer;
+}
+
+/*!
+ * \fn static int first_slot(uint64_t occupied, int from)
+ * \brief distance (0..63) entre le slot from et le premier slot occupe qui le suit
+ */
+static int first_slot(uint64_t occupied, int from)
+{
+    uint64_t rotated = from ? (occupied >> from) | (occupied << (SIMPTCP_TIMER_WHEEL_SIZE - from))
+                       : occupied;
+
+    return __builtin_ctzll(rotated);
+}
+
+/*!
+ * \fn int64_t simptcp_timer_next_expiry(uint64_t now)
+ * \brief delai avant le prochain tick ou la roue a du travail : echeance d'un
+ * timer de niveau 0, ou cascade d'un slot occupe d'un niveau superieur
+ * \param now date courante en ms
+ * \return delai en ms (0 si des timers sont deja echus), -1 si aucun timer n'est arme
+ */
+int64_t simptcp_timer_next_expiry(uint64_t now)
+{
+    uint64_t next = UINT64_MAX;
+    uint64_t occupied;
+    uint64_t cursor;
+    uint64_t tick;
+    int level, slot;
+
+    pthread_mutex_lock(&wheel_mutex);
+    if (wheel.expired != NULL)
+    {
+        pthread_mutex_unlock(&wheel_mutex);
+        return 0;
+    }
+    for (level = 0; level < SIMPTCP_TIMER_WHEEL_LEVELS; level++)
+    {
+        if (wheel.occupied[level] == 0)
+            continue;
+        occupied = wheel.occupied[level];
+        cursor = wheel.base >> LEVEL_SHIFT(level);
+        slot = cursor & WHEEL_MASK;
+        if (((cursor << LEVEL_SHIFT(level)) < wheel.base) && (occupied & (1ULL << slot)))
+        {
+            /* current slot of an upper level, already cascaded for this turn :
+               its timers are due one turn later */
+            tick = (cursor + SIMPTCP_TIMER_WHEEL_SIZE) << LEVEL_SHIFT(level);
+            if (tick < next)
+                next = tick;
+            occupied &= ~(1ULL << slot);
+            if (occupied == 0)
+                continue;
+        }
+        tick = (cursor + first_slot(occupied, slot)) << LEVEL_SHIFT(level);
+        if (tick < next)
+            next = tick;
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+
+    if (next == UINT64_MAX)
+        return -1;
+    return (next > now) ? (int64_t) (next - now) : 0;
+}
+
+/* vim: set expandtab ts=4 sw=4 tw=80: */